@@ -0,0 +1,122 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include "macro_define.hpp"
+#include "noncopyable.hpp"
+#include "rwlock.hpp"
+
+namespace moon
+{
+    /*
+    Global string vocabulary, each string gets a small integer id(atom), ids start at 1 and are never released.
+    name/extra are lock-free, intern/find take a read-write lock.
+    extra is an opaque pointer for the script layer, e.g. the shared lua string of the atom.
+    */
+    class atom_table : public moon::noncopyable
+    {
+    public:
+        //same as LUAI_MAXSHORTLEN, atoms are lua short strings
+        static const size_t MAX_ATOM_LEN = 40;
+        static const uint32_t MAX_ATOM_NUM = 4096;
+
+        atom_table()
+            :size_(0)
+        {
+        }
+
+        //return 0 if name is too long or the table is full
+        uint32_t intern(string_view_t name)
+        {
+            uint32_t id = find(name);
+            if (0 != id || name.size() > MAX_ATOM_LEN || name.empty())
+            {
+                return id;
+            }
+
+            std::unique_lock<rwlock> lk(lock_);
+            auto iter = ids_.find(std::string(name.data(), name.size()));
+            if (iter != ids_.end())
+            {
+                return iter->second;
+            }
+
+            id = size_.load(std::memory_order_relaxed) + 1;
+            if (id > MAX_ATOM_NUM)
+            {
+                return 0;
+            }
+            entries_[id].name = std::string(name.data(), name.size());
+            ids_.emplace(entries_[id].name, id);
+            size_.store(id, std::memory_order_release);
+            return id;
+        }
+
+        uint32_t find(string_view_t name) const
+        {
+            if (name.size() > MAX_ATOM_LEN || 0 == size_.load(std::memory_order_acquire))
+            {
+                return 0;
+            }
+            std::shared_lock<rwlock> lk(lock_);
+            auto iter = ids_.find(std::string(name.data(), name.size()));
+            return (iter != ids_.end()) ? iter->second : 0;
+        }
+
+        const std::string& name(uint32_t id) const
+        {
+            static const std::string empty;
+            if (0 == id || id > size_.load(std::memory_order_acquire))
+            {
+                return empty;
+            }
+            return entries_[id].name;
+        }
+
+        const void* extra(uint32_t id) const
+        {
+            if (0 == id || id > size_.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+            return entries_[id].extra.load(std::memory_order_acquire);
+        }
+
+        void set_extra(uint32_t id, const void* v)
+        {
+            if (0 == id || id > size_.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            entries_[id].extra.store(v, std::memory_order_release);
+        }
+
+        uint32_t size() const
+        {
+            return size_.load(std::memory_order_acquire);
+        }
+
+    private:
+        struct entry
+        {
+            entry()
+                :extra(nullptr)
+            {
+            }
+
+            std::string name;
+            std::atomic<const void*> extra;
+        };
+
+        std::atomic<uint32_t> size_;
+        mutable rwlock lock_;
+        std::unordered_map<std::string, uint32_t> ids_;
+        entry entries_[MAX_ATOM_NUM + 1];
+    };
+}
@@ -0,0 +1,255 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include "noncopyable.hpp"
+
+namespace moon
+{
+    /*
+    Per-thread size-classed block cache, each worker thread owns one.
+    Size classes are powers of two from MIN_BLOCK_SIZE to MAX_BLOCK_SIZE, bigger blocks go to the heap directly.
+    A block can be freed by any thread, it goes to the freeing thread's cache.
+    Each class caches at most CLASS_CACHE_BYTES, the rest are returned to the heap, so producer/consumer threads can not hoard memory.
+    */
+    class block_pool : public moon::noncopyable
+    {
+    public:
+        static const size_t MIN_BLOCK_BITS = 6;
+        static const size_t MIN_BLOCK_SIZE = size_t(1) << MIN_BLOCK_BITS;
+        static const size_t CLASS_NUM = 8;
+        static const size_t MAX_BLOCK_SIZE = MIN_BLOCK_SIZE << (CLASS_NUM - 1);
+        static const size_t CLASS_CACHE_BYTES = 512 * 1024;
+
+        struct stats
+        {
+            //all allocate calls
+            uint64_t allocs;
+            //allocations served by the cache
+            uint64_t hits;
+            //allocations which called operator new
+            uint64_t heap_allocs;
+            uint64_t frees;
+            //frees which called operator delete
+            uint64_t heap_frees;
+            size_t cached_bytes;
+        };
+
+        //return the real capacity of the block
+        static size_t block_size(size_t n)
+        {
+            if (n > MAX_BLOCK_SIZE)
+            {
+                return n;
+            }
+            return MIN_BLOCK_SIZE << class_index(n);
+        }
+
+        //capacity(optional) receives the real block size, which must be passed back to deallocate
+        static void* allocate(size_t n, size_t* capacity = nullptr)
+        {
+            size_t size = block_size(n);
+            if (nullptr != capacity)
+            {
+                *capacity = size;
+            }
+
+            auto pool = local();
+            if (nullptr == pool)
+            {
+                return ::operator new(size);
+            }
+
+            ++pool->stats_.allocs;
+            if (size <= MAX_BLOCK_SIZE)
+            {
+                auto& fl = pool->free_[class_index(size)];
+                if (nullptr != fl.head)
+                {
+                    free_block* b = fl.head;
+                    fl.head = b->next;
+                    --fl.count;
+                    pool->stats_.cached_bytes -= size;
+                    ++pool->stats_.hits;
+                    return b;
+                }
+            }
+            ++pool->stats_.heap_allocs;
+            return ::operator new(size);
+        }
+
+        static void deallocate(void* p, size_t capacity)
+        {
+            if (nullptr == p)
+            {
+                return;
+            }
+
+            auto pool = local();
+            if (nullptr == pool)
+            {
+                ::operator delete(p);
+                return;
+            }
+
+            ++pool->stats_.frees;
+            if (capacity <= MAX_BLOCK_SIZE)
+            {
+                auto& fl = pool->free_[class_index(capacity)];
+                if ((fl.count + 1)*capacity <= CLASS_CACHE_BYTES)
+                {
+                    auto b = static_cast<free_block*>(p);
+                    b->next = fl.head;
+                    fl.head = b;
+                    ++fl.count;
+                    pool->stats_.cached_bytes += capacity;
+                    return;
+                }
+            }
+            ++pool->stats_.heap_frees;
+            ::operator delete(p);
+        }
+
+        //stats of the calling thread's pool
+        static stats local_stats()
+        {
+            auto pool = local();
+            if (nullptr == pool)
+            {
+                return stats{};
+            }
+            return pool->stats_;
+        }
+
+    private:
+        struct free_block
+        {
+            free_block* next;
+        };
+
+        struct free_list
+        {
+            free_block* head;
+            size_t count;
+        };
+
+        struct tls_state
+        {
+            block_pool* pool;
+            bool dead;
+        };
+
+        //release the cache when the thread exits, blocks freed after that go to the heap directly
+        struct tls_guard
+        {
+            ~tls_guard()
+            {
+                auto& s = state();
+                delete s.pool;
+                s.pool = nullptr;
+                s.dead = true;
+            }
+        };
+
+        block_pool()
+            :stats_{}
+            , free_{}
+        {
+        }
+
+        ~block_pool()
+        {
+            for (auto& fl : free_)
+            {
+                while (nullptr != fl.head)
+                {
+                    free_block* b = fl.head;
+                    fl.head = b->next;
+                    ::operator delete(b);
+                }
+            }
+        }
+
+        static size_t class_index(size_t n)
+        {
+            size_t idx = 0;
+            size_t size = MIN_BLOCK_SIZE;
+            while (size < n)
+            {
+                size <<= 1;
+                ++idx;
+            }
+            return idx;
+        }
+
+        //trivially destructible, still readable while other thread_local objects are destroyed
+        static tls_state& state()
+        {
+            static thread_local tls_state s{ nullptr, false };
+            return s;
+        }
+
+        static block_pool* local()
+        {
+            auto& s = state();
+            if (nullptr != s.pool || s.dead)
+            {
+                return s.pool;
+            }
+            static thread_local tls_guard guard;
+            (void)guard;
+            s.pool = new block_pool();
+            return s.pool;
+        }
+
+    private:
+        stats stats_;
+        free_list free_[CLASS_NUM];
+    };
+
+    //STL allocator on block_pool, e.g. std::allocate_shared keeps object and control block in one cached block
+    template<typename T>
+    class block_allocator
+    {
+    public:
+        using value_type = T;
+
+        block_allocator() noexcept = default;
+
+        template<typename U>
+        block_allocator(const block_allocator<U>&) noexcept
+        {
+        }
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(block_pool::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n) noexcept
+        {
+            block_pool::deallocate(p, block_pool::block_size(n * sizeof(T)));
+        }
+    };
+
+    template<typename T, typename U>
+    inline bool operator==(const block_allocator<T>&, const block_allocator<U>&) noexcept
+    {
+        return true;
+    }
+
+    template<typename T, typename U>
+    inline bool operator!=(const block_allocator<T>&, const block_allocator<U>&) noexcept
+    {
+        return false;
+    }
+}
@@ -10,18 +10,21 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #pragma once
 #include <cstdint>
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <type_traits>
 #include <string>
 #include <cstring>
 #include <iostream>
+#include "block_pool.hpp"
 
 namespace moon
 {
 	enum class buffer_flag :std::uint8_t
 	{
-		pack_size = 1
+		pack_size = 1,
+		close = 2,//the connection is closed after this buffer is sent
 	};
 
 	class buffer
@@ -33,13 +36,12 @@ namespace moon
 		using value_type = char;
 		using const_reference = const value_type&;
 		using reference = value_type&;
-		using data_type = std::vector<value_type>;
-		using iterator = data_type::iterator;
-		using const_iterator = data_type::const_iterator;
-		using difference_type = data_type::difference_type;
-		using size_type = data_type::size_type;
 		using pointer = value_type*;
 		using const_pointer = const value_type*;
+		using iterator = pointer;
+		using const_iterator = const_pointer;
+		using difference_type = std::ptrdiff_t;
+		using size_type = size_t;
 
 		enum seek_origin
 		{
@@ -48,24 +50,106 @@ namespace moon
 			End
 		};
 
+		//storage comes from the calling thread's block_pool
 		buffer(size_t capacity = DEFAULT_CAPACITY, size_t headreserved = 0)
-			:data_(capacity + headreserved), readpos_(headreserved), writepos_(headreserved), headreserved_(headreserved), flag_(0)
+			:flag_(0), readpos_(headreserved), writepos_(headreserved), headreserved_(headreserved), owned_(true), capacity_(0), data_(nullptr)
 		{
+			data_ = static_cast<pointer>(block_pool::allocate(capacity + headreserved, &capacity_));
+		}
+
+		//use external storage(not owned), e.g. the tail of a message block. Grows into pooled storage when full.
+		buffer(pointer storage, size_t size, size_t headreserved)
+			:flag_(0), readpos_(headreserved), writepos_(headreserved), headreserved_(headreserved), owned_(false), capacity_(size), data_(storage)
+		{
+			assert(size >= headreserved);
+		}
+
+		buffer(const buffer& other)
+			:flag_(other.flag_), readpos_(other.readpos_), writepos_(other.writepos_), headreserved_(other.headreserved_), owned_(true), capacity_(0), data_(nullptr)
+		{
+			data_ = static_cast<pointer>(block_pool::allocate(other.capacity_, &capacity_));
+			memcpy(data_, other.data_, other.writepos_);
+		}
+
+		//external storage can not be stolen, it is copied
+		buffer(buffer&& other)
+			:flag_(other.flag_), readpos_(other.readpos_), writepos_(other.writepos_), headreserved_(other.headreserved_), owned_(other.owned_), capacity_(other.capacity_), data_(other.data_)
+		{
+			if (!other.owned_)
+			{
+				owned_ = true;
+				data_ = static_cast<pointer>(block_pool::allocate(other.capacity_, &capacity_));
+				memcpy(data_, other.data_, other.writepos_);
+			}
+			else
+			{
+				other.data_ = nullptr;
+				other.capacity_ = 0;
+			}
+			other.readpos_ = other.writepos_ = other.headreserved_ = 0;
+		}
 
+		buffer& operator=(const buffer& other)
+		{
+			if (this != &other)
+			{
+				buffer tmp(other);
+				swap(tmp);
+			}
+			return *this;
 		}
 
-		buffer(const buffer& other) = default;
-		buffer(buffer&& other) = default;
+		buffer& operator=(buffer&& other)
+		{
+			if (this != &other)
+			{
+				buffer tmp(std::move(other));
+				swap(tmp);
+			}
+			return *this;
+		}
+
+		~buffer()
+		{
+			release();
+		}
+
+		//buffer objects created by new(e.g. lua seri.pack) also come from the pool
+		static void* operator new(size_t size)
+		{
+			return block_pool::allocate(size);
+		}
+
+		static void operator delete(void* p, size_t size)
+		{
+			block_pool::deallocate(p, block_pool::block_size(size));
+		}
 
 		void init(size_t capacity = DEFAULT_CAPACITY, size_t headreserved = 0)
 		{
-			data_.resize(capacity + headreserved);
+			if (capacity_ < capacity + headreserved)
+			{
+				release();
+				data_ = static_cast<pointer>(block_pool::allocate(capacity + headreserved, &capacity_));
+				owned_ = true;
+			}
 			readpos_ = headreserved;
 			writepos_ = headreserved;
 			headreserved_ = headreserved;
 			flag_ = 0;
 		}
 
+		void swap(buffer& other) noexcept
+		{
+			std::swap(flag_, other.flag_);
+			std::swap(readpos_, other.readpos_);
+			std::swap(writepos_, other.writepos_);
+			std::swap(headreserved_, other.headreserved_);
+			std::swap(owned_, other.owned_);
+			std::swap(capacity_, other.capacity_);
+			std::swap(data_, other.data_);
+		}
+
 		template<typename T>
 		void write_back(const T* Indata, size_t offset = 0, size_t count = 1)
 		{
@@ -162,44 +246,51 @@ namespace moon
 		{
 			return ((flag_&v) != 0);
 		}
+		//make sure n bytes are writable after end(), write them directly then commit with offset_writepos
+		pointer prepare(size_t n)
+		{
+			check_space(n);
+			return std::addressof(*end());
+		}
+
 		//mark
 		void offset_writepos(int offset) noexcept
 		{
 			writepos_ += offset;
-			if (writepos_ >= data_.size())
+			if (writepos_ >= capacity_)
 			{
-				writepos_ = data_.size();
+				writepos_ = capacity_;
 			}
 		}
 
 		const_iterator begin() const noexcept
 		{
-			return data_.begin() + readpos_;
+			return data_ + readpos_;
 		}
 
 		iterator begin() noexcept
 		{
-			return data_.begin() + readpos_;
+			return data_ + readpos_;
 		}
 
 		const_iterator end() const noexcept
 		{
-			return data_.begin() + writepos_;
+			return data_ + writepos_;
 		}
 
 		iterator end() noexcept
 		{
-			return data_.begin() + writepos_;
+			return data_ + writepos_;
 		}
 
 		pointer data() noexcept
 		{
-			return  std::addressof(*begin());
+			return begin();
 		}
 
 		const_pointer data() const noexcept
 		{
-			return  std::addressof(*begin());
+			return begin();
 		}
 
 		//readable size
@@ -210,14 +301,14 @@ namespace moon
 
 		size_type max_size() const noexcept
 		{
-			return data_.size();
+			return capacity_;
 		}
 
 	protected:
 		size_t writeablesize() const
 		{
-            assert(data_.size() >= writepos_);
-			return data_.size() - writepos_;
+            assert(capacity_ >= writepos_);
+			return capacity_ - writepos_;
 		}
 
 		void check_space(size_t len)
@@ -237,20 +328,36 @@ namespace moon
 		{
 			if (writeablesize() + readpos_ < len + headreserved_)
 			{
-				data_.resize(writepos_ + len);
+				size_t capacity = 0;
+				auto tmp = static_cast<pointer>(block_pool::allocate(std::max(writepos_ + len, capacity_ * 2), &capacity));
+				memcpy(tmp, data_, writepos_);
+				release();
+				data_ = tmp;
+				capacity_ = capacity;
+				owned_ = true;
 			}
 			else
 			{
 				size_t readable = size();
 				if (readable != 0)
 				{
-					std::copy(begin(), end(), data_.begin() + headreserved_);
+					memmove(data_ + headreserved_, begin(), readable);
 				}
 				readpos_ = headreserved_;
 				writepos_ = readpos_ + readable;
 			}
 		}
 
+		void release() noexcept
+		{
+			if (owned_ && nullptr != data_)
+			{
+				block_pool::deallocate(data_, capacity_);
+			}
+			data_ = nullptr;
+			capacity_ = 0;
+		}
+
 	protected:
         uint8_t								flag_;
 		//read position
@@ -260,7 +367,11 @@ namespace moon
 
 		size_t								headreserved_;
 
-        data_type							data_;
+		bool								owned_;
+
+		size_t								capacity_;
+
+		pointer								data_;
 	};
 
 };
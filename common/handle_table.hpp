@@ -0,0 +1,232 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "noncopyable.hpp"
+#include "spinlock.hpp"
+
+namespace moon
+{
+    //at most 2^18 - 1 live handles, 14 bits of generation
+    const uint32_t HANDLE_INDEX_BITS = 18;
+    const uint32_t HANDLE_INDEX_MASK = (1u << HANDLE_INDEX_BITS) - 1;
+    //unused slots are taken before released ones until this many slots are free
+    const uint32_t HANDLE_MIN_FREE = 1024;
+
+    inline uint32_t handle_index(uint32_t handle)
+    {
+        return handle & HANDLE_INDEX_MASK;
+    }
+
+    /*
+    Dense handle table, like skynet's handle storage.
+    handle = generation << INDEX_BITS | slot index. Index 0 is never used, so handle is never 0.
+    find/set are lock-free, create/release take a spin lock around the free list.
+    Slots live in lazily allocated segments which are never freed, so readers never touch freed memory.
+    A released slot bumps its generation. Released slots are reused in FIFO order, and only once HANDLE_MIN_FREE slots are free,
+    so a stale handle is rejected until its slot has been reused 2^(32 - INDEX_BITS) times, at least HANDLE_MIN_FREE creates apart.
+    */
+    template<typename T>
+    class handle_table : public moon::noncopyable
+    {
+    public:
+        static const uint32_t INDEX_BITS = HANDLE_INDEX_BITS;
+        static const uint32_t INDEX_MASK = HANDLE_INDEX_MASK;
+        static const uint32_t GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+        static const uint32_t SEGMENT_BITS = 12;
+        static const uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+        static const uint32_t SEGMENT_NUM = (INDEX_MASK + 1) / SEGMENT_SIZE;
+
+        handle_table()
+            :size_(0)
+            , next_index_(1)
+            , free_head_(0)
+            , free_tail_(0)
+            , free_num_(0)
+        {
+            for (auto& s : segments_)
+            {
+                s.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~handle_table()
+        {
+            for (auto& s : segments_)
+            {
+                delete[] s.load();
+            }
+        }
+
+        //return 0 if no more slot
+        uint32_t create(T* v)
+        {
+            uint32_t idx = alloc_index();
+            if (0 == idx)
+            {
+                return 0;
+            }
+
+            auto s = get_slot(idx, true);
+            if (nullptr == s)
+            {
+                push_free(idx);
+                return 0;
+            }
+
+            s->generation = (s->generation + 1) & GENERATION_MASK;
+            uint32_t handle = (s->generation << INDEX_BITS) | idx;
+            s->value.store(v, std::memory_order_relaxed);
+            s->handle.store(handle, std::memory_order_release);
+            size_.fetch_add(1);
+            return handle;
+        }
+
+        //return nullptr if handle is stale or value is nullptr
+        T* find(uint32_t handle) const
+        {
+            auto s = get_slot(handle_index(handle), false);
+            if (nullptr == s)
+            {
+                return nullptr;
+            }
+            T* v = s->value.load(std::memory_order_acquire);
+            if (s->handle.load(std::memory_order_acquire) != handle)
+            {
+                return nullptr;
+            }
+            return v;
+        }
+
+        bool set(uint32_t handle, T* v)
+        {
+            auto s = get_slot(handle_index(handle), false);
+            if (nullptr == s || s->handle.load(std::memory_order_acquire) != handle)
+            {
+                return false;
+            }
+            s->value.store(v, std::memory_order_release);
+            return true;
+        }
+
+        bool release(uint32_t handle)
+        {
+            auto idx = handle_index(handle);
+            auto s = get_slot(idx, false);
+            if (nullptr == s || !s->handle.compare_exchange_strong(handle, 0, std::memory_order_acq_rel))
+            {
+                return false;
+            }
+            s->value.store(nullptr, std::memory_order_release);
+            size_.fetch_sub(1);
+            push_free(idx);
+            return true;
+        }
+
+        size_t size() const
+        {
+            return size_.load();
+        }
+
+    private:
+        struct slot
+        {
+            slot()
+                :handle(0)
+                , value(nullptr)
+                , next_free(0)
+                , generation(0)
+            {
+            }
+
+            std::atomic<uint32_t> handle;
+            std::atomic<T*> value;
+            //guarded by lock_
+            uint32_t next_free;
+            //only touched by the thread which owns the slot(between alloc_index and push_free)
+            uint32_t generation;
+        };
+
+        slot* get_slot(uint32_t idx, bool create) const
+        {
+            if (0 == idx || idx > INDEX_MASK)
+            {
+                return nullptr;
+            }
+
+            auto& seg = segments_[idx >> SEGMENT_BITS];
+            slot* p = seg.load(std::memory_order_acquire);
+            if (nullptr == p && create)
+            {
+                slot* tmp = new slot[SEGMENT_SIZE];
+                if (seg.compare_exchange_strong(p, tmp, std::memory_order_acq_rel))
+                {
+                    p = tmp;
+                }
+                else
+                {
+                    delete[] tmp;
+                }
+            }
+            return (nullptr == p) ? nullptr : &p[idx & (SEGMENT_SIZE - 1)];
+        }
+
+        //return 0 if no more slot
+        uint32_t alloc_index()
+        {
+            std::lock_guard<spin_lock> lock(lock_);
+            if ((0 == free_head_ || free_num_ < HANDLE_MIN_FREE) && next_index_ <= INDEX_MASK)
+            {
+                return next_index_++;
+            }
+
+            uint32_t idx = free_head_;
+            if (0 != idx)
+            {
+                free_head_ = get_slot(idx, false)->next_free;
+                if (0 == free_head_)
+                {
+                    free_tail_ = 0;
+                }
+                --free_num_;
+            }
+            return idx;
+        }
+
+        void push_free(uint32_t idx)
+        {
+            auto s = get_slot(idx, false);
+            std::lock_guard<spin_lock> lock(lock_);
+            s->next_free = 0;
+            if (0 == free_tail_)
+            {
+                free_head_ = idx;
+            }
+            else
+            {
+                get_slot(free_tail_, false)->next_free = idx;
+            }
+            free_tail_ = idx;
+            ++free_num_;
+        }
+
+    private:
+        std::atomic<size_t> size_;
+        spin_lock lock_;
+        //free_head_, free_tail_: FIFO of released slots, linked by slot::next_free
+        uint32_t next_index_;
+        uint32_t free_head_;
+        uint32_t free_tail_;
+        uint32_t free_num_;
+        mutable std::atomic<slot*> segments_[SEGMENT_NUM];
+    };
+}
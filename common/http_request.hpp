@@ -23,10 +23,11 @@ namespace moon
             return parse(data_);
         }
 
-        /// Parse request line and header fields
+        /// Parse request line and header fields, the rest of sv is body. Views point into sv
         int parse(string_view_t sv) noexcept
         {
             header.clear();
+            body = string_view_t();
 
             buffer_reader br(sv.data(), sv.size());
             auto line = br.readline();
@@ -61,7 +62,7 @@ namespace moon
                     if ((protocol_end = line.find('/', path_and_query_string_end + 1)) != string_view_t::npos) {
                         if (line.compare(path_and_query_string_end + 1, protocol_end - path_and_query_string_end - 1, "HTTP") != 0)
                             return -1;
-                        http_version = line.substr(protocol_end + 1, line.size() - protocol_end - 2);
+                        http_version = line.substr(protocol_end + 1);
                     }
                     else
                         return -1;
@@ -84,7 +85,8 @@ namespace moon
             }
             else
                 return -1;
-           return static_cast<int>(sv.size() - br.size());
+            body = sv.substr(sv.size() - br.size());
+            return static_cast<int>(sv.size() - br.size());
         }
 
         string_view_t get_header(const string_view_t& key)
@@ -97,11 +99,22 @@ namespace moon
             return string_view_t();
         }
 
+        bool keep_alive()
+        {
+            auto conn = get_header("connection");
+            if (http_version == "1.0")
+            {
+                return iequal_string(conn, string_view_t("keep-alive"));
+            }
+            return !iequal_string(conn, string_view_t("close"));
+        }
+
         uint16_t remote_endpoint_port;
         string_view_t method;
         string_view_t path;
         string_view_t query_string;
         string_view_t http_version;
+        string_view_t body;
         string_view_t remote_endpoint_address;
     private:
         std::string data_;
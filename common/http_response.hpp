@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include "string.hpp"
+#include "string_ref.hpp"
+#include "buffer_reader.hpp"
+#include "http_request.hpp"
+
+namespace moon
+{
+    class http_response
+    {
+    public:
+        http_response()
+            :status_code(0)
+        {
+        }
+
+        int parse_string(const std::string& data) noexcept
+        {
+            data_ = data;
+            return parse(data_);
+        }
+
+        /// Parse status line and header fields, the rest of sv is body. Views point into sv
+        int parse(string_view_t sv) noexcept
+        {
+            header.clear();
+            status_code = 0;
+            body = string_view_t();
+
+            buffer_reader br(sv.data(), sv.size());
+            auto line = br.readline();
+
+            //HTTP/1.1 200 OK
+            if (line.size() < 12 || line.compare(0, 5, "HTTP/") != 0)
+            {
+                return -1;
+            }
+
+            size_t version_end = line.find(' ');
+            if (version_end == string_view_t::npos || version_end + 4 > line.size())
+            {
+                return -1;
+            }
+            http_version = line.substr(5, version_end - 5);
+
+            int code = 0;
+            for (size_t i = version_end + 1; i < version_end + 4; ++i)
+            {
+                if (line[i] < '0' || line[i] > '9')
+                {
+                    return -1;
+                }
+                code = code * 10 + (line[i] - '0');
+            }
+            status_code = code;
+            reason = (version_end + 5 <= line.size()) ? line.substr(version_end + 5) : string_view_t();
+
+            line = br.readline();
+            size_t param_end;
+            while ((param_end = line.find(':')) != string_view_t::npos)
+            {
+                size_t value_start = param_end + 1;
+                while (value_start < line.size() && line[value_start] == ' ')
+                    value_start++;
+                header.emplace(line.substr(0, param_end), line.substr(value_start));
+                line = br.readline();
+            }
+            body = sv.substr(sv.size() - br.size());
+            return static_cast<int>(sv.size() - br.size());
+        }
+
+        string_view_t get_header(const string_view_t& key)
+        {
+            auto iter = header.find(key);
+            if (iter != header.end())
+            {
+                return iter->second;
+            }
+            return string_view_t();
+        }
+
+        int status_code;
+        string_view_t http_version;
+        string_view_t reason;
+        string_view_t body;
+    private:
+        std::string data_;
+        case_insensitive_multimap header;
+    };
+}
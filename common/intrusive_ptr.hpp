@@ -0,0 +1,146 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <utility>
+
+namespace moon
+{
+    /*
+    Smart pointer for objects which carry their own reference count, like boost::intrusive_ptr.
+    T must provide free functions intrusive_ptr_add_ref(T*) and intrusive_ptr_release(T*), found by ADL.
+    */
+    template<typename T>
+    class intrusive_ptr
+    {
+    public:
+        using element_type = T;
+
+        intrusive_ptr() noexcept
+            :p_(nullptr)
+        {
+        }
+
+        intrusive_ptr(std::nullptr_t) noexcept
+            :p_(nullptr)
+        {
+        }
+
+        //add_ref=false adopts a reference the caller already holds
+        intrusive_ptr(T* p, bool add_ref = true)
+            :p_(p)
+        {
+            if (nullptr != p_ && add_ref)
+            {
+                intrusive_ptr_add_ref(p_);
+            }
+        }
+
+        intrusive_ptr(const intrusive_ptr& other)
+            :p_(other.p_)
+        {
+            if (nullptr != p_)
+            {
+                intrusive_ptr_add_ref(p_);
+            }
+        }
+
+        intrusive_ptr(intrusive_ptr&& other) noexcept
+            :p_(other.p_)
+        {
+            other.p_ = nullptr;
+        }
+
+        ~intrusive_ptr()
+        {
+            if (nullptr != p_)
+            {
+                intrusive_ptr_release(p_);
+            }
+        }
+
+        intrusive_ptr& operator=(const intrusive_ptr& other)
+        {
+            intrusive_ptr(other).swap(*this);
+            return *this;
+        }
+
+        intrusive_ptr& operator=(intrusive_ptr&& other) noexcept
+        {
+            intrusive_ptr(std::move(other)).swap(*this);
+            return *this;
+        }
+
+        void reset() noexcept
+        {
+            intrusive_ptr().swap(*this);
+        }
+
+        //give up ownership without releasing the reference
+        T* detach() noexcept
+        {
+            T* p = p_;
+            p_ = nullptr;
+            return p;
+        }
+
+        T* get() const noexcept
+        {
+            return p_;
+        }
+
+        T& operator*() const noexcept
+        {
+            return *p_;
+        }
+
+        T* operator->() const noexcept
+        {
+            return p_;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return nullptr != p_;
+        }
+
+        void swap(intrusive_ptr& other) noexcept
+        {
+            std::swap(p_, other.p_);
+        }
+
+    private:
+        T* p_;
+    };
+
+    template<typename T>
+    inline bool operator==(const intrusive_ptr<T>& a, std::nullptr_t) noexcept
+    {
+        return nullptr == a.get();
+    }
+
+    template<typename T>
+    inline bool operator==(std::nullptr_t, const intrusive_ptr<T>& a) noexcept
+    {
+        return nullptr == a.get();
+    }
+
+    template<typename T>
+    inline bool operator!=(const intrusive_ptr<T>& a, std::nullptr_t) noexcept
+    {
+        return nullptr != a.get();
+    }
+
+    template<typename T>
+    inline bool operator!=(std::nullptr_t, const intrusive_ptr<T>& a) noexcept
+    {
+        return nullptr != a.get();
+    }
+}
@@ -0,0 +1,134 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include "noncopyable.hpp"
+
+namespace moon
+{
+    //hook for intrusive mpsc_queue, a node can only be linked into one queue at a time
+    struct mpsc_node
+    {
+        mpsc_node() noexcept
+            :mpsc_next_(nullptr)
+        {
+        }
+
+        std::atomic<mpsc_node*> mpsc_next_;
+    };
+
+    /*
+    Intrusive multi-producer single-consumer queue (Dmitry Vyukov's algorithm).
+    push is wait-free(one atomic exchange), pop/pop_all are lock-free and must be called by one thread only.
+    A pushed node which is not fully linked yet may be missed by pop/pop_all, it will be returned by the next call.
+    */
+    template<typename T>
+    class mpsc_queue : public moon::noncopyable
+    {
+    public:
+        mpsc_queue()
+            :head_(&stub_)
+            , pad_{}
+            , tail_(&stub_)
+        {
+        }
+
+        void push(T* node)
+        {
+            mpsc_node* n = node;
+            n->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+            mpsc_node* prev = head_.exchange(n, std::memory_order_acq_rel);
+            prev->mpsc_next_.store(n, std::memory_order_release);
+        }
+
+        T* pop()
+        {
+            mpsc_node* tail = tail_;
+            mpsc_node* next = tail->mpsc_next_.load(std::memory_order_acquire);
+            if (tail == &stub_)
+            {
+                if (nullptr == next)
+                {
+                    return nullptr;
+                }
+                tail_ = next;
+                tail = next;
+                next = next->mpsc_next_.load(std::memory_order_acquire);
+            }
+
+            if (nullptr != next)
+            {
+                tail_ = next;
+                return static_cast<T*>(tail);
+            }
+
+            mpsc_node* head = head_.load(std::memory_order_acquire);
+            if (tail != head)
+            {
+                //a producer is linking
+                return nullptr;
+            }
+
+            push_stub();
+
+            next = tail->mpsc_next_.load(std::memory_order_acquire);
+            if (nullptr != next)
+            {
+                tail_ = next;
+                return static_cast<T*>(tail);
+            }
+            return nullptr;
+        }
+
+        //pop nodes in fifo order, stop at the node which was the newest one when called, so busy producers can not starve the consumer.
+        template<typename Handler>
+        size_t pop_all(Handler&& handler)
+        {
+            mpsc_node* last = head_.load(std::memory_order_acquire);
+            //head_ is also the stub after pop relinked it behind nodes pushed meanwhile, pop never returns the stub so those are drained until empty
+            if (last == &stub_ && tail_ == &stub_ && nullptr == stub_.mpsc_next_.load(std::memory_order_acquire))
+            {
+                return 0;
+            }
+
+            size_t n = 0;
+            T* node = nullptr;
+            while (nullptr != (node = pop()))
+            {
+                bool end = (node == last);
+                handler(node);
+                ++n;
+                if (end)
+                {
+                    break;
+                }
+            }
+            return n;
+        }
+
+    private:
+        friend struct mpsc_queue_tester;
+
+        void push_stub()
+        {
+            stub_.mpsc_next_.store(nullptr, std::memory_order_relaxed);
+            mpsc_node* prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+            prev->mpsc_next_.store(&stub_, std::memory_order_release);
+        }
+
+    private:
+        //producers and consumer touch different cache lines
+        std::atomic<mpsc_node*> head_;
+        char pad_[64 - sizeof(std::atomic<mpsc_node*>)];
+        mpsc_node* tail_;
+        mpsc_node stub_;
+    };
+}
@@ -141,10 +141,26 @@ namespace moon
 			return find(basic_string_ref(&v, 1), pos);
 		}
 
-        basic_string_ref substr(size_t pos, size_t len) const
+		size_type rfind(const value_type v, size_type pos = npos) const noexcept
+		{
+			if (size_ == 0)
+			{
+				return npos;
+			}
+			for (size_type i = (pos < size_ ? pos : size_ - 1) + 1; i > 0; --i)
+			{
+				if (data_[i - 1] == v)
+				{
+					return i - 1;
+				}
+			}
+			return npos;
+		}
+
+        basic_string_ref substr(size_t pos, size_t len = npos) const
 		{
 			const size_type max_length = pos > size_ ? 0 : size_ - pos;
-			return pos < size_ ? basic_string_ref(data_ + pos, len > max_length ? max_length : len) : throw std::out_of_range("Index out of range in basic_string_view::substr");
+			return pos <= size_ ? basic_string_ref(data_ + pos, len > max_length ? max_length : len) : throw std::out_of_range("Index out of range in basic_string_view::substr");
 		}
 
 		const_reference operator[](size_t pos) const noexcept
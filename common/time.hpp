@@ -8,6 +8,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 ****************************************************************************/
 
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include "macro_define.hpp"
@@ -28,6 +29,23 @@ namespace moon
 			return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 		}
 
+		//monotonic clock, used to measure elapsed time
+		static int64_t microsecond()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		//monotonic milliseconds cached by the server loop(updated every few ms), cheap enough for every received packet
+		static int64_t coarse_millsecond()
+		{
+			return coarse_clock().load(std::memory_order_relaxed);
+		}
+
+		static void update_coarse_clock()
+		{
+			coarse_clock().store(microsecond() / 1000, std::memory_order_relaxed);
+		}
+
         //e. 2017-11-11 16:03:11.635
         static size_t milltimestamp(char* buf, size_t len)
         {
@@ -101,6 +119,13 @@ namespace moon
 #endif
 			return tm;
 		}
+
+	private:
+		static std::atomic<int64_t>& coarse_clock()
+		{
+			static std::atomic<int64_t> v{ microsecond() / 1000 };
+			return v;
+		}
 	};
 
 	inline bool operator==(const std::tm& tm1, const std::tm& tm2)
@@ -67,6 +67,8 @@ namespace moon
 
         bool remove(const std::string& name);
 
+        size_t component_num() const;
+
         void for_all(std::function<void(component*)> cb);
 
         virtual log* logger() const;
@@ -0,0 +1,54 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+#pragma once
+#include "config.h"
+#include "component.h"
+
+namespace moon
+{
+    /*
+    HTTP/1.1 client. Keep-alive connections are pooled per host:port and reused by later requests,
+    responses are framed and chunked bodies decoded in C++.
+    A response is a PTYPE_TEXT message to responseid: status line and header fields as received, then the body.
+    Failures are PTYPE_ERROR messages, header "timeout", "closed" or "error", data is the reason.
+    */
+    class MOON_EXPORT http_client :public component
+    {
+    public:
+        http_client() noexcept;
+
+        virtual ~http_client();
+
+        //max connections to one host:port(default HTTP_CLIENT_MAX_CONN), more requests wait for a connection
+        void setmaxconn(uint32_t n);
+
+        //max requests written to a connection before its responses are received, 1(default) disables pipelining
+        void setpipeline(uint32_t n);
+
+        //a request which gets no response data in seconds fails with "timeout", 0 means no timeout
+        void settimeout(int seconds);
+
+        //max bytes of a response body(default WS_MAX_MESSAGE_SIZE)
+        void setmaxbody(size_t bytes);
+
+        //path includes the query string, headers are header lines each ends with \r\n, Host and Content-Length are added
+        void request(const std::string& method, const std::string& host, const std::string& port, string_view_t path, string_view_t headers, string_view_t body, int32_t responseid);
+
+        //number of open connections(including connecting ones) of all hosts
+        size_t connections() const;
+
+    private:
+        void init() override;
+
+        void destroy() override;
+    private:
+        struct imp;
+        imp* imp_;
+    };
+}
@@ -0,0 +1,408 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+#include "components/http/http_client.h"
+#include "components/tcp/tcp.h"
+#include "log.h"
+#include "message.hpp"
+#include "service.h"
+#include "core/worker.h"
+#include "common/string.hpp"
+#include "common/block_pool.hpp"
+#include "http_client_connection.hpp"
+
+namespace moon
+{
+    using http_client_conn_ptr_t = std::shared_ptr<http_client_connection>;
+
+    //connections and waiting requests of one host:port
+    struct http_host
+    {
+        std::string host;
+        std::string port;
+        bool resolving = false;
+        std::vector<stream_endpoint_t> endpoints;
+        std::vector<http_client_conn_ptr_t> conns;
+        std::deque<http_client_request> waiting;
+    };
+
+    struct http_client::imp
+    {
+        imp() noexcept
+            : ios_(nullptr)
+            , maxconn_(HTTP_CLIENT_MAX_CONN)
+            , pipeline_(1)
+            , timeout_(0)
+            , max_body_size_(WS_MAX_MESSAGE_SIZE)
+            , next_id_(0)
+            , checking_(false)
+            , log_(nullptr)
+        {
+        }
+
+        std::shared_ptr<http_client> get_self()
+        {
+            return self_.lock();
+        }
+
+        //send waiting requests on ready connections, open connections for the rest
+        void dispatch(http_host* h)
+        {
+            while (!h->waiting.empty())
+            {
+                http_client_connection* best = nullptr;
+                for (auto& c : h->conns)
+                {
+                    if (c->ready() && c->inflight() < pipeline_ && (nullptr == best || c->inflight() < best->inflight()))
+                    {
+                        best = c.get();
+                        if (0 == best->inflight())
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                if (nullptr == best || !best->request(std::move(h->waiting.front())))
+                {
+                    break;
+                }
+                h->waiting.pop_front();
+            }
+
+            if (h->waiting.empty())
+            {
+                return;
+            }
+
+            size_t connecting = 0;
+            for (auto& c : h->conns)
+            {
+                if (!c->connected())
+                {
+                    ++connecting;
+                }
+            }
+
+            while (connecting < h->waiting.size() && h->conns.size() < maxconn_)
+            {
+                if (h->endpoints.empty())
+                {
+                    resolve(h);
+                    return;
+                }
+                connect(h);
+                ++connecting;
+            }
+        }
+
+        void resolve(http_host* h)
+        {
+            if (h->resolving)
+            {
+                return;
+            }
+            h->resolving = true;
+            auto resolver = std::make_shared<asio::ip::tcp::resolver>(*ios_);
+            resolver->async_resolve(asio::ip::tcp::resolver::query(h->host, h->port),
+                [this, self = get_self(), h, resolver](const asio::error_code& e, asio::ip::tcp::resolver::iterator it)
+            {
+                if (nullptr == self || !self->ok())
+                {
+                    return;
+                }
+                h->resolving = false;
+                if (e)
+                {
+                    fail_waiting(h, moon::format("resolve %s:%s failed %s(%d)", h->host.data(), h->port.data(), e.message().data(), e.value()));
+                    return;
+                }
+                for (; it != asio::ip::tcp::resolver::iterator(); ++it)
+                {
+                    h->endpoints.push_back(it->endpoint());
+                }
+                dispatch(h);
+            });
+        }
+
+        void connect(http_host* h)
+        {
+            auto conn = std::allocate_shared<http_client_connection>(block_allocator<http_client_connection>(), *ios_);
+            conn->set_id(++next_id_);
+            conn->setlogger(log_);
+            conn->set_max_body(max_body_size_);
+            conn->on_data = on_data_;
+            conn->on_close = [this, h](uint32_t id) { remove(h, id); };
+            conn->on_ready = [this, h]() { dispatch(h); };
+            conn->on_retry = [this, h](std::vector<http_client_request>& requests) {
+                for (auto it = requests.rbegin(); it != requests.rend(); ++it)
+                {
+                    h->waiting.push_front(std::move(*it));
+                }
+            };
+            h->conns.push_back(conn);
+            start_check();
+
+            asio::async_connect(conn->socket(), h->endpoints.begin(), h->endpoints.end(),
+                [this, self = get_self(), h, conn](const asio::error_code& e, std::vector<stream_endpoint_t>::iterator)
+            {
+                if (nullptr == self || !self->ok() || nullptr == conn->on_data)
+                {
+                    return;
+                }
+
+                if (e)
+                {
+                    conn->on_data = nullptr;
+                    remove(h, conn->id());
+                    //endpoints may have changed
+                    h->endpoints.clear();
+                    if (h->conns.empty())
+                    {
+                        fail_waiting(h, moon::format("connect %s:%s failed %s(%d)", h->host.data(), h->port.data(), e.message().data(), e.value()));
+                    }
+                    return;
+                }
+                conn->start(false);
+                dispatch(h);
+            });
+        }
+
+        //connection closed, its requests were answered or moved back to waiting
+        void remove(http_host* h, uint32_t id)
+        {
+            auto it = std::find_if(h->conns.begin(), h->conns.end(), [id](const http_client_conn_ptr_t& c) { return c->id() == id; });
+            if (it != h->conns.end())
+            {
+                h->conns.erase(it);
+            }
+            //not in the connection's call stack
+            ios_->post([this, self = get_self(), h]() {
+                if (nullptr != self && self->ok())
+                {
+                    dispatch(h);
+                }
+            });
+        }
+
+        void fail_waiting(http_host* h, const std::string& reason)
+        {
+            std::deque<http_client_request> requests;
+            requests.swap(h->waiting);
+            for (auto& req : requests)
+            {
+                auto msg = message::create();
+                msg->set_header("error");
+                msg->write_string(reason);
+                msg->set_type(PTYPE_ERROR);
+                msg->set_responseid(-req.responseid);
+                on_data_(msg);
+            }
+        }
+
+        //request timeout and idle keep-alive connections
+        void start_check()
+        {
+            if (checking_)
+            {
+                return;
+            }
+            checking_ = true;
+            timer_->expires_from_now(std::chrono::milliseconds(HTTP_CLIENT_CHECK_INTERVAL));
+            timer_->async_wait([this, self = get_self()](const asio::error_code& e) {
+                if (e || nullptr == self || !self->ok())
+                {
+                    return;
+                }
+                checking_ = false;
+                check();
+            });
+        }
+
+        void check()
+        {
+            auto now = time::coarse_millsecond();
+            size_t n = 0;
+            for (auto& it : hosts_)
+            {
+                //by copy, close may remove connections
+                auto conns = it.second->conns;
+                for (auto& c : conns)
+                {
+                    if (!c->connected())
+                    {
+                        if (0 != timeout_ && now - c->create_time() > timeout_)
+                        {
+                            c->close();
+                        }
+                    }
+                    else if (0 != c->inflight())
+                    {
+                        if (0 != timeout_ && now - c->wait_time() > timeout_)
+                        {
+                            c->timeout();
+                        }
+                    }
+                    else if (now - c->idle_time() > HTTP_CLIENT_IDLE_TIMEOUT)
+                    {
+                        c->close();
+                    }
+                }
+                n += it.second->conns.size();
+            }
+
+            if (0 != n)
+            {
+                start_check();
+            }
+        }
+
+        http_host* find_host(const std::string& host, const std::string& port)
+        {
+            auto key = host + ":" + port;
+            auto& h = hosts_[key];
+            if (nullptr == h)
+            {
+                h.reset(new http_host);
+                h->host = host;
+                h->port = port;
+            }
+            return h.get();
+        }
+
+        static buffer_ptr_t make_request(const std::string& method, const std::string& host, const std::string& port, string_view_t path, string_view_t headers, string_view_t body)
+        {
+            auto buf = message::create_buffer(method.size() + path.size() + host.size() + port.size() + headers.size() + body.size() + 64);
+            buf->write_back(method.data(), 0, method.size());
+            buf->write_back(" ", 0, 1);
+            if (path.empty())
+            {
+                buf->write_back("/", 0, 1);
+            }
+            else
+            {
+                buf->write_back(path.data(), 0, path.size());
+            }
+            string_view_t s = " HTTP/1.1\r\nHost: "_sv;
+            buf->write_back(s.data(), 0, s.size());
+            buf->write_back(host.data(), 0, host.size());
+            if (port != "80")
+            {
+                buf->write_back(":", 0, 1);
+                buf->write_back(port.data(), 0, port.size());
+            }
+            buf->write_back(STR_CRLF.data(), 0, STR_CRLF.size());
+            if (!body.empty() || method == "POST" || method == "PUT" || method == "PATCH")
+            {
+                char line[48];
+                int n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", body.size());
+                buf->write_back(line, 0, n);
+            }
+            buf->write_back(headers.data(), 0, headers.size());
+            buf->write_back(STR_CRLF.data(), 0, STR_CRLF.size());
+            buf->write_back(body.data(), 0, body.size());
+            return buf;
+        }
+
+        asio::io_service* ios_;
+        uint32_t maxconn_;
+        uint32_t pipeline_;
+        //milliseconds
+        int64_t timeout_;
+        size_t max_body_size_;
+        uint32_t next_id_;
+        bool checking_;
+        moon::log* log_;
+        std::unique_ptr<asio::steady_timer> timer_;
+        std::unordered_map<std::string, std::unique_ptr<http_host>> hosts_;
+        std::weak_ptr<http_client> self_;
+        std::function<void(const message_ptr_t&)> on_data_;
+    };
+
+    http_client::http_client() noexcept
+        :imp_(new imp)
+    {
+    }
+
+    http_client::~http_client()
+    {
+        SAFE_DELETE(imp_);
+    }
+
+    void http_client::setmaxconn(uint32_t n)
+    {
+        imp_->maxconn_ = std::max<uint32_t>(n, 1);
+    }
+
+    void http_client::setpipeline(uint32_t n)
+    {
+        imp_->pipeline_ = std::max<uint32_t>(n, 1);
+    }
+
+    void http_client::settimeout(int seconds)
+    {
+        imp_->timeout_ = (seconds > 0) ? int64_t(seconds) * 1000 : 0;
+    }
+
+    void http_client::setmaxbody(size_t bytes)
+    {
+        imp_->max_body_size_ = bytes;
+    }
+
+    void http_client::request(const std::string& method, const std::string& host, const std::string& port, string_view_t path, string_view_t headers, string_view_t body, int32_t responseid)
+    {
+        http_client_request req;
+        req.responseid = -responseid;
+        req.head = (method == "HEAD");
+        req.idempotent = (method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS");
+        req.data = imp::make_request(method, host, port, path, headers, body);
+
+        auto h = imp_->find_host(host, port);
+        h->waiting.push_back(std::move(req));
+        imp_->dispatch(h);
+    }
+
+    size_t http_client::connections() const
+    {
+        size_t n = 0;
+        for (auto& it : imp_->hosts_)
+        {
+            n += it.second->conns.size();
+        }
+        return n;
+    }
+
+    void http_client::init()
+    {
+        component::init();
+        auto s = parent<service>();
+        MOON_DCHECK(s != nullptr, "http_client::init service is null");
+        imp_->self_ = s->get_component<http_client>(name());
+        imp_->ios_ = &(s->get_worker()->io_service());
+        imp_->log_ = s->logger();
+        imp_->on_data_ = std::bind(&service::handle_message, s, std::placeholders::_1);
+        imp_->timer_.reset(new asio::steady_timer(*imp_->ios_));
+    }
+
+    void http_client::destroy()
+    {
+        component::destroy();
+        asio::error_code ec;
+        imp_->timer_->cancel(ec);
+        for (auto& it : imp_->hosts_)
+        {
+            auto conns = it.second->conns;
+            for (auto& c : conns)
+            {
+                c->close(true);
+            }
+            it.second->conns.clear();
+            it.second->waiting.clear();
+        }
+    }
+}
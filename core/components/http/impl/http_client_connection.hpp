@@ -0,0 +1,469 @@
+#pragma once
+#include "components/tcp/impl/http_framing.hpp"
+
+namespace moon
+{
+    struct http_client_request
+    {
+        int32_t responseid = 0;
+        //HEAD request, its response has no body
+        bool head = false;
+        //may be sent again when a reused connection closes before its response
+        bool idempotent = false;
+        bool retried = false;
+        int64_t sent_time = 0;
+        buffer_ptr_t data;
+    };
+
+    /*
+    Client side of a pooled keep-alive connection. Requests are written in order(several of them when pipelining),
+    responses are framed by Content-Length, chunked coding or connection close and answer them in the same order.
+    */
+    class http_client_connection : public base_connection
+    {
+    public:
+        using base_connection_t = base_connection;
+
+        explicit http_client_connection(asio::io_service& ios)
+            :base_connection(ios)
+            , connected_(false)
+            , reusable_(true)
+            , started_(false)
+            , until_close_(false)
+            , closing_(false)
+            , max_body_size_(WS_MAX_MESSAGE_SIZE)
+            , rsize_(HTTP_READ_SIZE_MIN)
+            , read_remain_(0)
+            , scan_(0)
+            , served_(0)
+            , create_time_(time::coarse_millsecond())
+            , idle_time_(0)
+        {
+        }
+
+        void start(bool accepted, int32_t responseid = 0) override
+        {
+            base_connection_t::start(accepted, responseid);
+            connected_ = true;
+            idle_time_ = last_recv_time_;
+            set_no_delay();
+            read_some();
+        }
+
+        void set_max_body(size_t max_body_size)
+        {
+            max_body_size_ = max_body_size;
+        }
+
+        bool request(http_client_request&& req)
+        {
+            if (!connected_ || !reusable_ || !base_connection::send(req.data))
+            {
+                return false;
+            }
+            req.sent_time = time::coarse_millsecond();
+            inflight_.push_back(std::move(req));
+            return true;
+        }
+
+        //connected and may take more requests
+        bool ready() const
+        {
+            return connected_ && reusable_ && nullptr != on_data;
+        }
+
+        bool connected() const
+        {
+            return connected_;
+        }
+
+        size_t inflight() const
+        {
+            return inflight_.size();
+        }
+
+        int64_t create_time() const
+        {
+            return create_time_;
+        }
+
+        //when the last response completed(or connected), valid when there is no request in flight
+        int64_t idle_time() const
+        {
+            return idle_time_;
+        }
+
+        //since when the first request in flight has been waiting for data
+        int64_t wait_time() const
+        {
+            return inflight_.empty() ? 0 : std::max(inflight_.front().sent_time, last_recv_time_);
+        }
+
+        //a response completed, the connection can take another request
+        std::function<void()> on_ready;
+
+        //requests which did not get a response and can be sent again on another connection
+        std::function<void(std::vector<http_client_request>&)> on_retry;
+
+    protected:
+        void read_some()
+        {
+            if (nullptr == rmsg_)
+            {
+                rmsg_ = message::create(2 * rsize_);
+            }
+
+            //rest of a big response is read exactly, so it ends at the end of its own message
+            size_t n = (0 != read_remain_) ? read_remain_ : rsize_;
+            bool exact = (0 != read_remain_);
+            auto buf = rmsg_->get_buffer();
+            socket_.async_read_some(asio::buffer(buf->prepare(n), n),
+                make_custom_alloc_handler(allocator_,
+                    [this, self = shared_from_this(), n, exact](const asio::error_code& e, std::size_t bytes_transferred)
+            {
+                if (!ok())
+                    return;
+
+                if (e)
+                {
+                    //a response without length ends with the connection
+                    if (e == asio::error::eof && until_close_)
+                    {
+                        until_close_ = false;
+                        complete(body_);
+                        body_ = nullptr;
+                    }
+                    if (ok())
+                    {
+                        error(e, int(logic_error_));
+                    }
+                    return;
+                }
+
+                if (bytes_transferred == 0)
+                {
+                    read_some();
+                    return;
+                }
+
+                last_recv_time_ = time::coarse_millsecond();
+                rmsg_->get_buffer()->offset_writepos(static_cast<int>(bytes_transferred));
+                if (exact)
+                {
+                    read_remain_ -= bytes_transferred;
+                }
+
+                if (!parse_responses())
+                {
+                    if (ok())
+                    {
+                        error(asio::error_code(), 0, "bad response");
+                        close();
+                    }
+                    return;
+                }
+
+                if (!ok())
+                {
+                    return;
+                }
+
+                //the response which closes the connection is received, requests after it were not answered
+                if (closing_)
+                {
+                    error(asio::error_code(), 0, "closed");
+                    close();
+                    return;
+                }
+
+                if (!exact)
+                {
+                    if (bytes_transferred == n && rsize_ < HTTP_READ_SIZE_MAX)
+                    {
+                        rsize_ *= 2;
+                    }
+                    else if (rsize_ > HTTP_READ_SIZE_MIN && bytes_transferred <= rsize_ / 4)
+                    {
+                        rsize_ /= 2;
+                    }
+                }
+                read_some();
+            }));
+        }
+
+        //status line and framing header fields, false if it is malformed
+        static bool parse_head(string_view_t head, int& status, int64_t& content_length, bool& chunked, bool& close)
+        {
+            size_t pos = head.find(STR_CRLF);
+            auto line = head.substr(0, pos);
+            //HTTP-version SP status-code SP reason
+            if (line.size() < 12 || line.compare(0, 7, "HTTP/1.") != 0 || line[8] != ' ')
+            {
+                return false;
+            }
+            bool http10 = (line[7] == '0');
+            status = 0;
+            for (size_t i = 9; i < 12; ++i)
+            {
+                if (line[i] < '0' || line[i] > '9')
+                {
+                    return false;
+                }
+                status = status * 10 + (line[i] - '0');
+            }
+
+            content_length = -1;
+            chunked = false;
+            bool conn_close = false;
+            bool conn_keepalive = false;
+            pos += STR_CRLF.size();
+            while (pos < head.size())
+            {
+                size_t end = head.find(STR_CRLF, pos);
+                if (end == pos || end == string_view_t::npos)
+                {
+                    break;
+                }
+                line = head.substr(pos, end - pos);
+                pos = end + STR_CRLF.size();
+
+                size_t colon = line.find(':');
+                if (colon == string_view_t::npos || 0 == colon)
+                {
+                    return false;
+                }
+                auto name = line.substr(0, colon);
+                auto value = http::trim(line.substr(colon + 1));
+                if (iequal_string(name, HTTP_CONTENT_LENGTH))
+                {
+                    if (!http::to_size(value, content_length))
+                    {
+                        return false;
+                    }
+                }
+                else if (iequal_string(name, HTTP_TRANSFER_ENCODING))
+                {
+                    chunked = http::is_chunked(value);
+                }
+                else if (iequal_string(name, HTTP_CONNECTION))
+                {
+                    conn_close = conn_close || http::has_token(value, HTTP_CLOSE);
+                    conn_keepalive = conn_keepalive || http::has_token(value, HTTP_KEEP_ALIVE);
+                }
+            }
+            close = conn_close || (http10 && !conn_keepalive);
+            return true;
+        }
+
+        //answer requests in flight with all complete responses, false if a response is malformed
+        bool parse_responses()
+        {
+            while (nullptr != rmsg_ && ok())
+            {
+                auto buf = rmsg_->get_buffer();
+                if (0 != buf->size())
+                {
+                    started_ = true;
+                }
+
+                if (chunked_.active())
+                {
+                    if (0 != chunked_.decode(buf, max_body_size_))
+                    {
+                        return false;
+                    }
+                    if (!chunked_.done())
+                    {
+                        break;
+                    }
+                    complete(chunked_.take());
+                    continue;
+                }
+
+                if (until_close_)
+                {
+                    if (body_->get_buffer()->size() + buf->size() > max_body_size_)
+                    {
+                        return false;
+                    }
+                    body_->get_buffer()->write_back(buf->data(), 0, buf->size());
+                    buf->clear();
+                    break;
+                }
+
+                size_t len = buf->size();
+                if (0 == len)
+                {
+                    break;
+                }
+
+                //response without request
+                if (inflight_.empty())
+                {
+                    return false;
+                }
+
+                const char* p = buf->data();
+                size_t head = http::find_head_end(p, len, scan_);
+                if (head == string_view_t::npos)
+                {
+                    if (len > HTTP_MAX_HEADER_SIZE)
+                    {
+                        return false;
+                    }
+                    break;
+                }
+
+                int status = 0;
+                int64_t content_length = -1;
+                bool chunked = false;
+                bool close = false;
+                if (!parse_head(string_view_t{ p, head }, status, content_length, chunked, close))
+                {
+                    return false;
+                }
+
+                //interim response
+                if (status >= 100 && status < 200 && status != 101)
+                {
+                    buf->seek(static_cast<int>(head), buffer::Current);
+                    continue;
+                }
+
+                if (close)
+                {
+                    reusable_ = false;
+                }
+
+                if (inflight_.front().head || status == 204 || status == 304 || (status >= 100 && status < 200))
+                {
+                    content_length = 0;
+                }
+                else if (chunked)
+                {
+                    auto msg = message::create(head + HTTP_READ_SIZE_MIN);
+                    msg->get_buffer()->write_back(p, 0, head);
+                    buf->seek(static_cast<int>(head), buffer::Current);
+                    chunked_.start(std::move(msg));
+                    continue;
+                }
+                else if (content_length < 0)
+                {
+                    reusable_ = false;
+                    until_close_ = true;
+                    body_ = message::create(head + HTTP_READ_SIZE_MAX);
+                    body_->get_buffer()->write_back(p, 0, head);
+                    buf->seek(static_cast<int>(head), buffer::Current);
+                    continue;
+                }
+
+                if (static_cast<uint64_t>(content_length) > max_body_size_)
+                {
+                    return false;
+                }
+
+                size_t total = head + static_cast<size_t>(content_length);
+                if (len < total)
+                {
+                    hold_partial_message(rmsg_, total, rsize_, read_remain_);
+                    //parsed again when the body is received, the head is not scanned twice
+                    scan_ = head - 1;
+                    break;
+                }
+
+                if (len == total)
+                {
+                    message_ptr_t msg;
+                    msg.swap(rmsg_);
+                    complete(msg);
+                    continue;
+                }
+
+                auto msg = message::create(total);
+                msg->get_buffer()->write_back(p, 0, total);
+                buf->seek(static_cast<int>(total), buffer::Current);
+                complete(msg);
+            }
+            return true;
+        }
+
+        void complete(const message_ptr_t& msg)
+        {
+            auto req = std::move(inflight_.front());
+            inflight_.pop_front();
+            started_ = false;
+            ++served_;
+            idle_time_ = time::coarse_millsecond();
+            msg->set_type(PTYPE_TEXT);
+            msg->set_responseid(-req.responseid);
+            on_data(msg);
+            if (!reusable_)
+            {
+                closing_ = true;
+            }
+            else if (ok())
+            {
+                on_ready();
+            }
+        }
+
+        //requests in flight fail, or are sent again if they can be
+        void error(const asio::error_code& e, int logicerr, const std::string& lemsg = "") override
+        {
+            auto on_data_f = on_data;
+            on_close(id_);
+            on_data = nullptr;
+
+            bool timeout = (logicerr == int(moon::network_logic_error::timeout));
+            std::string content = timeout ? "no response in time" : (e ? moon::format("%s(%d)", e.message().data(), e.value()) : lemsg);
+            std::deque<http_client_request> requests;
+            requests.swap(inflight_);
+            std::vector<http_client_request> retry;
+            for (size_t i = 0; i < requests.size(); ++i)
+            {
+                auto& req = requests[i];
+                //a reused connection closed by the server before any of this response arrived
+                bool untouched = (0 != i || !started_);
+                if (req.idempotent && !req.retried && 0 != served_ && untouched && !timeout)
+                {
+                    req.retried = true;
+                    retry.push_back(std::move(req));
+                    continue;
+                }
+                auto msg = message::create();
+                msg->set_header(timeout ? "timeout" : "closed");
+                msg->write_string(content);
+                msg->set_type(PTYPE_ERROR);
+                msg->set_responseid(-req.responseid);
+                on_data_f(msg);
+            }
+
+            if (!retry.empty())
+            {
+                on_retry(retry);
+            }
+        }
+
+    protected:
+        bool connected_;
+        //no more requests after the response which closes the connection
+        bool reusable_;
+        //some data of the first response in flight is received
+        bool started_;
+        //the response being received has no length, it ends when the server closes
+        bool until_close_;
+        bool closing_;
+        size_t max_body_size_;
+        size_t rsize_;
+        size_t read_remain_;
+        size_t scan_;
+        //responses received
+        size_t served_;
+        int64_t create_time_;
+        int64_t idle_time_;
+        message_ptr_t rmsg_;
+        message_ptr_t body_;
+        http::chunked_decoder chunked_;
+        std::deque<http_client_request> inflight_;
+    };
+}
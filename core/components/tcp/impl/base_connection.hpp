@@ -4,7 +4,9 @@
 #include "message.hpp"
 #include "handler_alloc.hpp"
 #include "const_buffers_holder.hpp"
+#include "stream_endpoint.hpp"
 #include "common/string.hpp"
+#include "common/time.hpp"
 
 namespace moon
 {
@@ -40,12 +42,24 @@ namespace moon
     class base_connection :public std::enable_shared_from_this<base_connection>
     {
     public:
-        using socket_t = asio::ip::tcp::socket;
+        //tcp or unix domain socket
+        using socket_t = asio::generic::stream_protocol::socket;
 
         explicit base_connection(asio::io_service& ios)
             :sending_(false)
+            , send_high_reached_(false)
+            , lingering_(false)
+            , close_after_send_(false)
+            , corked_(false)
+            , send_policy_(send_policy::block)
             , id_(0)
+            , writable_responseid_(0)
             , last_recv_time_(0)
+            , send_high_(0)
+            , send_low_(0)
+            , queued_bytes_(0)
+            , sending_bytes_(0)
+            , send_head_(0)
             , logic_error_(network_logic_error::ok)
             , ios_(ios)
             , socket_(ios)
@@ -60,16 +74,9 @@ namespace moon
 
         virtual void start(bool accepted, int32_t responseid = 0)
         {
-            (void)accepted;
             (void)responseid;
-            //save remote addr
-            asio::error_code ec;
-            auto ep = socket_.remote_endpoint(ec);
-            auto addr = ep.address();
-            remote_addr_ = addr.to_string(ec) + ":";
-            remote_addr_ += std::to_string(ep.port());
-
-            last_recv_time_ = std::time(nullptr);
+            remote_addr_ = peer_address(accepted);
+            last_recv_time_ = time::coarse_millsecond();
         }
 
         virtual bool read(const read_request& ctx) 
@@ -78,6 +85,12 @@ namespace moon
             return false;
         };
 
+        //add protocol framing to data, only touches data, so it can be called in any thread
+        virtual void encode(const buffer_ptr_t & data)
+        {
+            (void)data;
+        }
+
         virtual bool send(const buffer_ptr_t & data)
         {
             if (data == nullptr || data->size() == 0)
@@ -85,26 +98,87 @@ namespace moon
                 return false;
             }
 
-            if (!socket_.is_open())
+            if (!is_open() || !ok() || close_after_send_)
             {
                 return false;
             }
 
+            if (0 != send_high_ && queued_bytes_ + data->size() > send_high_)
+            {
+                switch (send_policy_)
+                {
+                case send_policy::drop:
+                    if (queued_bytes_ >= send_high_)
+                    {
+                        notify_send_high();
+                        return false;
+                    }
+                    break;
+                case send_policy::close:
+                    logic_error_ = network_logic_error::send_buffer_full;
+                    //not in the sender's call stack
+                    ios_.post([this, self = shared_from_this()]() {
+                        if (!ok())
+                            return;
+                        error(asio::error_code(), int(network_logic_error::send_buffer_full), "send buffer full");
+                        close();
+                    });
+                    return false;
+                default:
+                    break;
+                }
+            }
+
             send_queue_.push_back(data);
+            queued_bytes_ += data->size();
+            //later data is refused, the socket is closed when the queue is sent
+            close_after_send_ = data->check_flag(uint8_t(buffer_flag::close));
 
-            if (send_queue_.size() > 30)
+            if (0 != send_high_ && queued_bytes_ >= send_high_)
             {
-                printf("warn:network send_queue size >30\n");
+                notify_send_high();
             }
 
-            if (!sending_)
+            if (!sending_ && !corked_)
             {
                 post_send();
             }
             return true;
         }
 
-        bool close(bool exit = false)
+        void set_send_limit(size_t high, size_t low, send_policy policy)
+        {
+            send_high_ = high;
+            send_low_ = (0 == low || low > high) ? high / 2 : low;
+            send_policy_ = policy;
+        }
+
+        size_t queued_bytes() const
+        {
+            return queued_bytes_.load(std::memory_order_relaxed);
+        }
+
+        bool wait_writable(int32_t responseid)
+        {
+            if (!is_open() || !ok() || 0 != writable_responseid_)
+            {
+                return false;
+            }
+            writable_responseid_ = responseid;
+            if (!send_high_reached_)
+            {
+                //guarantee response is async
+                ios_.post([this, self = shared_from_this()]() {
+                    if (ok() && !send_high_reached_)
+                    {
+                        response_writable(true);
+                    }
+                });
+            }
+            return true;
+        }
+
+        virtual bool close(bool exit = false)
         {
             bool ret = false;
             do
@@ -114,7 +188,7 @@ namespace moon
                     break;
                 }
                 asio::error_code ec;
-                socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                socket_.shutdown(socket_t::shutdown_both, ec);
                 socket_.close(ec);
                 ret = true;
             } while (0);
@@ -131,7 +205,7 @@ namespace moon
             return socket_;
         }
 
-        bool is_open() const
+        virtual bool is_open() const
         {
             return socket_.is_open();
         }
@@ -146,16 +220,20 @@ namespace moon
             return id_;
         }
 
-        void timeout_check(time_t now, int timeout)
+        //time::coarse_millsecond of the last read
+        int64_t last_recv_time() const
         {
-            if ((0 != timeout) && (0 != last_recv_time_) && (now - last_recv_time_ > timeout))
-            {
-                logic_error_ = network_logic_error::timeout;
-                close();
-            }
+            return last_recv_time_;
+        }
+
+        void timeout()
+        {
+            logic_error_ = network_logic_error::timeout;
+            close();
         }
 
-        void set_no_delay()
+        //no effect on unix domain sockets
+        virtual void set_no_delay()
         {
             asio::ip::tcp::no_delay option(true);
             asio::error_code ec;
@@ -179,47 +257,179 @@ namespace moon
     protected:
         void post_send()
         {
-            if (send_queue_.size() == 0)
+            if (send_head_ == send_queue_.size())
                 return;
 
             buffers_holder_.clear();
+            sending_bytes_ = 0;
 
-            while ((send_queue_.size() != 0) && (buffers_holder_.size() < 50))
+            while ((send_head_ != send_queue_.size()) && (buffers_holder_.size() < NMSG_SEND_BATCH_BUFFERS))
             {
-                auto& msg = send_queue_.front();
+                auto& msg = send_queue_[send_head_];
+                if (buffers_holder_.size() != 0 && sending_bytes_ + msg->size() > NMSG_SEND_BATCH_BYTES)
+                {
+                    break;
+                }
+                sending_bytes_ += msg->size();
                 buffers_holder_.push_back(msg);
-                send_queue_.pop_front();
+                msg.reset();
+                ++send_head_;
+            }
+
+            if (send_head_ == send_queue_.size())
+            {
+                send_queue_.clear();
+                send_head_ = 0;
+            }
+            else if (send_head_ * 2 >= send_queue_.size())
+            {
+                send_queue_.erase(send_queue_.begin(), send_queue_.begin() + send_head_);
+                send_head_ = 0;
             }
 
             if (buffers_holder_.size() == 0)
                 return;
 
             sending_ = true;
+            write();
+        }
+
+        //write buffers_holder_, then handle_write
+        virtual void write()
+        {
             asio::async_write(
                 socket_,
                 buffers_holder_.buffers(),
                 make_custom_alloc_handler(allocator_,
                     [this, self = shared_from_this()](const asio::error_code& e, std::size_t)
             {
-                if (!ok())
-                    return;
+                handle_write(e);
+            }));
+        }
+
+        void handle_write(const asio::error_code& e)
+        {
+            if (!ok())
+            {
+                if (lingering_)
+                {
+                    sending_ = false;
+                    if (e || send_head_ == send_queue_.size())
+                        close();
+                    else
+                        post_send();
+                }
+                return;
+            }
 
-                sending_ = false;
+            sending_ = false;
 
-                if (!e)
+            if (!e)
+            {
+                queued_bytes_ -= sending_bytes_;
+                sending_bytes_ = 0;
+                if (send_high_reached_ && queued_bytes_ <= send_low_)
+                {
+                    send_high_reached_ = false;
+                    notify_send_watermark(socket_data_type::socket_send_low);
+                    if (!ok())
+                        return;
+                    response_writable(true);
+                    if (!ok())
+                        return;
+                }
+                if (close_after_send_ && send_head_ == send_queue_.size())
                 {
-                    post_send();
+                    //the pending read fails, then the service is told like tcp::close
+                    close();
                     return;
                 }
-                else
+                post_send();
+                return;
+            }
+            else
+            {
+                error(e, int(logic_error_));
+            }
+        }
+
+        //ip:port, the listening path for accepted unix domain sockets(their peers are unnamed)
+        virtual std::string peer_address(bool accepted)
+        {
+            asio::error_code ec;
+            auto ep = socket_.remote_endpoint(ec);
+            if (accepted && is_unix_endpoint(ep))
+            {
+                ep = socket_.local_endpoint(ec);
+            }
+            return stream_endpoint_address(ep);
+        }
+
+        void cork()
+        {
+            corked_ = true;
+        }
+
+        void uncork()
+        {
+            corked_ = false;
+            if (!sending_ && ok())
+            {
+                post_send();
+            }
+        }
+
+        void notify_send_high()
+        {
+            if (send_high_reached_)
+            {
+                return;
+            }
+            send_high_reached_ = true;
+            //not in the sender's call stack
+            ios_.post([this, self = shared_from_this()]() {
+                if (ok() && send_high_reached_)
                 {
-                    error(e, int(logic_error_));
+                    notify_send_watermark(socket_data_type::socket_send_high);
                 }
-            }));
+            });
+        }
+
+        void notify_send_watermark(socket_data_type t)
+        {
+            auto msg = message::create();
+            msg->write_string(std::to_string(queued_bytes()));
+            msg->set_sender(id_);
+            msg->set_subtype(static_cast<uint8_t>(t));
+            msg->set_type(PTYPE_SOCKET);
+            on_data(msg);
+        }
+
+        void response_writable(bool writable)
+        {
+            if (0 == writable_responseid_)
+            {
+                return;
+            }
+            auto msg = message::create();
+            if (writable)
+            {
+                msg->write_string(std::to_string(queued_bytes()));
+            }
+            else
+            {
+                msg->set_header("closed");
+            }
+            msg->set_type(writable ? PTYPE_TEXT : PTYPE_ERROR);
+            msg->set_responseid(-writable_responseid_);
+            writable_responseid_ = 0;
+            on_data(msg);
         }
 
         virtual void error(const asio::error_code& e, int lerrcode, const std::string& lemsg = "")
         {
+            response_writable(false);
+
             //error
             {
                 auto msg = message::create();
@@ -266,17 +476,51 @@ namespace moon
         {
             return (on_data != nullptr);
         }
+
+        //after error(): send what is queued then close the socket, waits at most NET_LINGER_TIMEOUT
+        void linger_close()
+        {
+            if (!sending_)
+            {
+                close();
+                return;
+            }
+            lingering_ = true;
+            auto timer = std::make_shared<asio::steady_timer>(ios_);
+            timer->expires_from_now(std::chrono::milliseconds(NET_LINGER_TIMEOUT));
+            std::weak_ptr<base_connection> wp = shared_from_this();
+            timer->async_wait([wp, timer](const asio::error_code&) {
+                if (auto self = wp.lock())
+                {
+                    self->close();
+                }
+            });
+        }
     protected:
         bool sending_;
+        bool send_high_reached_;
+        bool lingering_;
+        bool close_after_send_;
+        //sends are only queued, uncork writes them in one batch
+        bool corked_;
+        send_policy send_policy_;
         uint32_t id_;
-        time_t last_recv_time_;
+        int32_t writable_responseid_;
+        int64_t last_recv_time_;
+        size_t send_high_;
+        size_t send_low_;
+        //bytes in send_queue_ and buffers_holder_, may be read by other thread(sharded listener)
+        std::atomic<size_t> queued_bytes_;
+        size_t sending_bytes_;
+        //send_queue_[send_head_, size) are waiting, a vector allocates nothing for idle connections(unlike deque)
+        size_t send_head_;
         network_logic_error logic_error_;
         asio::io_service& ios_;
         socket_t socket_;
         handler_allocator allocator_;
         const_buffers_holder  buffers_holder_;
         std::string remote_addr_;
-        std::deque<buffer_ptr_t> send_queue_;
+        std::vector<buffer_ptr_t> send_queue_;
         moon::log* log_;
     };
 }
\ No newline at end of file
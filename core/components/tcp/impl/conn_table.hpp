@@ -0,0 +1,159 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+namespace moon
+{
+    class base_connection;
+
+    using connection_ptr_t = std::shared_ptr<base_connection>;
+
+    //connid = shard << CONN_SHARD_SHIFT | generation << CONN_INDEX_BITS | slot index. shard 0 is the owner worker
+    const uint32_t CONN_INDEX_BITS = 21;
+    const uint32_t CONN_INDEX_MASK = (1u << CONN_INDEX_BITS) - 1;
+    const uint32_t CONN_GENERATION_BITS = 5;
+    const uint32_t CONN_GENERATION_MASK = (1u << CONN_GENERATION_BITS) - 1;
+    const uint32_t CONN_SHARD_SHIFT = CONN_INDEX_BITS + CONN_GENERATION_BITS;
+    const uint32_t CONN_MAX_SHARD = (1u << (32 - CONN_SHARD_SHIFT)) - 1;
+
+    inline uint32_t conn_shard(uint32_t connid)
+    {
+        return connid >> CONN_SHARD_SHIFT;
+    }
+
+    /*
+    Connections of a tcp component or one of its shards(or sessions of a udp component), O(1) id allocation and lookup, like handle_table.
+    Released slots are reused in FIFO order and bump their generation, so a stale connid is rejected
+    until its slot has been reused 2^CONN_GENERATION_BITS times. Not thread safe.
+    */
+    template<typename TConn>
+    class basic_conn_table
+    {
+    public:
+        explicit basic_conn_table(uint32_t shard = 0)
+            :tag_(shard << CONN_SHARD_SHIFT)
+            , size_(0)
+            , free_head_(0)
+            , free_tail_(0)
+        {
+            //index 0 is never used, so connid is never 0
+            slots_.emplace_back(0);
+        }
+
+        //return 0 if the table is full
+        uint32_t add(const TConn& conn)
+        {
+            uint32_t idx = free_head_;
+            if (0 != idx)
+            {
+                free_head_ = slots_[idx].next_free;
+                if (0 == free_head_)
+                {
+                    free_tail_ = 0;
+                }
+            }
+            else
+            {
+                if (slots_.size() > CONN_INDEX_MASK)
+                {
+                    return 0;
+                }
+                idx = static_cast<uint32_t>(slots_.size());
+                slots_.emplace_back(tag_ | idx);
+            }
+
+            auto& s = slots_[idx];
+            s.conn = conn;
+            s.next_free = 0;
+            ++size_;
+            return s.id;
+        }
+
+        const TConn& find(uint32_t connid) const
+        {
+            static const TConn null_conn;
+            uint32_t idx = connid & CONN_INDEX_MASK;
+            if (idx >= slots_.size() || slots_[idx].id != connid)
+            {
+                return null_conn;
+            }
+            return slots_[idx].conn;
+        }
+
+        bool remove(uint32_t connid)
+        {
+            uint32_t idx = connid & CONN_INDEX_MASK;
+            if (0 == idx || idx >= slots_.size() || slots_[idx].id != connid || nullptr == slots_[idx].conn)
+            {
+                return false;
+            }
+
+            auto& s = slots_[idx];
+            s.conn.reset();
+            //the slot's next id, find rejects it until the slot is reused
+            uint32_t generation = ((connid >> CONN_INDEX_BITS) + 1) & CONN_GENERATION_MASK;
+            s.id = tag_ | (generation << CONN_INDEX_BITS) | idx;
+            if (0 == free_tail_)
+            {
+                free_head_ = idx;
+            }
+            else
+            {
+                slots_[free_tail_].next_free = idx;
+            }
+            free_tail_ = idx;
+            --size_;
+            return true;
+        }
+
+        template<typename Handler>
+        void for_each(Handler&& h) const
+        {
+            //by index and by copy, h may remove connections
+            for (size_t i = 1; i < slots_.size(); ++i)
+            {
+                if (nullptr != slots_[i].conn)
+                {
+                    TConn conn = slots_[i].conn;
+                    h(conn);
+                }
+            }
+        }
+
+        void clear()
+        {
+            slots_.erase(slots_.begin() + 1, slots_.end());
+            size_ = 0;
+            free_head_ = 0;
+            free_tail_ = 0;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        struct slot
+        {
+            explicit slot(uint32_t v)
+                :id(v)
+                , next_free(0)
+            {
+            }
+
+            TConn conn;
+            uint32_t id;
+            uint32_t next_free;
+        };
+
+        uint32_t tag_;
+        size_t size_;
+        uint32_t free_head_;
+        uint32_t free_tail_;
+        std::deque<slot> slots_;
+    };
+
+    using conn_table = basic_conn_table<connection_ptr_t>;
+}
@@ -1,8 +1,15 @@
 #pragma once
 #include "base_connection.hpp"
+#include "common/block_pool.hpp"
 
 namespace moon
 {
+    /*
+    Text protocols(redis, http...): the service asks for n bytes or a line with read(), requests are queued
+    and answered in order from one read buffer, as many as buffered data allows in one pass.
+    All delimiters end with '\n', it is searched with memchr and the scan resumes where the last one stopped.
+    The buffer starts at NMSG_READ_BUFFER_MIN, grows when a request needs more and shrinks back when traffic is light.
+    */
     class custom_connection: public base_connection
     {
     public:
@@ -11,43 +18,94 @@ namespace moon
 
         explicit custom_connection(asio::io_service& ios)
             :base_connection(ios)
-            ,restore_write_offset_(0)
-            , prew_read_offset_(0)
+            , handling_(false)
+            , reading_(false)
+            , rbuf_(nullptr)
+            , rcap_(NMSG_READ_BUFFER_MIN)
+            , rhead_(0)
+            , rtail_(0)
+            , scan_(0)
+            , need_(0)
+            , request_head_(0)
         {
         }
 
+        ~custom_connection()
+        {
+            block_pool::deallocate(rbuf_, rcap_);
+        }
+
         void start(bool accepted, int32_t responseid = 0) override
         {
             base_connection_t::start(accepted, responseid);
-            response_msg_ = message::create(8192);
+            rbuf_ = static_cast<char*>(block_pool::allocate(rcap_));
             read_some();
         }
 
         bool read(const read_request& ctx) override
         {
-            if (is_open() && read_request_.responseid ==0)
+            if (!is_open() || !ok())
+            {
+                return false;
+            }
+
+            requests_.push_back(ctx);
+            //queued behind others, or answered by the running pass
+            if (handling_ || requests_.size() - request_head_ > 1)
             {
-                read_request_ = ctx;
-                restore_buffer_offset();
-                if (response_msg_->size() > 0)
-                {
-                    //guarantee read is async operation
-                    ios_.post([this] {
-                        handle_read_request();
-                    });
-                }
                 return true;
             }
-            return false;
+
+            reserve(ctx);
+            if (rtail_ != rhead_)
+            {
+                //guarantee read is async operation
+                ios_.post([this, self = shared_from_this()] {
+                    if (ok())
+                    {
+                        handle_read_request();
+                    }
+                });
+            }
+            return true;
         }
 
     protected:
+        //the buffer is only moved or resized here and in the read handler, when no read is pending
         void read_some()
         {
-            socket_.async_read_some(asio::buffer(buffer_),
+            if (need_ > rcap_)
+            {
+                size_t cap = rcap_;
+                while (cap < need_)
+                {
+                    cap *= 2;
+                }
+                resize_buffer(cap);
+            }
+            need_ = 0;
+
+            //a line longer than the buffer doubles it
+            if (rtail_ == rcap_)
+            {
+                if (0 != rhead_)
+                {
+                    rtail_ -= rhead_;
+                    memmove(rbuf_, rbuf_ + rhead_, rtail_);
+                    rhead_ = 0;
+                }
+                else
+                {
+                    resize_buffer(rcap_ * 2);
+                }
+            }
+
+            reading_ = true;
+            socket_.async_read_some(asio::buffer(rbuf_ + rtail_, rcap_ - rtail_),
                 make_custom_alloc_handler(allocator_,
                     [this,self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
             {
+                reading_ = false;
                 if (!ok())
                     return;
 
@@ -63,126 +121,187 @@ namespace moon
                     return;
                 }
 
-                //CONSOLE_DEBUG(logger(), "connection recv:%u %s",id_, std::string((char*)buffer_.data(), bytes_transferred).data());
-
-                last_recv_time_ = std::time(nullptr);
-                restore_buffer_offset();
-                response_msg_->get_buffer()->write_back(buffer_.data(), 0, bytes_transferred);
+                last_recv_time_ = time::coarse_millsecond();
+                rtail_ += bytes_transferred;
+                bool full = (rtail_ == rcap_);
                 handle_read_request();
+                if (!ok())
+                    return;
+
+                if (full && rcap_ < NMSG_READ_BUFFER_SIZE)
+                {
+                    resize_buffer(rcap_ * 2);
+                }
+                else if (rhead_ == rtail_ && request_head_ == requests_.size()
+                    && rcap_ > NMSG_READ_BUFFER_MIN && bytes_transferred <= rcap_ / 4)
+                {
+                    resize_buffer(rcap_ / 2);
+                }
                 read_some();
             }));
         }
 
-        void restore_buffer_offset()
+        //bytes a fixed length request needs fit in the buffer, so it is read in one go. The next read_some grows it
+        void reserve(const read_request& req)
         {
-            auto buf = response_msg_->get_buffer();
-            buf->offset_writepos(restore_write_offset_);
-            buf->seek(prew_read_offset_, buffer::Current);
-            restore_write_offset_ = 0;
-            prew_read_offset_ = 0;
+            if (req.delim != read_delim::FIXEDLEN || req.size <= rcap_)
+            {
+                return;
+            }
+            need_ = std::max(need_, req.size);
         }
 
-        void read_with_delim(buffer* buf,const string_view_t& delim)
+        void resize_buffer(size_t cap)
         {
-            size_t dszie = buf->size();
-            string_view_t strref(buf->data(), dszie);
-            size_t pos = strref.find(delim);
-            if (pos != string_view_t::npos)
+            auto p = static_cast<char*>(block_pool::allocate(cap));
+            size_t n = rtail_ - rhead_;
+            if (0 != n)
             {
-                buf->offset_writepos(-static_cast<int>(dszie - pos));
-                restore_write_offset_ = static_cast<int>(dszie - pos);
-                prew_read_offset_ = static_cast<int>(pos + delim.size());
-                make_response(response_msg_);
+                memcpy(p, rbuf_ + rhead_, n);
             }
+            block_pool::deallocate(rbuf_, rcap_);
+            rbuf_ = p;
+            rcap_ = cap;
+            rhead_ = 0;
+            rtail_ = n;
         }
 
-        void handle_read_request()
+        //offset of the delimiter from rhead_, npos if it is not received yet
+        size_t find_delim(read_delim delim, size_t& dlen)
         {
-            auto buf = response_msg_->get_buffer();
-            size_t dszie = buf->size();
-
-            if (0 == read_request_.responseid || dszie ==0)
+            string_view_t d;
+            switch (delim)
             {
-                return;
+            case read_delim::CRLF: d = STR_CRLF; break;
+            case read_delim::DCRLF: d = STR_DCRLF; break;
+            default: d = STR_LF; break;
             }
+            dlen = d.size();
 
-            switch (read_request_.delim)
+            const char* begin = rbuf_ + rhead_;
+            size_t len = rtail_ - rhead_;
+            while (scan_ < len)
             {
-            case read_delim::FIXEDLEN:
-            {
-                if (buf->size() >= read_request_.size)
+                auto p = static_cast<const char*>(memchr(begin + scan_, '\n', len - scan_));
+                if (nullptr == p)
                 {
-                    buf->offset_writepos(-static_cast<int>(dszie - read_request_.size));
-                    restore_write_offset_ = static_cast<int>(dszie - read_request_.size);
-                    prew_read_offset_ = static_cast<int>(read_request_.size);
-                    make_response(response_msg_);
                     break;
                 }
-                else
+                size_t end = static_cast<size_t>(p - begin) + 1;
+                if (end >= dlen && 0 == memcmp(begin + end - dlen, d.data(), dlen))
                 {
-                    return;
+                    return end - dlen;
                 }
+                scan_ = end;
             }
-            case read_delim::LF:
+            scan_ = len;
+            return string_view_t::npos;
+        }
+
+        //answer queued requests in order while buffered data is enough
+        void handle_read_request()
+        {
+            handling_ = true;
+            while (request_head_ < requests_.size() && ok())
             {
-                read_with_delim(buf,STR_LF);
-                break;
+                //copy, the response may queue more requests
+                read_request req = requests_[request_head_];
+                size_t readable = rtail_ - rhead_;
+                size_t n = 0;
+                size_t consumed = 0;
+                if (req.delim == read_delim::FIXEDLEN)
+                {
+                    if (readable < req.size)
+                    {
+                        reserve(req);
+                        break;
+                    }
+                    n = consumed = req.size;
+                }
+                else
+                {
+                    size_t dlen = 0;
+                    n = find_delim(req.delim, dlen);
+                    if (n == string_view_t::npos)
+                    {
+                        break;
+                    }
+                    consumed = n + dlen;
+                }
+
+                auto msg = message::create(n);
+                msg->get_buffer()->write_back(rbuf_ + rhead_, 0, n);
+                rhead_ += consumed;
+                scan_ = 0;
+                ++request_head_;
+                make_response(msg, req.responseid);
             }
-            case read_delim::CRLF:
+
+            if (request_head_ == requests_.size())
             {
-                read_with_delim(buf, STR_CRLF);
-                break;
+                requests_.clear();
+                request_head_ = 0;
             }
-            case read_delim::DCRLF:
+
+            //a pending read writes at rtail_
+            if (rhead_ == rtail_ && !reading_)
             {
-                read_with_delim(buf, STR_DCRLF);
-                break;
-            }
-            default:
-                break;
+                rhead_ = rtail_ = 0;
             }
+            handling_ = false;
         }
 
         void error(const asio::error_code& e, int logicerr, const std::string& lemsg = "") override
         {
             (void)lemsg;
-            {
-                switch (logicerr)
-                {
-                case int(moon::network_logic_error::timeout):
-                    response_msg_->set_header("timeout");
-                    break;
-                default:
-                    response_msg_->set_header("closed");
-                    break;
-                }
-
-                if (e)
-                {
-                    response_msg_->write_string(moon::format("%s.(%d)", e.message().data(), e.value()));
-                }
+            response_writable(false);
 
-                if (read_request_.responseid != 0)
-                {
-                    make_response(response_msg_, PTYPE_ERROR);
-                }
-            }
+            auto on_data_f = on_data;
             on_close(id_);
+            //reads issued by the responses below fail
             on_data = nullptr;
+
+            std::string content;
+            if (e)
+            {
+                content = moon::format("%s.(%d)", e.message().data(), e.value());
+            }
+
+            std::vector<read_request> requests;
+            requests.swap(requests_);
+            for (size_t i = request_head_; i < requests.size(); ++i)
+            {
+                auto msg = message::create();
+                msg->set_header((logicerr == int(moon::network_logic_error::timeout)) ? "timeout" : "closed");
+                msg->write_string(content);
+                msg->set_type(PTYPE_ERROR);
+                msg->set_responseid(-requests[i].responseid);
+                on_data_f(msg);
+            }
+            request_head_ = 0;
         }
 
-        void make_response(const message_ptr_t & msg, uint8_t mtype = PTYPE_TEXT)
+        void make_response(const message_ptr_t & msg, int32_t responseid, uint8_t mtype = PTYPE_TEXT)
         {
             msg->set_type(mtype);
-            msg->set_responseid(-read_request_.responseid);
-            read_request_.responseid = 0;
+            msg->set_responseid(-responseid);
             on_data(msg);
         }
     protected:
-        int restore_write_offset_ ;
-        int prew_read_offset_;
-        message_ptr_t  response_msg_;
-        std::array<uint8_t, 1024> buffer_;
-        read_request read_request_;
+        bool handling_;
+        //an async_read_some into rbuf_[rtail_, rcap_) is pending
+        bool reading_;
+        char* rbuf_;
+        size_t rcap_;
+        //rbuf_[rhead_, rtail_) is received but not consumed
+        size_t rhead_;
+        size_t rtail_;
+        //rbuf_[rhead_, rhead_ + scan_) has no delimiter for the first request
+        size_t scan_;
+        //buffer size the first fixed length request needs
+        size_t need_;
+        //requests_[request_head_, size) are waiting
+        size_t request_head_;
+        std::vector<read_request> requests_;
     };
-}
\ No newline at end of file
+}
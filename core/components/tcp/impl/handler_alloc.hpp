@@ -12,52 +12,29 @@
 #include <type_traits>
 #include <utility>
 
+#include "common/block_pool.hpp"
+
 // Class to manage the memory to be used for handler-based custom allocation.
-// It contains a single block of memory which may be returned for allocation
-// requests. If the memory is in use when an allocation request is made, the
-// allocator delegates allocation to the global heap.
+// Handler memory comes from the calling thread's block_pool instead of an
+// inline block, so an idle connection does not carry handler storage and the
+// read and write handlers in flight are both served from the cache.
 class handler_allocator
 {
 public:
-    handler_allocator()
-        : in_use_(false)
-    {
-    }
+    handler_allocator() = default;
 
     handler_allocator(const handler_allocator&) = delete;
     handler_allocator& operator=(const handler_allocator&) = delete;
 
     void* allocate(std::size_t size)
     {
-        if (!in_use_ && size < sizeof(storage_))
-        {
-            in_use_ = true;
-            return &storage_;
-        }
-        else
-        {
-            return ::operator new(size);
-        }
+        return moon::block_pool::allocate(size);
     }
 
-    void deallocate(void* pointer)
+    void deallocate(void* pointer, std::size_t size)
     {
-        if (pointer == &storage_)
-        {
-            in_use_ = false;
-        }
-        else
-        {
-            ::operator delete(pointer);
-        }
+        moon::block_pool::deallocate(pointer, moon::block_pool::block_size(size));
     }
-
-private:
-    // Storage space used for handler-based custom memory allocation.
-    typename std::aligned_storage<1024>::type storage_;
-
-    // Whether the handler-based custom allocation storage has been used.
-    bool in_use_;
 };
 
 // Wrapper class template for handler objects to allow handler memory
@@ -85,10 +62,10 @@ public:
         return this_handler->allocator_.allocate(size);
     }
 
-    friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
+    friend void asio_handler_deallocate(void* pointer, std::size_t size,
         custom_alloc_handler<Handler>* this_handler)
     {
-        this_handler->allocator_.deallocate(pointer);
+        this_handler->allocator_.deallocate(pointer, size);
     }
 
 private:
@@ -0,0 +1,430 @@
+#pragma once
+#include "http_framing.hpp"
+
+namespace moon
+{
+    struct http_head
+    {
+        int64_t content_length = -1;
+        bool chunked = false;
+        bool close = false;
+        bool expect_continue = false;
+    };
+
+    /*
+    HTTP/1.1 server side. Requests are framed in C++(Content-Length or chunked body) and each complete request
+    is one socket_recv message: request line and header fields as received, then the body(chunked body decoded).
+    Pipelined requests are delivered in order, the service answers them in order. The request which ends
+    at the end of received data is delivered with the read buffer itself, others are copied out.
+    After a request which does not keep the connection alive, later data is discarded.
+    */
+    class http_connection : public base_connection
+    {
+    public:
+        using base_connection_t = base_connection;
+        using socket_t = base_connection_t;
+
+        explicit http_connection(asio::io_service& ios)
+            :base_connection(ios)
+            , max_message_size_(WS_MAX_MESSAGE_SIZE)
+            , rsize_(HTTP_READ_SIZE_MIN)
+            , read_remain_(0)
+            , scan_(0)
+            , closing_(false)
+            , continued_(false)
+        {
+        }
+
+        void start(bool accepted, int32_t responseid = 0) override
+        {
+            base_connection_t::start(accepted, responseid);
+            auto msg = message::create();
+            msg->write_string(remote_addr_);
+            msg->set_sender(id_);
+            msg->set_subtype(static_cast<uint8_t>(accepted ? socket_data_type::socket_accept : socket_data_type::socket_connect));
+            msg->set_type(PTYPE_SOCKET);
+            on_data(msg);
+            if (ok())
+            {
+                set_no_delay();
+                read_some();
+            }
+        }
+
+        //max bytes of a request body
+        void set_message_limit(size_t max_message_size)
+        {
+            max_message_size_ = max_message_size;
+        }
+
+        //status line, Content-Length and Connection are written here, headers are extra header lines each ends with CRLF.
+        //keepalive false: the connection is closed after this response is sent
+        static buffer_ptr_t make_response(int status, string_view_t headers, string_view_t body, bool keepalive)
+        {
+            char line[96];
+            int n = 0;
+            //no Content-Length for 1xx and 204
+            if (status < 200 || status == 204)
+            {
+                n = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, status_text(status));
+            }
+            else
+            {
+                n = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n", status, status_text(status), body.size());
+            }
+            string_view_t conn = keepalive ? "Connection: keep-alive\r\n"_sv : "Connection: close\r\n"_sv;
+
+            auto buf = message::create_buffer(static_cast<size_t>(n) + conn.size() + headers.size() + STR_CRLF.size() + body.size());
+            buf->write_back(line, 0, n);
+            buf->write_back(conn.data(), 0, conn.size());
+            buf->write_back(headers.data(), 0, headers.size());
+            buf->write_back(STR_CRLF.data(), 0, STR_CRLF.size());
+            buf->write_back(body.data(), 0, body.size());
+            if (!keepalive)
+            {
+                buf->set_flag(uint8_t(buffer_flag::close));
+            }
+            return buf;
+        }
+
+        static const char* status_text(int status)
+        {
+            switch (status)
+            {
+            case 100: return "Continue";
+            case 101: return "Switching Protocols";
+            case 200: return "OK";
+            case 201: return "Created";
+            case 202: return "Accepted";
+            case 204: return "No Content";
+            case 206: return "Partial Content";
+            case 301: return "Moved Permanently";
+            case 302: return "Found";
+            case 303: return "See Other";
+            case 304: return "Not Modified";
+            case 307: return "Temporary Redirect";
+            case 308: return "Permanent Redirect";
+            case 400: return "Bad Request";
+            case 401: return "Unauthorized";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 408: return "Request Timeout";
+            case 409: return "Conflict";
+            case 411: return "Length Required";
+            case 413: return "Payload Too Large";
+            case 414: return "URI Too Long";
+            case 415: return "Unsupported Media Type";
+            case 429: return "Too Many Requests";
+            case 431: return "Request Header Fields Too Large";
+            case 500: return "Internal Server Error";
+            case 501: return "Not Implemented";
+            case 502: return "Bad Gateway";
+            case 503: return "Service Unavailable";
+            case 504: return "Gateway Timeout";
+            default: return "Unknown";
+            }
+        }
+
+        //request line and the framing header fields of head(ends with an empty line), false if it is malformed
+        static bool parse_head(string_view_t head, http_head& h)
+        {
+            size_t pos = head.find(STR_CRLF);
+            auto line = head.substr(0, pos);
+            //method SP request-target SP HTTP-version
+            size_t sp1 = line.find(' ');
+            size_t sp2 = line.rfind(' ');
+            if (sp1 == string_view_t::npos || 0 == sp1 || sp2 == sp1 + 1 || sp2 == sp1)
+            {
+                return false;
+            }
+            auto version = line.substr(sp2 + 1);
+            if (version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0)
+            {
+                return false;
+            }
+
+            bool conn_close = false;
+            bool conn_keepalive = false;
+            pos += STR_CRLF.size();
+            while (pos < head.size())
+            {
+                size_t end = head.find(STR_CRLF, pos);
+                if (end == pos || end == string_view_t::npos)
+                {
+                    break;
+                }
+                line = head.substr(pos, end - pos);
+                pos = end + STR_CRLF.size();
+
+                size_t colon = line.find(':');
+                if (colon == string_view_t::npos || 0 == colon)
+                {
+                    return false;
+                }
+                auto name = line.substr(0, colon);
+                auto value = http::trim(line.substr(colon + 1));
+                if (iequal_string(name, HTTP_CONTENT_LENGTH))
+                {
+                    int64_t n = 0;
+                    if (!http::to_size(value, n) || (h.content_length >= 0 && h.content_length != n))
+                    {
+                        return false;
+                    }
+                    h.content_length = n;
+                }
+                else if (iequal_string(name, HTTP_TRANSFER_ENCODING))
+                {
+                    if (!http::is_chunked(value))
+                    {
+                        return false;
+                    }
+                    h.chunked = true;
+                }
+                else if (iequal_string(name, HTTP_CONNECTION))
+                {
+                    conn_close = conn_close || http::has_token(value, HTTP_CLOSE);
+                    conn_keepalive = conn_keepalive || http::has_token(value, HTTP_KEEP_ALIVE);
+                }
+                else if (iequal_string(name, HTTP_EXPECT))
+                {
+                    h.expect_continue = iequal_string(value, HTTP_100_CONTINUE);
+                }
+            }
+
+            //HTTP/1.0 closes unless asked, HTTP/1.1 keeps alive unless asked
+            h.close = conn_close || (version[7] == '0' && !conn_keepalive);
+            if (h.chunked)
+            {
+                //both are present: Transfer-Encoding wins, and the connection is not reused
+                h.close = h.close || h.content_length >= 0;
+                h.content_length = 0;
+            }
+            else if (h.content_length < 0)
+            {
+                h.content_length = 0;
+            }
+            return true;
+        }
+
+    protected:
+        void read_some()
+        {
+            if (nullptr == rmsg_)
+            {
+                rmsg_ = message::create(2 * rsize_);
+            }
+
+            //rest of a big request is read exactly, so it ends at the end of its own message
+            size_t n = (0 != read_remain_) ? read_remain_ : rsize_;
+            bool exact = (0 != read_remain_);
+            auto buf = rmsg_->get_buffer();
+            socket_.async_read_some(asio::buffer(buf->prepare(n), n),
+                make_custom_alloc_handler(allocator_,
+                    [this, self = shared_from_this(), n, exact](const asio::error_code& e, std::size_t bytes_transferred)
+            {
+                if (!ok())
+                    return;
+
+                if (e)
+                {
+                    error(e, 0);
+                    return;
+                }
+
+                if (bytes_transferred == 0)
+                {
+                    read_some();
+                    return;
+                }
+
+                last_recv_time_ = time::coarse_millsecond();
+                rmsg_->get_buffer()->offset_writepos(static_cast<int>(bytes_transferred));
+                if (exact)
+                {
+                    read_remain_ -= bytes_transferred;
+                    parse(false, 0);
+                }
+                else
+                {
+                    parse(bytes_transferred == n, bytes_transferred);
+                }
+            }));
+        }
+
+        //deliver all complete requests, then keep reading.
+        //responses of pipelined requests answered in the same pass are written together
+        void parse(bool full, size_t bytes_transferred)
+        {
+            cork();
+            int status = parse_requests();
+            uncork();
+            if (0 != status)
+            {
+                fail(status);
+                return;
+            }
+
+            if (!ok())
+            {
+                return;
+            }
+
+            if (full && rsize_ < HTTP_READ_SIZE_MAX)
+            {
+                rsize_ *= 2;
+            }
+            else if (0 != bytes_transferred && rsize_ > HTTP_READ_SIZE_MIN && bytes_transferred <= rsize_ / 4)
+            {
+                rsize_ /= 2;
+            }
+            read_some();
+        }
+
+        //answer a bad request with its status, tell the service, then close after it is sent
+        void fail(int status)
+        {
+            auto reason = status_text(status);
+            base_connection::send(make_response(status, string_view_t{}, string_view_t{}, false));
+            error(asio::error_code(), status, reason);
+            linger_close();
+        }
+
+        //return http status of a bad request, 0 if there is no error
+        int parse_requests()
+        {
+            while (nullptr != rmsg_ && ok())
+            {
+                auto buf = rmsg_->get_buffer();
+                if (chunked_.active())
+                {
+                    int status = chunked_.decode(buf, max_message_size_);
+                    if (0 != status)
+                    {
+                        return status;
+                    }
+                    if (!chunked_.done())
+                    {
+                        break;
+                    }
+                    deliver(chunked_.take());
+                    continue;
+                }
+
+                size_t len = buf->size();
+                if (0 == len)
+                {
+                    break;
+                }
+
+                if (closing_)
+                {
+                    buf->clear();
+                    break;
+                }
+
+                const char* p = buf->data();
+                size_t head = http::find_head_end(p, len, scan_);
+                if (head == string_view_t::npos)
+                {
+                    if (len > HTTP_MAX_HEADER_SIZE)
+                    {
+                        return 431;
+                    }
+                    break;
+                }
+
+                if (head > HTTP_MAX_HEADER_SIZE)
+                {
+                    return 431;
+                }
+
+                http_head h;
+                if (!parse_head(string_view_t{ p, head }, h))
+                {
+                    return 400;
+                }
+
+                if (static_cast<uint64_t>(h.content_length) > max_message_size_)
+                {
+                    return 413;
+                }
+
+                closing_ = h.close;
+
+                if (h.chunked)
+                {
+                    auto msg = message::create(head + HTTP_READ_SIZE_MIN);
+                    msg->get_buffer()->write_back(p, 0, head);
+                    buf->seek(static_cast<int>(head), buffer::Current);
+                    chunked_.start(std::move(msg));
+                    if (h.expect_continue)
+                    {
+                        send_continue();
+                    }
+                    continue;
+                }
+
+                size_t total = head + static_cast<size_t>(h.content_length);
+                if (len < total)
+                {
+                    hold_partial_message(rmsg_, total, rsize_, read_remain_);
+                    if (h.expect_continue && !continued_)
+                    {
+                        continued_ = true;
+                        send_continue();
+                    }
+                    //parsed again when the body is received, the head is not scanned twice
+                    scan_ = head - 1;
+                    break;
+                }
+
+                continued_ = false;
+                if (len == total)
+                {
+                    message_ptr_t msg;
+                    msg.swap(rmsg_);
+                    deliver(msg);
+                    break;
+                }
+
+                auto msg = message::create(total);
+                msg->get_buffer()->write_back(p, 0, total);
+                buf->seek(static_cast<int>(total), buffer::Current);
+                deliver(msg);
+            }
+            return 0;
+        }
+
+        void send_continue()
+        {
+            constexpr string_view_t s = "HTTP/1.1 100 Continue\r\n\r\n"_sv;
+            auto buf = message::create_buffer(s.size());
+            buf->write_back(s.data(), 0, s.size());
+            base_connection::send(buf);
+        }
+
+        void deliver(const message_ptr_t& msg)
+        {
+            msg->set_sender(id_);
+            msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+            msg->set_type(PTYPE_SOCKET);
+            on_data(msg);
+        }
+
+    protected:
+        size_t max_message_size_;
+        size_t rsize_;
+        //bytes of a big request which are read directly into rmsg_
+        size_t read_remain_;
+        //rmsg_'s data before scan_ has no end of head
+        size_t scan_;
+        //the last request does not keep the connection alive
+        bool closing_;
+        //100 Continue is sent for the request whose body is being received
+        bool continued_;
+        message_ptr_t rmsg_;
+        //head and decoded body of the chunked request being received
+        http::chunked_decoder chunked_;
+    };
+}
@@ -0,0 +1,290 @@
+#pragma once
+#include "base_connection.hpp"
+
+namespace moon
+{
+    constexpr size_t HTTP_READ_SIZE_MIN = NMSG_READ_BUFFER_MIN;
+    constexpr size_t HTTP_READ_SIZE_MAX = NMSG_READ_BUFFER_SIZE;
+    //a chunk size line longer than this is a bad request
+    constexpr size_t HTTP_CHUNK_LINE_MAX = 1024;
+
+    constexpr const string_view_t HTTP_CONTENT_LENGTH = "content-length"_sv;
+    constexpr const string_view_t HTTP_TRANSFER_ENCODING = "transfer-encoding"_sv;
+    constexpr const string_view_t HTTP_CONNECTION = "connection"_sv;
+    constexpr const string_view_t HTTP_EXPECT = "expect"_sv;
+    constexpr const string_view_t HTTP_CHUNKED = "chunked"_sv;
+    constexpr const string_view_t HTTP_CLOSE = "close"_sv;
+    constexpr const string_view_t HTTP_KEEP_ALIVE = "keep-alive"_sv;
+    constexpr const string_view_t HTTP_100_CONTINUE = "100-continue"_sv;
+
+    /*
+    A message of total bytes bigger than rsize is partly received at the read position of msg. The first call moves it to
+    a message of exactly total bytes and sets remain to the bytes not received yet, so the rest is read into it directly.
+    While remain is set, later calls keep that message. Shared by http and websocket connections.
+    */
+    inline void hold_partial_message(message_ptr_t& msg, size_t total, size_t rsize, size_t& remain)
+    {
+        if (0 != remain || total <= rsize)
+        {
+            return;
+        }
+        auto buf = msg->get_buffer();
+        size_t len = buf->size();
+        auto m = message::create(total);
+        m->get_buffer()->write_back(buf->data(), 0, len);
+        msg = std::move(m);
+        remain = total - len;
+    }
+
+    //framing of http/1.1 messages, shared by the server(http_connection) and the client(http_client) side
+    namespace http
+    {
+        inline string_view_t trim(string_view_t s)
+        {
+            size_t b = 0;
+            size_t e = s.size();
+            while (b < e && (s[b] == ' ' || s[b] == '\t'))
+                ++b;
+            while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t'))
+                --e;
+            return s.substr(b, e - b);
+        }
+
+        inline bool to_size(string_view_t s, int64_t& n)
+        {
+            n = 0;
+            if (s.empty())
+            {
+                return false;
+            }
+            for (auto c : s)
+            {
+                if (c < '0' || c > '9' || n > (INT64_MAX - 9) / 10)
+                {
+                    return false;
+                }
+                n = n * 10 + (c - '0');
+            }
+            return true;
+        }
+
+        //comma separated, case insensitive
+        inline bool has_token(string_view_t value, string_view_t token)
+        {
+            size_t pos = 0;
+            while (pos <= value.size())
+            {
+                size_t comma = value.find(',', pos);
+                if (comma == string_view_t::npos)
+                {
+                    comma = value.size();
+                }
+                if (iequal_string(trim(value.substr(pos, comma - pos)), token))
+                {
+                    return true;
+                }
+                pos = comma + 1;
+            }
+            return false;
+        }
+
+        //chunked must be the last transfer coding
+        inline bool is_chunked(string_view_t value)
+        {
+            size_t comma = value.rfind(',');
+            auto last = (comma == string_view_t::npos) ? value : trim(value.substr(comma + 1));
+            return iequal_string(last, HTTP_CHUNKED);
+        }
+
+        inline int hex_value(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        }
+
+        //offset after the empty line which ends a head in [begin, begin + len), npos if it is not received yet.
+        //scan: bytes known to have no end of head, updated for the next call
+        inline size_t find_head_end(const char* begin, size_t len, size_t& scan)
+        {
+            while (scan < len)
+            {
+                auto p = static_cast<const char*>(memchr(begin + scan, '\n', len - scan));
+                if (nullptr == p)
+                {
+                    break;
+                }
+                size_t end = static_cast<size_t>(p - begin) + 1;
+                if (end >= STR_DCRLF.size() && 0 == memcmp(begin + end - STR_DCRLF.size(), STR_DCRLF.data(), STR_DCRLF.size()))
+                {
+                    scan = 0;
+                    return end;
+                }
+                scan = end;
+            }
+            return string_view_t::npos;
+        }
+
+        /*
+        Decodes a chunked body as it arrives: chunk data is appended to the message which already holds the head,
+        chunk extensions and trailer fields are dropped.
+        */
+        class chunked_decoder
+        {
+        public:
+            enum class state :std::uint8_t
+            {
+                none,
+                size,
+                data,
+                crlf,
+                trailer,
+            };
+
+            chunked_decoder()
+                :state_(state::none)
+                , remain_(0)
+                , body_size_(0)
+            {
+            }
+
+            void start(message_ptr_t out)
+            {
+                out_ = std::move(out);
+                state_ = state::size;
+                remain_ = 0;
+                body_size_ = 0;
+            }
+
+            //a body is being decoded
+            bool active() const
+            {
+                return nullptr != out_ && state::none != state_;
+            }
+
+            //the last chunk and trailer fields are received
+            bool done() const
+            {
+                return nullptr != out_ && state::none == state_;
+            }
+
+            message_ptr_t take()
+            {
+                message_ptr_t msg;
+                msg.swap(out_);
+                return msg;
+            }
+
+            //consume bytes of in until done or in is empty. return http status of a malformed or too big body, 0 if ok
+            int decode(buffer* in, size_t max_body_size)
+            {
+                while (state::none != state_)
+                {
+                    const char* p = in->data();
+                    size_t len = in->size();
+                    if (0 == len)
+                    {
+                        break;
+                    }
+
+                    switch (state_)
+                    {
+                    case state::size:
+                    {
+                        auto e = static_cast<const char*>(memchr(p, '\n', len));
+                        if (nullptr == e)
+                        {
+                            return (len > HTTP_CHUNK_LINE_MAX) ? 400 : 0;
+                        }
+                        size_t line = static_cast<size_t>(e - p) + 1;
+                        //hex size, then optional chunk extensions
+                        size_t size = 0;
+                        size_t i = 0;
+                        for (; i < line; ++i)
+                        {
+                            int v = hex_value(p[i]);
+                            if (v < 0)
+                            {
+                                break;
+                            }
+                            if (size > max_body_size)
+                            {
+                                return 413;
+                            }
+                            size = size * 16 + static_cast<size_t>(v);
+                        }
+                        if (0 == i || (p[i] != ';' && p[i] != '\r' && p[i] != ' ' && p[i] != '\t'))
+                        {
+                            return 400;
+                        }
+                        if (body_size_ + size > max_body_size)
+                        {
+                            return 413;
+                        }
+                        in->seek(static_cast<int>(line), buffer::Current);
+                        remain_ = size;
+                        state_ = (0 == size) ? state::trailer : state::data;
+                        break;
+                    }
+                    case state::data:
+                    {
+                        size_t n = std::min(len, remain_);
+                        out_->get_buffer()->write_back(p, 0, n);
+                        in->seek(static_cast<int>(n), buffer::Current);
+                        remain_ -= n;
+                        body_size_ += n;
+                        if (0 == remain_)
+                        {
+                            state_ = state::crlf;
+                        }
+                        break;
+                    }
+                    case state::crlf:
+                    {
+                        if (len < STR_CRLF.size())
+                        {
+                            return 0;
+                        }
+                        if (0 != memcmp(p, STR_CRLF.data(), STR_CRLF.size()))
+                        {
+                            return 400;
+                        }
+                        in->seek(static_cast<int>(STR_CRLF.size()), buffer::Current);
+                        state_ = state::size;
+                        break;
+                    }
+                    case state::trailer:
+                    {
+                        //an empty line ends the body
+                        auto e = static_cast<const char*>(memchr(p, '\n', len));
+                        if (nullptr == e)
+                        {
+                            return (len > HTTP_MAX_HEADER_SIZE) ? 431 : 0;
+                        }
+                        size_t line = static_cast<size_t>(e - p) + 1;
+                        in->seek(static_cast<int>(line), buffer::Current);
+                        if (line == STR_CRLF.size() && p[0] == '\r')
+                        {
+                            state_ = state::none;
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                }
+                return 0;
+            }
+
+        private:
+            state state_;
+            size_t remain_;
+            size_t body_size_;
+            message_ptr_t out_;
+        };
+    }
+}
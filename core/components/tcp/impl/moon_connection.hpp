@@ -1,9 +1,16 @@
 #pragma once
 #include "base_connection.hpp"
 #include "common/byte_convert.hpp"
+#include "common/block_pool.hpp"
 
 namespace moon
 {
+    /*
+    Default protocol: 2 bytes big-endian length + data.
+    Reads as much as possible into a per-connection buffer, every complete frame in it is delivered in one pass,
+    so a client which pipelines small frames costs one read per batch instead of two reads per frame.
+    The buffer starts at NMSG_READ_BUFFER_MIN, so idle connections stay small, and grows up to NMSG_READ_BUFFER_SIZE under load.
+    */
     class moon_connection : public base_connection
     {
     public:
@@ -12,10 +19,18 @@ namespace moon
 
         explicit moon_connection(asio::io_service& ios)
             :base_connection(ios)
-            ,msg_size_(0)
+            , rbuf_(nullptr)
+            , rcap_(NMSG_READ_BUFFER_MIN)
+            , rhead_(0)
+            , rtail_(0)
         {
         }
 
+        ~moon_connection()
+        {
+            block_pool::deallocate(rbuf_, rcap_);
+        }
+
         void start(bool accepted, int32_t responseid = 0) override
         {
             base_connection_t::start(accepted, responseid);
@@ -27,11 +42,18 @@ namespace moon
             on_data(msg);
             if (ok())
             {
-                read_header();
+                rbuf_ = static_cast<char*>(block_pool::allocate(rcap_));
+                read_some();
             }
         }
 
-       bool send(const buffer_ptr_t & data) override
+        void encode(const buffer_ptr_t & data) override
+        {
+            encode_message(data);
+        }
+
+        //prepend the length once(pack_size flag), a framed buffer can be shared by many connections
+        static void encode_message(const buffer_ptr_t & data)
         {
             if (!data->check_flag(uint8_t(buffer_flag::pack_size)))
             {
@@ -40,13 +62,18 @@ namespace moon
                 MOON_DCHECK(data->write_front(&size, 0, 1), "send_packsize write_front failed");
                 data->set_flag(uint8_t(buffer_flag::pack_size));
             }
+        }
+
+        bool send(const buffer_ptr_t & data) override
+        {
+            encode(data);
             return base_connection_t::send(data);
         }
 
     protected:
-        void read_header()
+        virtual void read_some()
         {
-            asio::async_read(socket_, asio::buffer(&msg_size_, sizeof(msg_size_)),
+            socket_.async_read_some(asio::buffer(rbuf_ + rtail_, rcap_ - rtail_),
                 make_custom_alloc_handler(allocator_,
                     [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
             {
@@ -61,28 +88,108 @@ namespace moon
 
                 if (bytes_transferred == 0)
                 {
-                    read_header();
+                    read_some();
                     return;
                 }
 
-                last_recv_time_ = std::time(nullptr);
-                net2host(msg_size_);
-                if (msg_size_ > MAX_NMSG_SIZE)
+                last_recv_time_ = time::coarse_millsecond();
+                rtail_ += bytes_transferred;
+                parse(rtail_ == rcap_, bytes_transferred);
+            }));
+        }
+
+        //deliver all complete frames in read buffer, then keep reading
+        void parse(bool full, size_t bytes_transferred)
+        {
+            size_t need = 0;
+            while (rtail_ - rhead_ >= sizeof(message_size_t))
+            {
+                message_size_t size = 0;
+                memcpy(&size, rbuf_ + rhead_, sizeof(size));
+                net2host(size);
+                if (size > MAX_NMSG_SIZE)
                 {
                     error(asio::error_code(), int(network_logic_error::read_message_size_max));
                     close();
                     return;
                 }
-                read_body(msg_size_);
-            }));
+
+                size_t readable = rtail_ - rhead_ - sizeof(size);
+                if (readable < size)
+                {
+                    if (sizeof(size) + size > NMSG_READ_BUFFER_SIZE)
+                    {
+                        //frame does not fit in read buffer, read the rest into the message block directly
+                        auto msg = message::create(size);
+                        msg->get_buffer()->write_back(rbuf_ + rhead_ + sizeof(size), 0, readable);
+                        rhead_ = rtail_ = 0;
+                        read_body(msg, size - readable);
+                        return;
+                    }
+                    need = sizeof(size) + size;
+                    break;
+                }
+
+                rhead_ += sizeof(size);
+                if (size > 0)
+                {
+                    auto msg = message::create(size);
+                    msg->get_buffer()->write_back(rbuf_ + rhead_, 0, size);
+                    rhead_ += size;
+                    deliver(msg);
+                    if (!ok())
+                        return;
+                }
+            }
+
+            //move the partial frame to the front
+            size_t left = rtail_ - rhead_;
+            if (left != 0 && rhead_ != 0)
+            {
+                memmove(rbuf_, rbuf_ + rhead_, left);
+            }
+            rhead_ = 0;
+            rtail_ = left;
+
+            size_t cap = rcap_;
+            if (full && cap < NMSG_READ_BUFFER_SIZE)
+            {
+                cap *= 2;
+            }
+            else if (0 == left && cap > NMSG_READ_BUFFER_MIN && bytes_transferred <= cap / 4)
+            {
+                cap /= 2;
+            }
+            while (cap < need)
+            {
+                cap *= 2;
+            }
+            if (cap != rcap_)
+            {
+                resize_buffer(cap);
+            }
+            read_some();
+        }
+
+        void resize_buffer(size_t cap)
+        {
+            auto p = static_cast<char*>(block_pool::allocate(cap));
+            if (rtail_ != 0)
+            {
+                memcpy(p, rbuf_, rtail_);
+            }
+            block_pool::deallocate(rbuf_, rcap_);
+            rbuf_ = p;
+            rcap_ = cap;
         }
 
-        void read_body(message_size_t size)
+        //the rest(size bytes) of a frame bigger than the read buffer
+        virtual void read_body(const message_ptr_t& msg, size_t size)
         {
-            auto buf = message::create_buffer(size);
-            asio::async_read(socket_, asio::buffer((void*)buf->data(), size),
+            auto buf = msg->get_buffer();
+            asio::async_read(socket_, asio::buffer(buf->data() + buf->size(), size),
                 make_custom_alloc_handler(allocator_,
-                    [this, self = shared_from_this(), buf](const asio::error_code& e, std::size_t bytes_transferred)
+                    [this, self = shared_from_this(), msg](const asio::error_code& e, std::size_t bytes_transferred)
             {
                 if (!ok())
                     return;
@@ -93,24 +200,28 @@ namespace moon
                     return;
                 }
 
-                if (bytes_transferred == 0)
+                last_recv_time_ = time::coarse_millsecond();
+                msg->get_buffer()->offset_writepos(static_cast<int>(bytes_transferred));
+                deliver(msg);
+                if (ok())
                 {
-                    read_header();
-                    return;
+                    read_some();
                 }
-
-                buf->offset_writepos(static_cast<int>(bytes_transferred));
-                auto msg = message::create(buf);
-                msg->set_sender(id_);
-                msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
-                msg->set_type(PTYPE_SOCKET);
-                on_data(msg);
-
-                read_header();
             }));
         }
 
+        void deliver(const message_ptr_t& msg)
+        {
+            msg->set_sender(id_);
+            msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+            msg->set_type(PTYPE_SOCKET);
+            on_data(msg);
+        }
+
     protected:
-        message_size_t msg_size_;
+        char* rbuf_;
+        size_t rcap_;
+        size_t rhead_;
+        size_t rtail_;
     };
-}
\ No newline at end of file
+}
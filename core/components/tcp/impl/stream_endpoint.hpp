@@ -0,0 +1,126 @@
+#pragma once
+#include "config.h"
+#include "asio.hpp"
+#include "components/tcp/tcp.h"
+#if TARGET_PLATFORM != PLATFORM_WINDOWS
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace moon
+{
+    /*
+    Connections use generic stream sockets, so one connection type serves tcp and unix domain sockets.
+    An address "unix:/path"(unix_endpoint_path) is a unix domain socket, the port is ignored. Not available on windows.
+    */
+    using stream_endpoint_t = asio::generic::stream_protocol::endpoint;
+    using stream_acceptor_t = asio::basic_socket_acceptor<asio::generic::stream_protocol>;
+
+    //throws asio::system_error
+    inline std::vector<stream_endpoint_t> resolve_stream_endpoint(asio::io_service& ios, const std::string& address, const std::string& port)
+    {
+        std::vector<stream_endpoint_t> endpoints;
+        auto path = unix_endpoint_path(address);
+        if (!path.empty())
+        {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+            endpoints.emplace_back(asio::local::stream_protocol::endpoint(std::string(path.data(), path.size())));
+#else
+            throw asio::system_error(asio::error::address_family_not_supported);
+#endif
+            return endpoints;
+        }
+
+        asio::ip::tcp::resolver resolver(ios);
+        asio::ip::tcp::resolver::query query(address, port);
+        for (auto iter = resolver.resolve(query); iter != asio::ip::tcp::resolver::iterator(); ++iter)
+        {
+            endpoints.emplace_back(iter->endpoint());
+        }
+        return endpoints;
+    }
+
+    //"ip:port" or "unix:path", the path of a unix socket's unnamed peer is empty
+    inline std::string stream_endpoint_address(const stream_endpoint_t& ep)
+    {
+        switch (ep.protocol().family())
+        {
+        case AF_INET:
+        case AF_INET6:
+        {
+            asio::ip::tcp::endpoint tep;
+            if (ep.size() > tep.capacity())
+            {
+                break;
+            }
+            memcpy(tep.data(), ep.data(), ep.size());
+            tep.resize(ep.size());
+            asio::error_code ec;
+            return tep.address().to_string(ec) + ":" + std::to_string(tep.port());
+        }
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        case AF_UNIX:
+        {
+            asio::local::stream_protocol::endpoint lep;
+            if (ep.size() > lep.capacity())
+            {
+                break;
+            }
+            memcpy(lep.data(), ep.data(), ep.size());
+            lep.resize(ep.size());
+            return std::string(UNIX_ENDPOINT_PREFIX.data(), UNIX_ENDPOINT_PREFIX.size()) + lep.path();
+        }
+#endif
+        default:
+            break;
+        }
+        return std::string();
+    }
+
+    inline bool is_unix_endpoint(const stream_endpoint_t& ep)
+    {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        return ep.protocol().family() == AF_UNIX;
+#else
+        (void)ep;
+        return false;
+#endif
+    }
+
+    //remove the socket file a previous process left at path. Only a socket nobody listens on(connect is refused) is removed
+    inline void remove_stale_unix_socket(const std::string& path)
+    {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        struct stat st;
+        if (0 != ::lstat(path.data(), &st) || !S_ISSOCK(st.st_mode))
+        {
+            return;
+        }
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            return;
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.data(), path.size());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return;
+        }
+        bool refused = (0 != ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) && errno == ECONNREFUSED);
+        ::close(fd);
+        if (refused)
+        {
+            ::unlink(path.data());
+        }
+#else
+        (void)path;
+#endif
+    }
+}
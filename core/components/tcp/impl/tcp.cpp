@@ -10,23 +10,149 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "log.h"
 #include "message.hpp"
 #include "service.h"
+#include "server.h"
 #include "core/worker.h"
+#include "core/io_pool.h"
 #include "common/string.hpp"
 #include "moon_connection.hpp"
 #include "custom_connection.hpp"
 #include "ws_connection.hpp"
+#include "http_connection.hpp"
+#include "conn_table.hpp"
+#include "timeout_wheel.hpp"
+#include "stream_endpoint.hpp"
+#include "uring_connection.hpp"
 
 namespace moon
 {
+    /*
+    Read timeout of the connections owned by one thread: the owner worker or a shard.
+    A read only stores the coarse clock in the connection, its wheel entry is not moved. When the entry expires
+    the real deadline is checked and the entry is added again if the connection was active since,
+    so a connection is touched about once per timeout period and a tick only costs the expiring entries.
+    */
+    struct idle_checker
+    {
+        idle_checker(asio::io_service& ios, int64_t timeout_ms, int64_t precision_ms)
+            :timer(ios)
+            , timeout(timeout_ms)
+            , precision(precision_ms)
+            , wheel(static_cast<uint64_t>(time::coarse_millsecond() / precision_ms))
+        {
+        }
+
+        void add(uint32_t connid)
+        {
+            wheel.add(connid, to_tick(time::coarse_millsecond() + timeout));
+        }
+
+        //find(connid) returns a connection_ptr_t copy, nullptr if it was closed
+        template<typename Find>
+        void expire(Find&& find)
+        {
+            auto now = time::coarse_millsecond();
+            wheel.advance(static_cast<uint64_t>(now / precision), [this, now, &find](uint32_t connid) {
+                auto conn = find(connid);
+                if (nullptr == conn)
+                {
+                    return;
+                }
+                auto deadline = conn->last_recv_time() + timeout;
+                if (deadline > now)
+                {
+                    wheel.add(connid, to_tick(deadline));
+                }
+                else
+                {
+                    conn->timeout();
+                }
+            });
+        }
+
+        uint64_t to_tick(int64_t ms) const
+        {
+            return static_cast<uint64_t>((ms + precision - 1) / precision);
+        }
+
+        asio::steady_timer timer;
+        int64_t timeout;
+        int64_t precision;
+        timeout_wheel wheel;
+    };
+
+    using idle_checker_ptr_t = std::shared_ptr<idle_checker>;
+
+    //settings of new connections
+    struct conn_options
+    {
+        protocol_type type;
+        send_policy policy;
+        size_t send_high;
+        size_t send_low;
+        size_t max_message_size;
+        size_t stream_size;
+    };
+
+    /*
+    An acceptor and its connections on another thread: a worker(SO_REUSEPORT shard) or a network io thread.
+    Connections' io runs on that thread, their messages are sent to the owner service through server.
+    conns is locked because the owner service looks up connections from its own thread, io operations are posted to the shard's thread.
+    */
+    struct tcp_shard
+    {
+        tcp_shard(asio::io_service& s, uint32_t idx)
+            :ios(s)
+            , index(idx)
+            , conns(idx)
+        {
+        }
+
+        //called in shard's thread, return 0 if the table is full
+        uint32_t add(const connection_ptr_t& conn)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            return conns.add(conn);
+        }
+
+        void remove(uint32_t connid)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            conns.remove(connid);
+        }
+
+        connection_ptr_t find(uint32_t connid)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            return conns.find(connid);
+        }
 
-    using connection_ptr_t = std::shared_ptr<base_connection>;
+        asio::io_service& ios;
+        uint32_t index;
+        std::mutex lock;
+        conn_table conns;
+        //only touched in shard's thread
+        idle_checker_ptr_t idle;
+        //copied from the owner at listen, the owner's setters may still change theirs
+        conn_options opts;
+        std::shared_ptr<stream_acceptor_t> acceptor;
+    };
+
+    using tcp_shard_ptr_t = std::shared_ptr<tcp_shard>;
 
     struct tcp::imp
     {
         imp() noexcept
-            : connuid_(1)
-            , timeout_(0)
+            : timeout_(0)
+            , timeout_precision_(NET_TIMEOUT_PRECISION)
             , type_(protocol_type::protocol_default)
+            , send_policy_(send_policy::block)
+            , send_high_(0)
+            , send_low_(0)
+            , max_message_size_(WS_MAX_MESSAGE_SIZE)
+            , stream_size_(0)
+            , iothread_(false)
+            , shardnum_(0)
+            , backend_(io_backend::epoll)
             , log_(nullptr)
         {
         }
@@ -36,16 +162,22 @@ namespace moon
             return *ios_;
         }
 
-        uint32_t make_connid()
+        //return false if the table is full, the socket is closed
+        bool add_connection(const connection_ptr_t& conn)
         {
-            if (connuid_ == 0xFFFF)
-                connuid_ = 1;
-            auto id = connuid_++;
-            while (conns_.find(id) != conns_.end())
+            auto id = conns_.add(conn);
+            if (0 == id)
             {
-                id = connuid_++;
+                CONSOLE_WARN(log_, "tcp too many connections %zu", conns_.size());
+                conn->close();
+                return false;
             }
-            return id;
+            conn->set_id(id);
+            if (nullptr != idle_)
+            {
+                idle_->add(id);
+            }
+            return true;
         }
 
         void make_response(string_view_t data, const std::string& header, int32_t responseid, uint8_t mtype = PTYPE_SOCKET)
@@ -61,46 +193,274 @@ namespace moon
         }
 
         connection_ptr_t create_connection()
+        {
+            auto conn = make_connection(io_service(), options());
+            conn->on_data = on_data_;
+            conn->on_close = std::bind(&tcp::remove, get_self(), std::placeholders::_1);
+            return conn;
+        }
+
+#if defined(MOON_HAS_IO_URING)
+        //listen with the io_uring backend, false if it is not available
+        bool uring_listen(const stream_endpoint_t& endpoint)
+        {
+            if (type_ != protocol_type::protocol_default || iothread_ || shardnum_ > 1)
+            {
+                CONSOLE_WARN(log_, "tcp io_uring backend: default protocol without shards or io thread only, use epoll");
+                return false;
+            }
+
+            auto loop = std::make_shared<uring_loop>(io_service(), log_);
+            std::weak_ptr<tcp> wp = get_self();
+            loop->on_accept = [this, wp, loop = std::weak_ptr<uring_loop>(loop)](int fd) {
+                auto self = wp.lock();
+                auto l = loop.lock();
+                if (nullptr == self || !self->ok() || nullptr == l)
+                {
+                    ::close(fd);
+                    return;
+                }
+                connection_ptr_t conn = std::allocate_shared<uring_connection>(block_allocator<uring_connection>(), io_service(), l, fd);
+                conn->setlogger(log_);
+                conn->set_send_limit(send_high_, send_low_, send_policy_);
+                conn->on_data = on_data_;
+                conn->on_close = std::bind(&tcp::remove, self, std::placeholders::_1);
+                if (add_connection(conn))
+                {
+                    conn->start(true);
+                }
+            };
+
+            std::string reason;
+            if (!loop->listen(endpoint, reason))
+            {
+                CONSOLE_WARN(log_, "tcp io_uring backend is not available %s, use epoll", reason.data());
+                return false;
+            }
+            uring_ = loop;
+            return true;
+        }
+#endif
+
+        conn_options options() const
+        {
+            return conn_options{ type_, send_policy_, send_high_, send_low_, max_message_size_, stream_size_ };
+        }
+
+        connection_ptr_t make_connection(asio::io_service& ios, const conn_options& opts)
         {
             connection_ptr_t conn;
-            switch (type_)
+            switch (opts.type)
             {
             case moon::protocol_type::protocol_default:
-                conn = std::make_shared<moon_connection>(io_service());
+                conn = std::allocate_shared<moon_connection>(block_allocator<moon_connection>(), ios);
                 break;
             case moon::protocol_type::protocol_custom:
-                conn = std::make_shared<custom_connection>(io_service());
+                conn = std::allocate_shared<custom_connection>(block_allocator<custom_connection>(), ios);
                 break;
             case moon::protocol_type::protocol_websocket:
-                conn = std::make_shared<ws_connection>(io_service());
+            {
+                auto ws = std::allocate_shared<ws_connection>(block_allocator<ws_connection>(), ios);
+                ws->set_message_limit(opts.max_message_size, opts.stream_size);
+                conn = ws;
+                break;
+            }
+            case moon::protocol_type::protocol_http:
+            {
+                auto http = std::allocate_shared<http_connection>(block_allocator<http_connection>(), ios);
+                http->set_message_limit(opts.max_message_size);
+                conn = http;
                 break;
+            }
             default:
                 break;
             }
 
             conn->setlogger(log_);
-            conn->on_data = on_data_;
-            conn->on_close = std::bind(&tcp::remove, get_self(), std::placeholders::_1);
-
+            conn->set_send_limit(opts.send_high, opts.send_low, opts.policy);
             return conn;
         }
 
+        //framing of this component's protocol, done once so the buffer can be shared by many connections
+        void encode(const buffer_ptr_t& data)
+        {
+            switch (type_)
+            {
+            case moon::protocol_type::protocol_default:
+                moon_connection::encode_message(data);
+                break;
+            case moon::protocol_type::protocol_websocket:
+                ws_connection::encode_message(data);
+                break;
+            default:
+                break;
+            }
+        }
+
+        tcp_shard* find_shard(uint32_t connid)
+        {
+            auto idx = conn_shard(connid);
+            if (0 == idx || idx > shards_.size())
+            {
+                return nullptr;
+            }
+            return shards_[idx - 1].get();
+        }
+
+        static std::shared_ptr<stream_acceptor_t> open_acceptor(asio::io_service& ios, const stream_endpoint_t& endpoint, bool reuseport)
+        {
+            auto acceptor = std::make_shared<stream_acceptor_t>(ios);
+            acceptor->open(endpoint.protocol());
+#if TARGET_PLATFORM != PLATFORM_WINDOWS
+            if (!is_unix_endpoint(endpoint))
+            {
+                acceptor->set_option(asio::socket_base::reuse_address(true));
+                if (reuseport)
+                {
+                    acceptor->set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+                }
+            }
+#else
+            (void)reuseport;
+#endif
+            acceptor->bind(endpoint);
+            acceptor->listen(std::numeric_limits<int>::max());
+            return acceptor;
+        }
+
         std::shared_ptr<tcp> get_self()
         {
             return self_.lock();
         }
 
+        void check(const idle_checker_ptr_t& c)
+        {
+            c->timer.expires_from_now(std::chrono::milliseconds(c->precision));
+            c->timer.async_wait([this, self = get_self(), c](const asio::error_code & e) {
+                //replaced by another settimeout
+                if (e || nullptr == self || !self->ok() || idle_ != c)
+                {
+                    return;
+                }
+                c->expire([this](uint32_t connid) {
+                    return connection_ptr_t(conns_.find(connid));
+                });
+                check(c);
+            });
+        }
+
+        //runs in shard's thread
+        static void shard_check(const tcp_shard_ptr_t& sh, const idle_checker_ptr_t& c)
+        {
+            c->timer.expires_from_now(std::chrono::milliseconds(c->precision));
+            c->timer.async_wait([sh, c](const asio::error_code & e) {
+                if (e || sh->idle != c)
+                {
+                    return;
+                }
+                c->expire([&sh](uint32_t connid) {
+                    return sh->find(connid);
+                });
+                shard_check(sh, c);
+            });
+        }
+
+        //(re)starts shard's read timeout check in its thread, timeout 0 stops it
+        static void start_shard_check(const tcp_shard_ptr_t& sh, int64_t timeout, int64_t precision)
+        {
+            sh->ios.post([sh, timeout, precision] {
+                if (nullptr != sh->idle)
+                {
+                    sh->idle->timer.cancel();
+                    sh->idle = nullptr;
+                }
+                if (0 == timeout)
+                {
+                    return;
+                }
+                auto c = std::make_shared<idle_checker>(sh->ios, timeout, precision);
+                {
+                    std::unique_lock<std::mutex> lk(sh->lock);
+                    sh->conns.for_each([&c](const connection_ptr_t& conn) {
+                        c->add(conn->id());
+                    });
+                }
+                sh->idle = c;
+                shard_check(sh, c);
+            });
+        }
+
+        //runs in shard's thread
+        void shard_accept(const tcp_shard_ptr_t& sh)
+        {
+            if (!sh->acceptor->is_open())
+                return;
+
+            auto conn = make_connection(sh->ios, sh->opts);
+            sh->acceptor->async_accept(conn->socket(), [this, self = get_self(), sh, conn](const asio::error_code& e)
+            {
+                if (nullptr == self || !sh->acceptor->is_open())
+                {
+                    return;
+                }
+
+                if (!e)
+                {
+                    conn->on_data = shard_on_data_;
+                    conn->on_close = [sh](uint32_t connid) { sh->remove(connid); };
+                    auto id = sh->add(conn);
+                    if (0 != id)
+                    {
+                        conn->set_id(id);
+                        if (nullptr != sh->idle)
+                        {
+                            sh->idle->add(id);
+                        }
+                        conn->start(true);
+                    }
+                    else
+                    {
+                        CONSOLE_WARN(log_, "tcp too many connections in shard %u", sh->index);
+                        asio::error_code ec;
+                        conn->socket().close(ec);
+                    }
+                }
+                else
+                {
+                    CONSOLE_WARN(log_, "tcp async_accept error %s(%d )", e.message().data(), e.value());
+                }
+                shard_accept(sh);
+            });
+        }
+
         asio::io_service* ios_;
-        uint32_t connuid_;
-        uint32_t timeout_;
+        //milliseconds
+        int64_t timeout_;
+        int64_t timeout_precision_;
         protocol_type type_;
+        send_policy send_policy_;
+        size_t send_high_;
+        size_t send_low_;
+        size_t max_message_size_;
+        size_t stream_size_;
+        bool iothread_;
+        uint32_t shardnum_;
+        io_backend backend_;
         moon::log* log_;
-        std::shared_ptr<asio::ip::tcp::acceptor> acceptor_;
-        std::shared_ptr<asio::steady_timer> checker_;
-        std::unordered_map<uint32_t, connection_ptr_t> conns_;
+        std::shared_ptr<stream_acceptor_t> acceptor_;
+        //the socket file this unix domain listener bound, removed in destroy
+        std::string unix_path_;
+        idle_checker_ptr_t idle_;
+        conn_table conns_;
+        std::vector<tcp_shard_ptr_t> shards_;
+#if defined(MOON_HAS_IO_URING)
+        std::shared_ptr<uring_loop> uring_;
+#endif
         message_ptr_t  response_msg_;
         std::weak_ptr<tcp> self_;
         std::function<void(const message_ptr_t&)> on_data_;
+        //send messages of shards' connections to the owner service
+        std::function<void(const message_ptr_t&)> shard_on_data_;
     };
 
     tcp::tcp() noexcept
@@ -120,44 +480,244 @@ namespace moon
 
     void tcp::settimeout(int seconds)
     {
-        imp_->checker_ = std::make_shared<asio::steady_timer>(imp_->io_service());
-        imp_->timeout_ = seconds;
-        check();
+        imp_->timeout_ = (seconds > 0) ? int64_t(seconds) * 1000 : 0;
+        if (nullptr != imp_->idle_)
+        {
+            imp_->idle_->timer.cancel();
+            imp_->idle_ = nullptr;
+        }
+
+        if (0 != imp_->timeout_)
+        {
+            auto c = std::make_shared<idle_checker>(imp_->io_service(), imp_->timeout_, imp_->timeout_precision_);
+            imp_->conns_.for_each([&c](const connection_ptr_t& conn) {
+                c->add(conn->id());
+            });
+            imp_->idle_ = c;
+            imp_->check(c);
+        }
+
+        for (auto& sh : imp_->shards_)
+        {
+            imp::start_shard_check(sh, imp_->timeout_, imp_->timeout_precision_);
+        }
+    }
+
+    void tcp::settimeoutprecision(int milliseconds)
+    {
+        imp_->timeout_precision_ = std::max<int64_t>(milliseconds, NET_TIMEOUT_PRECISION_MIN);
     }
 
     void tcp::setnodelay(uint32_t connid)
     {
+        if (auto sh = imp_->find_shard(connid))
+        {
+            if (auto conn = sh->find(connid))
+            {
+                sh->ios.post([conn] { conn->set_no_delay(); });
+            }
+            return;
+        }
+
+        auto& conn = imp_->conns_.find(connid);
+        if (nullptr != conn)
+        {
+            conn->set_no_delay();
+        }
+    }
+
+    void tcp::setiothread(bool v)
+    {
+        imp_->iothread_ = v;
+    }
+
+    void tcp::setshards(uint32_t n)
+    {
+        imp_->shardnum_ = n;
+    }
+
+    void tcp::setbackend(io_backend b)
+    {
+        imp_->backend_ = b;
+    }
+
+    void tcp::setsendlimit(size_t high, size_t low, send_policy policy)
+    {
+        imp_->send_high_ = high;
+        imp_->send_low_ = low;
+        imp_->send_policy_ = policy;
+        imp_->conns_.for_each([high, low, policy](const connection_ptr_t& conn) {
+            conn->set_send_limit(high, low, policy);
+        });
+
+        for (auto& sh : imp_->shards_)
+        {
+            sh->ios.post([sh, high, low, policy] {
+                sh->opts.send_high = high;
+                sh->opts.send_low = low;
+                sh->opts.policy = policy;
+                std::unique_lock<std::mutex> lk(sh->lock);
+                sh->conns.for_each([high, low, policy](const connection_ptr_t& conn) {
+                    conn->set_send_limit(high, low, policy);
+                });
+            });
+        }
+    }
+
+    void tcp::setmaxmessage(size_t bytes)
+    {
+        imp_->max_message_size_ = bytes;
+    }
+
+    void tcp::setstreamsize(size_t bytes)
+    {
+        imp_->stream_size_ = bytes;
+    }
+
+    size_t tcp::queued_bytes(uint32_t connid)
+    {
+        if (auto sh = imp_->find_shard(connid))
+        {
+            auto conn = sh->find(connid);
+            return (nullptr != conn) ? conn->queued_bytes() : 0;
+        }
+
+        auto& conn = imp_->conns_.find(connid);
+        return (nullptr != conn) ? conn->queued_bytes() : 0;
+    }
+
+    void tcp::wait_writable(uint32_t connid, int32_t responseid)
+    {
+        responseid = -responseid;
+        if (auto sh = imp_->find_shard(connid))
+        {
+            if (auto conn = sh->find(connid))
+            {
+                sh->ios.post([conn, responseid, on_data = imp_->shard_on_data_] {
+                    if (!conn->wait_writable(responseid))
+                    {
+                        auto msg = message::create();
+                        msg->write_string("wait_writable a invlid socket");
+                        msg->set_header("closed");
+                        msg->set_type(PTYPE_ERROR);
+                        msg->set_responseid(-responseid);
+                        on_data(msg);
+                    }
+                });
+                return;
+            }
+        }
+
         do
         {
-            auto iter = imp_->conns_.find(connid);
-            if (iter == imp_->conns_.end())
+            auto& conn = imp_->conns_.find(connid);
+            if (nullptr == conn)
+                break;
+
+            if (!conn->wait_writable(responseid))
+            {
                 break;
-            iter->second->set_no_delay();
+            }
+            return;
         } while (0);
+        imp_->io_service().post([this, responseid]() {
+            imp_->make_response("wait_writable a invlid socket", "closed", responseid, PTYPE_ERROR);
+        });
     }
 
     bool tcp::listen(const std::string & ip, const std::string & port)
     {
         try
         {
-            imp_->acceptor_ = std::make_shared<asio::ip::tcp::acceptor>(imp_->io_service());
+            auto endpoint = resolve_stream_endpoint(imp_->io_service(), ip, port).front();
+            auto unix_path = unix_endpoint_path(ip);
+            if (!unix_path.empty())
+            {
+                remove_stale_unix_socket(std::string(unix_path.data(), unix_path.size()));
+            }
 
-            auto& acceptor_ = imp_->acceptor_;
-            asio::ip::tcp::resolver resolver(acceptor_->get_io_service());
-            asio::ip::tcp::resolver::query query(ip, port);
-            resolver.resolve(query);
-            auto iter = resolver.resolve(query);
-            asio::ip::tcp::endpoint endpoint = *iter;
-            acceptor_->open(endpoint.protocol());
-#if TARGET_PLATFORM != PLATFORM_WINDOWS
-            acceptor_->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+            if (imp_->backend_ == io_backend::io_uring)
+            {
+#if defined(MOON_HAS_IO_URING)
+                if (imp_->uring_listen(endpoint))
+                {
+                    imp_->unix_path_ = std::string(unix_path.data(), unix_path.size());
+                    return true;
+                }
+#else
+                CONSOLE_WARN(logger(), "tcp io_uring backend is not supported on this platform, use epoll");
 #endif
-            acceptor_->bind(endpoint);
-            acceptor_->listen(std::numeric_limits<int>::max());
-            if (imp_->type_ == protocol_type::protocol_default || imp_->type_ == protocol_type::protocol_websocket)
+            }
+
+            bool auto_accept = (imp_->type_ != protocol_type::protocol_custom);
+            auto s = parent<service>();
+            auto server = s->get_server();
+            auto pool = server->iopool();
+            //custom protocol accepts by request, keeps everything in service's worker
+            bool use_io = imp_->iothread_ && pool->size() > 0 && auto_accept;
+            uint32_t shardnum = std::min(imp_->shardnum_, use_io ? pool->size() : static_cast<uint32_t>(server->workernum()));
+            shardnum = std::min(shardnum, CONN_MAX_SHARD);
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+            //no SO_REUSEPORT load balancing
+            shardnum = 0;
+#endif
+            if (!auto_accept)
+            {
+                shardnum = 0;
+            }
+
+            //one socket file, one acceptor
+            if (!unix_path.empty())
+            {
+                shardnum = std::min(shardnum, 1u);
+            }
+
+            if (use_io)
+            {
+                //all acceptors in io threads, index starts from 1, the owner worker has no connection
+                shardnum = std::max(shardnum, 1u);
+                uint32_t start = pool->next();
+                for (uint32_t i = 0; i < shardnum; ++i)
+                {
+                    auto sh = std::make_shared<tcp_shard>(pool->get(start + i), i + 1);
+                    sh->opts = imp_->options();
+                    sh->acceptor = imp::open_acceptor(sh->ios, endpoint, shardnum > 1);
+                    imp_->shards_.push_back(sh);
+                }
+            }
+            else
+            {
+                imp_->acceptor_ = imp::open_acceptor(imp_->io_service(), endpoint, shardnum > 1);
+
+                //shard i listens in the i-th worker after the owner's
+                uint32_t owner = s->get_worker()->workerid();
+                for (uint32_t i = 1; i < shardnum; ++i)
+                {
+                    auto w = server->get_worker((owner - 1 + i) % server->workernum() + 1);
+                    auto sh = std::make_shared<tcp_shard>(w->io_service(), i);
+                    sh->opts = imp_->options();
+                    sh->acceptor = imp::open_acceptor(sh->ios, endpoint, true);
+                    imp_->shards_.push_back(sh);
+                }
+            }
+
+            for (auto& sh : imp_->shards_)
+            {
+                sh->ios.post([this, self = imp_->get_self(), sh] {
+                    imp_->shard_accept(sh);
+                });
+                if (0 != imp_->timeout_)
+                {
+                    imp::start_shard_check(sh, imp_->timeout_, imp_->timeout_precision_);
+                }
+            }
+
+            if (auto_accept && !use_io)
             {
                 async_accept(0);
             }
+            //bound by this listener, removed in destroy
+            imp_->unix_path_ = std::string(unix_path.data(), unix_path.size());
             return true;
         }
         catch (asio::system_error& e)
@@ -173,7 +733,7 @@ namespace moon
 
         auto acceptor_ = imp_->acceptor_;
 
-        if (!acceptor_->is_open())
+        if (nullptr == acceptor_ || !acceptor_->is_open())
             return;
 
         auto conn = imp_->create_connection();
@@ -186,18 +746,28 @@ namespace moon
 
             if (!e)
             {
-                conn->set_id(imp_->make_connid());
-                imp_->conns_.emplace(conn->id(), conn);
-                conn->start(true);
-                
+                bool added = imp_->add_connection(conn);
+                if (added)
+                {
+                    conn->start(true);
+                }
+
                 switch (imp_->type_)
                 {
                 case protocol_type::protocol_default:
                 case protocol_type::protocol_websocket:
+                case protocol_type::protocol_http:
                     async_accept(0);
                     break;
                 case protocol_type::protocol_custom:
-                    imp_->make_response(std::to_string(conn->id()), "", responseid, PTYPE_TEXT);
+                    if (added)
+                    {
+                        imp_->make_response(std::to_string(conn->id()), "", responseid, PTYPE_TEXT);
+                    }
+                    else
+                    {
+                        imp_->make_response("tcp async_accept error too many connections", "error", responseid, PTYPE_ERROR);
+                    }
                     break;
                 default:
                     break;
@@ -205,7 +775,7 @@ namespace moon
             }
             else
             {
-                if (imp_->type_ == protocol_type::protocol_default || imp_->type_ == protocol_type::protocol_websocket)
+                if (imp_->type_ != protocol_type::protocol_custom)
                 {
                     CONSOLE_WARN(logger(), "tcp async_accept error %s(%d )", e.message().data(), e.value());
                 }
@@ -222,12 +792,11 @@ namespace moon
         responseid = -responseid;
         try
         {
-            asio::ip::tcp::resolver resolver(imp_->io_service());
-            asio::ip::tcp::resolver::query query(ip, port);
-            asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
+            //iterated until connected
+            auto endpoints = std::make_shared<std::vector<stream_endpoint_t>>(resolve_stream_endpoint(imp_->io_service(), ip, port));
             auto conn = imp_->create_connection();
-            asio::async_connect(conn->socket(), endpoint_iterator,
-                [this, self = imp_->get_self(), conn, ip, port, responseid](const asio::error_code& e, asio::ip::tcp::resolver::iterator)
+            asio::async_connect(conn->socket(), endpoints->begin(), endpoints->end(),
+                [this, self = imp_->get_self(), conn, endpoints, responseid](const asio::error_code& e, std::vector<stream_endpoint_t>::iterator)
             {
                 if (nullptr == self || !self->ok())
                 {
@@ -236,8 +805,11 @@ namespace moon
 
                 if (!e)
                 {
-                    conn->set_id(imp_->make_connid());
-                    imp_->conns_.emplace(conn->id(), conn);
+                    if (!imp_->add_connection(conn))
+                    {
+                        imp_->make_response("tcp async_connect error too many connections", "error", responseid, PTYPE_ERROR);
+                        return;
+                    }
                     conn->start(false);
                     imp_->make_response(std::to_string(conn->id()), "", responseid, PTYPE_TEXT);
                 }
@@ -259,14 +831,13 @@ namespace moon
     {
         try
         {
-            asio::ip::tcp::resolver resolver(imp_->io_service());
-            asio::ip::tcp::resolver::query query(ip, port);
-            asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-
+            auto endpoints = resolve_stream_endpoint(imp_->io_service(), ip, port);
             auto conn = imp_->create_connection();
-            asio::connect(conn->socket(), endpoint_iterator);
-            conn->set_id(imp_->make_connid());
-            imp_->conns_.emplace(conn->id(), conn);
+            asio::connect(conn->socket(), endpoints.begin(), endpoints.end());
+            if (!imp_->add_connection(conn))
+            {
+                return 0;
+            }
             conn->start(false);
             return conn->id();
         }
@@ -282,11 +853,12 @@ namespace moon
         responseid = -responseid;
         do
         {
-            auto iter = imp_->conns_.find(connid);
-            if (iter == imp_->conns_.end())
+            //custom protocol never listens with shards
+            auto& conn = imp_->conns_.find(connid);
+            if (nullptr == conn)
                 break;
 
-            if (!iter->second->read(moon::read_request{ delim, n, responseid }))
+            if (!conn->read(moon::read_request{ delim, n, responseid }))
             {
                 break;
             }
@@ -299,27 +871,111 @@ namespace moon
 
     bool tcp::send(uint32_t connid, const buffer_ptr_t & data)
     {
-        auto iter = imp_->conns_.find(connid);
-        if (iter == imp_->conns_.end())
+        if (auto sh = imp_->find_shard(connid))
+        {
+            auto conn = sh->find(connid);
+            if (nullptr == conn || nullptr == data || data->size() == 0)
+            {
+                return false;
+            }
+            //framed here, in the caller's thread, the shard's thread only reads data.
+            //data may be shared(send_message, the same buffer to many connections), framing it in several threads would race
+            conn->encode(data);
+            sh->ios.post([conn, data] { conn->base_connection::send(data); });
+            return true;
+        }
+
+        auto& conn = imp_->conns_.find(connid);
+        if (nullptr == conn)
         {
             return false;
         }
-        return iter->second->send(data);
+        return conn->send(data);
+    }
+
+    size_t tcp::multicast(const std::vector<uint32_t>& connids, const buffer_ptr_t & data)
+    {
+        if (nullptr == data || data->size() == 0)
+        {
+            return 0;
+        }
+
+        //framed once, from now on the buffer is only read, by every send queue it is in
+        imp_->encode(data);
+
+        size_t count = 0;
+        std::vector<std::vector<connection_ptr_t>> batches(imp_->shards_.size());
+        for (auto connid : connids)
+        {
+            auto idx = conn_shard(connid);
+            if (0 != idx)
+            {
+                auto sh = imp_->find_shard(connid);
+                if (nullptr == sh)
+                {
+                    continue;
+                }
+                if (auto conn = sh->find(connid))
+                {
+                    batches[idx - 1].push_back(std::move(conn));
+                    ++count;
+                }
+                continue;
+            }
+
+            auto& conn = imp_->conns_.find(connid);
+            if (nullptr != conn && conn->base_connection::send(data))
+            {
+                ++count;
+            }
+        }
+
+        //one post per shard
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            if (batches[i].empty())
+            {
+                continue;
+            }
+            imp_->shards_[i]->ios.post([conns = std::move(batches[i]), data] {
+                for (auto& conn : conns)
+                {
+                    conn->base_connection::send(data);
+                }
+            });
+        }
+        return count;
     }
 
     bool tcp::send_message(uint32_t connid, message * msg)
     {
-        return send(connid,*msg);
+        return send(connid, msg->shared_buffer());
+    }
+
+    bool tcp::send_http(uint32_t connid, int status, string_view_t headers, string_view_t body, bool keepalive)
+    {
+        return send(connid, http_connection::make_response(status, headers, body, keepalive));
     }
 
     bool tcp::close(uint32_t connid)
     {
-        auto iter = imp_->conns_.find(connid);
-        if (iter == imp_->conns_.end())
+        if (auto sh = imp_->find_shard(connid))
+        {
+            auto conn = sh->find(connid);
+            if (nullptr == conn)
+            {
+                return false;
+            }
+            sh->ios.post([conn] { conn->close(); });
+            return true;
+        }
+
+        auto conn = imp_->conns_.find(connid);
+        if (nullptr == conn)
         {
             return false;
         }
-        iter->second->close();
+        conn->close();
         return true;
     }
 
@@ -333,6 +989,10 @@ namespace moon
         imp_->ios_ = &(s->get_worker()->io_service());
         imp_->log_ = s->logger();
         imp_->on_data_ = std::bind(&service::handle_message, s, std::placeholders::_1);
+        imp_->shard_on_data_ = [server = s->get_server(), serviceid = s->id()](const message_ptr_t& msg) {
+            msg->set_receiver(serviceid);
+            server->send_message(msg);
+        };
         imp_->response_msg_ = message::create();
     }
 
@@ -340,46 +1000,65 @@ namespace moon
     {
         component::destroy();
 
-        for (auto& conn : imp_->conns_)
+        imp_->conns_.for_each([](const connection_ptr_t& conn) {
+            conn->close(true);
+        });
+        imp_->conns_.clear();
+
+        for (auto& sh : imp_->shards_)
+        {
+            sh->ios.post([sh] {
+                asio::error_code ec;
+                sh->acceptor->close(ec);
+                if (nullptr != sh->idle)
+                {
+                    sh->idle->timer.cancel();
+                    sh->idle = nullptr;
+                }
+                std::vector<connection_ptr_t> conns;
+                {
+                    std::unique_lock<std::mutex> lk(sh->lock);
+                    sh->conns.for_each([&conns](const connection_ptr_t& conn) {
+                        conns.push_back(conn);
+                    });
+                    sh->conns.clear();
+                }
+                for (auto& conn : conns)
+                {
+                    conn->close(true);
+                }
+            });
+        }
+
+        if (nullptr != imp_->idle_)
         {
-            conn.second->close(true);
+            imp_->idle_->timer.cancel();
+            imp_->idle_ = nullptr;
         }
 
-        if (imp_->checker_ != nullptr)
+#if defined(MOON_HAS_IO_URING)
+        if (nullptr != imp_->uring_)
         {
-            imp_->checker_->cancel();
+            imp_->uring_->stop();
+            imp_->uring_ = nullptr;
         }
+#endif
 
         if (nullptr != imp_->acceptor_ && imp_->acceptor_->is_open())
         {
             imp_->acceptor_->cancel();
             imp_->acceptor_->close();
         }
+
+        if (!imp_->unix_path_.empty())
+        {
+            std::remove(imp_->unix_path_.data());
+        }
     }
 
     void tcp::remove(uint32_t connid)
     {
         close(connid);
-        imp_->conns_.erase(connid);
-    }
-
-    void tcp::check()
-    {
-        auto checker_ = imp_->checker_;
-        checker_->expires_from_now(std::chrono::seconds(10));
-        checker_->async_wait([this, self = imp_->get_self()](const asio::error_code & e) {
-            if (e || nullptr == self || !self->ok())
-            {
-                return;
-            }      
-            auto now = std::time(nullptr);
-            for (auto& conn : imp_->conns_)
-            {
-                conn.second->timeout_check(now,imp_->timeout_);
-            }
-            check();
-        });
+        imp_->conns_.remove(connid);
     }
 }
-
-
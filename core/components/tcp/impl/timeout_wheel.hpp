@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace moon
+{
+    /*
+    Hierarchical timing wheel of connection ids: 3 levels of 256 slots, like the linux kernel's timer wheel.
+    Time is counted in ticks, add is O(1), advance only touches the slots whose time has come
+    and cascades a higher level slot when the level below wraps around.
+    Deadlines beyond the last level are clamped, the caller checks the real deadline when an entry expires.
+    */
+    class timeout_wheel
+    {
+    public:
+        static const uint32_t WHEEL_BITS = 8;
+        static const uint32_t WHEEL_SIZE = 1u << WHEEL_BITS;
+        static const uint32_t WHEEL_MASK = WHEEL_SIZE - 1;
+        static const uint32_t LEVELS = 3;
+        static const uint64_t MAX_DELTA = (uint64_t(1) << (LEVELS * WHEEL_BITS)) - 1;
+
+        explicit timeout_wheel(uint64_t tick = 0)
+            :tick_(tick)
+            , size_(0)
+        {
+        }
+
+        void add(uint32_t id, uint64_t expire)
+        {
+            if (expire <= tick_)
+            {
+                expire = tick_ + 1;
+            }
+            else if (expire - tick_ > MAX_DELTA)
+            {
+                expire = tick_ + MAX_DELTA;
+            }
+            insert(id, expire);
+            ++size_;
+        }
+
+        //call h(id) for every entry which expires in (tick(), tick], h may add entries
+        template<typename Handler>
+        void advance(uint64_t tick, Handler&& h)
+        {
+            while (tick_ < tick)
+            {
+                ++tick_;
+
+                uint64_t t = tick_;
+                for (uint32_t level = 1; level < LEVELS && 0 == (t & WHEEL_MASK); ++level)
+                {
+                    t >>= WHEEL_BITS;
+                    cascade(level, static_cast<uint32_t>(t & WHEEL_MASK));
+                }
+
+                auto& slot = slots_[0][tick_ & WHEEL_MASK];
+                if (slot.empty())
+                {
+                    continue;
+                }
+                //the slot gets scratch's capacity back, no allocation in steady state
+                scratch_.swap(slot);
+                size_ -= scratch_.size();
+                for (auto& e : scratch_)
+                {
+                    h(e.id);
+                }
+                scratch_.clear();
+            }
+        }
+
+        uint64_t tick() const
+        {
+            return tick_;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        struct entry
+        {
+            uint32_t id;
+            uint64_t expire;
+        };
+
+        //expire >= tick_, an entry due at tick_ goes to the slot which is about to be processed
+        void insert(uint32_t id, uint64_t expire)
+        {
+            uint64_t delta = expire - tick_;
+            uint32_t level = 0;
+            while (level + 1 < LEVELS && delta >= (uint64_t(1) << ((level + 1) * WHEEL_BITS)))
+            {
+                ++level;
+            }
+            slots_[level][(expire >> (level * WHEEL_BITS)) & WHEEL_MASK].push_back(entry{ id, expire });
+        }
+
+        void cascade(uint32_t level, uint32_t idx)
+        {
+            auto& slot = slots_[level][idx];
+            if (slot.empty())
+            {
+                return;
+            }
+            scratch_.swap(slot);
+            for (auto& e : scratch_)
+            {
+                insert(e.id, e.expire);
+            }
+            scratch_.clear();
+        }
+
+        uint64_t tick_;
+        size_t size_;
+        std::vector<entry> slots_[LEVELS][WHEEL_SIZE];
+        std::vector<entry> scratch_;
+    };
+}
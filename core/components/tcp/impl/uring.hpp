@@ -0,0 +1,299 @@
+#pragma once
+#include "config.h"
+
+#if TARGET_PLATFORM == PLATFORM_LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+//multishot recv(linux 6.0) comes after provided buffer rings(5.19) and multishot accept
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT)
+#define MOON_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(MOON_HAS_IO_URING)
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace moon
+{
+    /*
+    A minimal io_uring(no liburing): the rings are mapped once, sqes are queued in user space and
+    submitted in one io_uring_enter, completions are read from the shared completion ring without a syscall.
+    One provided buffer ring: the kernel picks a free buffer for each receive, the owner gives it back with add_buffer.
+    Only used from one thread.
+    */
+    class uring
+    {
+    public:
+        uring() = default;
+
+        uring(const uring&) = delete;
+        uring& operator=(const uring&) = delete;
+
+        ~uring()
+        {
+            if (nullptr != buf_ring_)
+            {
+                io_uring_buf_reg reg;
+                memset(&reg, 0, sizeof(reg));
+                reg.bgid = buf_group_;
+                enter_register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+                munmap(buf_ring_, buf_ring_size_);
+            }
+            if (nullptr != buffers_)
+            {
+                munmap(buffers_, static_cast<size_t>(buf_count_) * buf_size_);
+            }
+            if (nullptr != sqes_)
+            {
+                munmap(sqes_, sqes_size_);
+            }
+            if (nullptr != ring_)
+            {
+                munmap(ring_, ring_size_);
+            }
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+            }
+        }
+
+        //false if io_uring is not supported or disabled, errno is kept
+        bool open(uint32_t entries, uint32_t cq_entries)
+        {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = cq_entries;
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if (fd_ < 0)
+            {
+                return false;
+            }
+            //one mapping for both rings, completions are never dropped
+            if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+            {
+                errno = ENOSYS;
+                return false;
+            }
+
+            ring_size_ = std::max<size_t>(p.sq_off.array + p.sq_entries * sizeof(uint32_t), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+            ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+            if (MAP_FAILED == ring_)
+            {
+                ring_ = nullptr;
+                return false;
+            }
+            sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+            auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+            if (MAP_FAILED == sqes)
+            {
+                return false;
+            }
+            sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+            auto base = static_cast<char*>(ring_);
+            sq_head_ = reinterpret_cast<uint32_t*>(base + p.sq_off.head);
+            sq_tail_ = reinterpret_cast<uint32_t*>(base + p.sq_off.tail);
+            sq_flags_ = reinterpret_cast<uint32_t*>(base + p.sq_off.flags);
+            sq_mask_ = *reinterpret_cast<uint32_t*>(base + p.sq_off.ring_mask);
+            sq_entries_ = p.sq_entries;
+            cq_head_ = reinterpret_cast<uint32_t*>(base + p.cq_off.head);
+            cq_tail_ = reinterpret_cast<uint32_t*>(base + p.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<uint32_t*>(base + p.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+            //sqes are used in ring order, the index array never changes
+            auto array = reinterpret_cast<uint32_t*>(base + p.sq_off.array);
+            for (uint32_t i = 0; i < sq_entries_; ++i)
+            {
+                array[i] = i;
+            }
+            sqe_tail_ = *sq_tail_;
+            return true;
+        }
+
+        //count(power of 2) buffers of size bytes, selected by sqes with IOSQE_BUFFER_SELECT and buf_group
+        bool setup_buffers(uint16_t group, uint32_t count, uint32_t size)
+        {
+            buf_ring_size_ = count * sizeof(io_uring_buf);
+            auto r = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (MAP_FAILED == r)
+            {
+                return false;
+            }
+            buf_ring_ = static_cast<io_uring_buf*>(r);
+
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+            reg.ring_entries = count;
+            reg.bgid = group;
+            if (enter_register(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            {
+                munmap(buf_ring_, buf_ring_size_);
+                buf_ring_ = nullptr;
+                return false;
+            }
+
+            auto b = mmap(nullptr, static_cast<size_t>(count) * size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (MAP_FAILED == b)
+            {
+                return false;
+            }
+            buffers_ = static_cast<char*>(b);
+            buf_group_ = group;
+            buf_count_ = count;
+            buf_size_ = size;
+            buf_tail_ = 0;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                add_buffer(static_cast<uint16_t>(i));
+            }
+            commit_buffers();
+            return true;
+        }
+
+        uint16_t buffer_group() const
+        {
+            return buf_group_;
+        }
+
+        const char* buffer(uint16_t bid) const
+        {
+            return buffers_ + static_cast<size_t>(bid) * buf_size_;
+        }
+
+        //give a buffer back, visible to the kernel after commit_buffers
+        void add_buffer(uint16_t bid)
+        {
+            auto& buf = buf_ring_[(buf_tail_ + buf_added_) & (buf_count_ - 1)];
+            buf.addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(bid) * buf_size_);
+            buf.len = buf_size_;
+            buf.bid = bid;
+            ++buf_added_;
+        }
+
+        void commit_buffers()
+        {
+            if (0 == buf_added_)
+            {
+                return;
+            }
+            buf_tail_ = static_cast<uint16_t>(buf_tail_ + buf_added_);
+            buf_added_ = 0;
+            //the tail shares the first entry(its resv field)
+            __atomic_store_n(&buf_ring_[0].resv, buf_tail_, __ATOMIC_RELEASE);
+        }
+
+        //a zeroed sqe, nullptr if the submission queue is full(submit first)
+        io_uring_sqe* get_sqe()
+        {
+            uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            if (sqe_tail_ - head >= sq_entries_)
+            {
+                return nullptr;
+            }
+            auto sqe = &sqes_[sqe_tail_ & sq_mask_];
+            ++sqe_tail_;
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        //queued sqes not submitted yet
+        uint32_t pending() const
+        {
+            return sqe_tail_ - __atomic_load_n(sq_tail_, __ATOMIC_RELAXED);
+        }
+
+        //submit queued sqes, also flushes completions held by the kernel after an overflow. return the result of io_uring_enter
+        int submit()
+        {
+            uint32_t n = pending();
+            uint32_t flags = 0;
+            if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+            {
+                flags |= IORING_ENTER_GETEVENTS;
+            }
+            if (0 == n && 0 == flags)
+            {
+                return 0;
+            }
+            __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+            int ret = 0;
+            do
+            {
+                ++enter_count_;
+                ret = static_cast<int>(syscall(__NR_io_uring_enter, fd_, n, 0, flags, nullptr, 0));
+            } while (ret < 0 && errno == EINTR);
+            return ret;
+        }
+
+        //handle(const io_uring_cqe&) for each completion, return the count
+        template<typename Handle>
+        uint32_t for_each_completion(Handle&& handle)
+        {
+            uint32_t head = *cq_head_;
+            uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            uint32_t count = tail - head;
+            for (; head != tail; ++head)
+            {
+                handle(cqes_[head & cq_mask_]);
+            }
+            __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        bool has_completion() const
+        {
+            return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        }
+
+        int fd() const
+        {
+            return fd_;
+        }
+
+        //io_uring_enter calls so far
+        uint64_t enter_count() const
+        {
+            return enter_count_;
+        }
+
+    private:
+        int enter_register(uint32_t opcode, void* arg, uint32_t nr)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd_, opcode, arg, nr));
+        }
+
+    private:
+        int fd_ = -1;
+        void* ring_ = nullptr;
+        size_t ring_size_ = 0;
+        io_uring_sqe* sqes_ = nullptr;
+        size_t sqes_size_ = 0;
+        uint32_t* sq_head_ = nullptr;
+        uint32_t* sq_tail_ = nullptr;
+        uint32_t* sq_flags_ = nullptr;
+        uint32_t sq_mask_ = 0;
+        uint32_t sq_entries_ = 0;
+        uint32_t sqe_tail_ = 0;
+        uint32_t* cq_head_ = nullptr;
+        uint32_t* cq_tail_ = nullptr;
+        uint32_t cq_mask_ = 0;
+        io_uring_cqe* cqes_ = nullptr;
+        //io_uring_buf_ring, used as an array: its flexible array member is at a wrong offset in c++
+        io_uring_buf* buf_ring_ = nullptr;
+        size_t buf_ring_size_ = 0;
+        char* buffers_ = nullptr;
+        uint16_t buf_group_ = 0;
+        uint32_t buf_count_ = 0;
+        uint32_t buf_size_ = 0;
+        uint16_t buf_tail_ = 0;
+        uint16_t buf_added_ = 0;
+        uint64_t enter_count_ = 0;
+    };
+}
+#endif
@@ -0,0 +1,609 @@
+#pragma once
+#include "uring.hpp"
+
+#if defined(MOON_HAS_IO_URING)
+#include "moon_connection.hpp"
+#include "stream_endpoint.hpp"
+#include "log.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace moon
+{
+    class uring_connection;
+
+    /*
+    io_uring backend of one listener, runs in the owner service's worker.
+    One multishot accept, one multishot recv per connection with buffers picked by the kernel from a shared
+    provided buffer ring, sendmsg for writes. The ring fd is watched by asio, so the worker's loop wakes up when
+    completions arrive, all of them are handled in one pass and the sqes queued meanwhile(recvs re-armed, writes)
+    are submitted with one io_uring_enter. Sqes queued outside a pass(tcp::send) are submitted by a posted flush.
+    */
+    class uring_loop :public std::enable_shared_from_this<uring_loop>
+    {
+        enum op :uint64_t
+        {
+            op_accept = 1,
+            op_recv = 2,
+            op_send = 3,
+            op_cancel = 4,
+        };
+
+        //user_data is an object pointer(8 bytes aligned) | op
+        static constexpr uint64_t OP_MASK = 7;
+
+    public:
+        uring_loop(asio::io_service& ios, moon::log* l)
+            :stopped_(false)
+            , running_(false)
+            , flush_posted_(false)
+            , listen_fd_(-1)
+            , inflight_(0)
+            , ios_(ios)
+            , watcher_(ios)
+            , retry_timer_(ios)
+            , log_(l)
+        {
+        }
+
+        ~uring_loop()
+        {
+            //the ring closes its own fd
+            if (watcher_.is_open())
+            {
+                watcher_.release();
+            }
+            if (listen_fd_ >= 0)
+            {
+                ::close(listen_fd_);
+            }
+        }
+
+        //false if io_uring is not available(old kernel or disabled), throws asio::system_error if bind or listen fails
+        bool listen(const stream_endpoint_t& endpoint, std::string& reason)
+        {
+            if (!ring_.open(IO_URING_ENTRIES, IO_URING_ENTRIES * 4) || !ring_.setup_buffers(0, IO_URING_RECV_BUFFERS, IO_URING_RECV_BUFFER_SIZE))
+            {
+                reason = moon::format("%s(%d)", strerror(errno), errno);
+                return false;
+            }
+
+            int fd = ::socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, endpoint.protocol().protocol());
+            if (fd < 0)
+            {
+                throw asio::system_error(asio::error_code(errno, asio::error::get_system_category()), "socket");
+            }
+            listen_fd_ = fd;
+            if (!is_unix_endpoint(endpoint))
+            {
+                int v = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
+            }
+            if (0 != ::bind(fd, endpoint.data(), static_cast<socklen_t>(endpoint.size())))
+            {
+                throw asio::system_error(asio::error_code(errno, asio::error::get_system_category()), "bind");
+            }
+            if (0 != ::listen(fd, SOMAXCONN))
+            {
+                throw asio::system_error(asio::error_code(errno, asio::error::get_system_category()), "listen");
+            }
+
+            watcher_.assign(ring_.fd());
+            arm_accept();
+            ring_.submit();
+            wait();
+            return true;
+        }
+
+        //stop accepting, the loop ends when connections' requests are done(they are closed by tcp)
+        void stop()
+        {
+            if (stopped_)
+            {
+                return;
+            }
+            stopped_ = true;
+            retry_timer_.cancel();
+            if (listen_fd_ >= 0)
+            {
+                if (auto sqe = get_sqe())
+                {
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = reinterpret_cast<uint64_t>(this) | op_accept;
+                    sqe->user_data = reinterpret_cast<uint64_t>(this) | op_cancel;
+                    ++inflight_;
+                }
+                ::close(listen_fd_);
+                listen_fd_ = -1;
+            }
+            post_flush();
+        }
+
+        void recv(uring_connection* conn, int fd)
+        {
+            if (auto sqe = get_sqe())
+            {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = ring_.buffer_group();
+                sqe->user_data = reinterpret_cast<uint64_t>(conn) | op_recv;
+                ++inflight_;
+                post_flush();
+            }
+        }
+
+        void send(uring_connection* conn, int fd, const msghdr* msg)
+        {
+            if (auto sqe = get_sqe())
+            {
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(msg);
+                sqe->len = 1;
+                sqe->msg_flags = MSG_NOSIGNAL;
+                sqe->user_data = reinterpret_cast<uint64_t>(conn) | op_send;
+                ++inflight_;
+                post_flush();
+            }
+        }
+
+        const char* buffer(uint16_t bid) const
+        {
+            return ring_.buffer(bid);
+        }
+
+        //the kernel sees recycled buffers after this pass
+        void recycle(uint16_t bid)
+        {
+            ring_.add_buffer(bid);
+        }
+
+        std::function<void(int)> on_accept;
+
+    private:
+        io_uring_sqe* get_sqe()
+        {
+            auto sqe = ring_.get_sqe();
+            if (nullptr == sqe)
+            {
+                //queue is full, make room
+                ring_.submit();
+                sqe = ring_.get_sqe();
+            }
+            if (nullptr == sqe)
+            {
+                CONSOLE_WARN(log_, "io_uring submission queue is full");
+            }
+            return sqe;
+        }
+
+        void arm_accept()
+        {
+            if (auto sqe = get_sqe())
+            {
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->fd = listen_fd_;
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+                sqe->accept_flags = SOCK_CLOEXEC;
+                sqe->user_data = reinterpret_cast<uint64_t>(this) | op_accept;
+                ++inflight_;
+            }
+        }
+
+        //sqes queued outside a completion pass, one io_uring_enter for all of them
+        void post_flush()
+        {
+            if (running_ || flush_posted_)
+            {
+                return;
+            }
+            flush_posted_ = true;
+            ios_.post([this, self = shared_from_this()] {
+                flush_posted_ = false;
+                ring_.commit_buffers();
+                ring_.submit();
+            });
+        }
+
+        void wait()
+        {
+            watcher_.async_read_some(asio::null_buffers(), [this, self = shared_from_this()](const asio::error_code& e, std::size_t)
+            {
+                if (e)
+                {
+                    return;
+                }
+                run();
+            });
+        }
+
+        void run()
+        {
+            running_ = true;
+            //completions posted while submitting are handled without another wake up, a few rounds at most
+            for (int i = 0; i < 4; ++i)
+            {
+                ring_.for_each_completion([this](const io_uring_cqe& cqe) {
+                    complete(cqe);
+                });
+                ring_.commit_buffers();
+                ring_.submit();
+                if (!ring_.has_completion())
+                {
+                    break;
+                }
+            }
+            running_ = false;
+
+            if (stopped_ && 0 == inflight_)
+            {
+                watcher_.release();
+                return;
+            }
+
+            if (ring_.has_completion())
+            {
+                //let other handlers of this worker run first
+                ios_.post([this, self = shared_from_this()] { run(); });
+                return;
+            }
+            wait();
+        }
+
+        void complete(const io_uring_cqe& cqe);
+
+        void accepted(int res, bool more)
+        {
+            if (!more)
+            {
+                --inflight_;
+            }
+
+            if (res >= 0)
+            {
+                if (stopped_ || nullptr == on_accept)
+                {
+                    ::close(res);
+                }
+                else
+                {
+                    on_accept(res);
+                }
+            }
+            else if (-ECANCELED != res)
+            {
+                CONSOLE_WARN(log_, "io_uring accept error %s(%d)", strerror(-res), -res);
+            }
+
+            if (more || stopped_ || listen_fd_ < 0)
+            {
+                return;
+            }
+
+            if (res >= 0)
+            {
+                arm_accept();
+                return;
+            }
+            //out of fds or memory, try again later
+            retry_timer_.expires_from_now(std::chrono::milliseconds(100));
+            retry_timer_.async_wait([this, self = shared_from_this()](const asio::error_code& e) {
+                if (e || stopped_ || listen_fd_ < 0)
+                {
+                    return;
+                }
+                arm_accept();
+                ring_.submit();
+            });
+        }
+
+    private:
+        bool stopped_;
+        //in a completion pass, queued sqes are submitted at its end
+        bool running_;
+        bool flush_posted_;
+        int listen_fd_;
+        //requests which will still complete, multishot ones count once
+        uint32_t inflight_;
+        asio::io_service& ios_;
+        uring ring_;
+        asio::posix::stream_descriptor watcher_;
+        asio::steady_timer retry_timer_;
+        moon::log* log_;
+    };
+
+    using uring_loop_ptr_t = std::shared_ptr<uring_loop>;
+
+    /*
+    Default protocol connection of the io_uring backend. Received buffers are copied into the read buffer
+    and parsed like moon_connection. The connection keeps itself alive while it has requests in the ring.
+    */
+    class uring_connection : public moon_connection
+    {
+    public:
+        uring_connection(asio::io_service& ios, const uring_loop_ptr_t& loop, int fd)
+            :moon_connection(ios)
+            , recv_armed_(false)
+            , fd_(fd)
+            , inflight_(0)
+            , iov_head_(0)
+            , body_left_(0)
+            , loop_(loop)
+        {
+            memset(&msg_, 0, sizeof(msg_));
+        }
+
+        ~uring_connection()
+        {
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+            }
+        }
+
+        bool is_open() const override
+        {
+            return fd_ >= 0;
+        }
+
+        bool close(bool exit = false) override
+        {
+            bool ret = false;
+            if (fd_ >= 0)
+            {
+                //ends the multishot recv, requests hold the socket so the fd can be closed now
+                ::shutdown(fd_, SHUT_RDWR);
+                ::close(fd_);
+                fd_ = -1;
+                ret = true;
+            }
+
+            if (exit)
+            {
+                on_data = nullptr;
+            }
+            return ret;
+        }
+
+        void set_no_delay() override
+        {
+            int v = 1;
+            setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+        }
+
+        void on_recv(int res, uint32_t flags)
+        {
+            bool more = (0 != (flags & IORING_CQE_F_MORE));
+            if (!more)
+            {
+                recv_armed_ = false;
+            }
+
+            if (res > 0)
+            {
+                auto bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                if (ok() && fd_ >= 0)
+                {
+                    feed(loop_->buffer(bid), static_cast<size_t>(res));
+                }
+                loop_->recycle(bid);
+                read_some();
+            }
+            else if (-ENOBUFS == res)
+            {
+                //all buffers in use, they are given back at the end of this pass
+                read_some();
+            }
+            else if (ok())
+            {
+                if (fd_ < 0)
+                {
+                    error(asio::error::operation_aborted, int(network_logic_error::ok));
+                }
+                else if (0 == res)
+                {
+                    error(asio::error::eof, int(network_logic_error::ok));
+                }
+                else
+                {
+                    error(asio::error_code(-res, asio::error::get_system_category()), int(network_logic_error::ok));
+                }
+            }
+
+            if (!more)
+            {
+                release();
+            }
+        }
+
+        void on_send(int res)
+        {
+            if (res < 0)
+            {
+                handle_write(asio::error_code(-res, asio::error::get_system_category()));
+            }
+            else
+            {
+                //partial write, send the rest
+                auto n = static_cast<size_t>(res);
+                while (iov_head_ < iov_.size() && n >= iov_[iov_head_].iov_len)
+                {
+                    n -= iov_[iov_head_].iov_len;
+                    ++iov_head_;
+                }
+                if (iov_head_ < iov_.size())
+                {
+                    iov_[iov_head_].iov_base = static_cast<char*>(iov_[iov_head_].iov_base) + n;
+                    iov_[iov_head_].iov_len -= n;
+                    submit_send();
+                }
+                else
+                {
+                    handle_write(asio::error_code());
+                }
+            }
+            release();
+        }
+
+    protected:
+        std::string peer_address(bool accepted) override
+        {
+            stream_endpoint_t ep;
+            auto len = static_cast<socklen_t>(ep.capacity());
+            if (0 != ::getpeername(fd_, ep.data(), &len))
+            {
+                return std::string();
+            }
+            ep.resize(len);
+            if (accepted && is_unix_endpoint(ep))
+            {
+                len = static_cast<socklen_t>(ep.capacity());
+                ::getsockname(fd_, ep.data(), &len);
+                ep.resize(len);
+            }
+            return stream_endpoint_address(ep);
+        }
+
+        void read_some() override
+        {
+            if (recv_armed_ || fd_ < 0 || !ok())
+            {
+                return;
+            }
+            recv_armed_ = true;
+            hold();
+            loop_->recv(this, fd_);
+        }
+
+        //the rest of a big frame is filled by later receives
+        void read_body(const message_ptr_t& msg, size_t size) override
+        {
+            body_ = msg;
+            body_left_ = size;
+            read_some();
+        }
+
+        void write() override
+        {
+            iov_.clear();
+            iov_head_ = 0;
+            for (auto& b : buffers_holder_.buffers())
+            {
+                iov_.push_back(iovec{ const_cast<void*>(asio::buffer_cast<const void*>(b)), asio::buffer_size(b) });
+            }
+            submit_send();
+        }
+
+    private:
+        void submit_send()
+        {
+            if (fd_ < 0)
+            {
+                ios_.post([this, self = shared_from_this()] {
+                    handle_write(asio::error::operation_aborted);
+                });
+                return;
+            }
+            msg_.msg_iov = iov_.data() + iov_head_;
+            msg_.msg_iovlen = iov_.size() - iov_head_;
+            hold();
+            loop_->send(this, fd_, &msg_);
+        }
+
+        void feed(const char* data, size_t n)
+        {
+            last_recv_time_ = time::coarse_millsecond();
+            if (nullptr != body_)
+            {
+                size_t count = std::min(n, body_left_);
+                body_->get_buffer()->write_back(data, 0, count);
+                data += count;
+                n -= count;
+                body_left_ -= count;
+                if (0 != body_left_)
+                {
+                    return;
+                }
+                message_ptr_t msg;
+                msg.swap(body_);
+                deliver(msg);
+                if (!ok() || 0 == n)
+                {
+                    return;
+                }
+            }
+
+            if (rcap_ - rtail_ < n)
+            {
+                size_t cap = rcap_;
+                while (cap - rtail_ < n)
+                {
+                    cap *= 2;
+                }
+                resize_buffer(cap);
+            }
+            memcpy(rbuf_ + rtail_, data, n);
+            rtail_ += n;
+            parse(rtail_ == rcap_, n);
+        }
+
+        void hold()
+        {
+            if (0 == inflight_++)
+            {
+                self_ = shared_from_this();
+            }
+        }
+
+        //may destroy this
+        void release()
+        {
+            if (0 == --inflight_)
+            {
+                auto self = std::move(self_);
+            }
+        }
+
+    private:
+        bool recv_armed_;
+        int fd_;
+        uint32_t inflight_;
+        size_t iov_head_;
+        size_t body_left_;
+        msghdr msg_;
+        std::vector<iovec> iov_;
+        message_ptr_t body_;
+        std::shared_ptr<base_connection> self_;
+        uring_loop_ptr_t loop_;
+    };
+
+    inline void uring_loop::complete(const io_uring_cqe& cqe)
+    {
+        auto ptr = cqe.user_data & ~OP_MASK;
+        bool more = (0 != (cqe.flags & IORING_CQE_F_MORE));
+        switch (cqe.user_data & OP_MASK)
+        {
+        case op_accept:
+            accepted(cqe.res, more);
+            return;
+        case op_recv:
+            if (!more)
+            {
+                --inflight_;
+            }
+            reinterpret_cast<uring_connection*>(ptr)->on_recv(cqe.res, cqe.flags);
+            return;
+        case op_send:
+            --inflight_;
+            reinterpret_cast<uring_connection*>(ptr)->on_send(cqe.res);
+            return;
+        default:
+            --inflight_;
+            return;
+        }
+    }
+}
+#endif
@@ -1,10 +1,17 @@
 #pragma once
 #include "base_connection.hpp"
+#include "http_framing.hpp"
 #include "common/http_request.hpp"
 #include "common/base64.hpp"
 #include "common/byte_convert.hpp"
 #include "common/sha1.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 namespace moon
 {
     namespace ws
@@ -97,16 +104,61 @@ namespace moon
             bool rsv2 : 1;
             bool rsv3 : 1;
         };
+
+        //xor payload with the 4 bytes masking key(as it is in the frame), 32/16/8 bytes a step then the tail
+        inline void unmask(uint8_t* data, size_t len, const uint8_t* key)
+        {
+            uint32_t k32 = 0;
+            memcpy(&k32, key, sizeof(k32));
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256i k256 = _mm256_set1_epi32(static_cast<int>(k32));
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(v, k256));
+            }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+            const __m128i k128 = _mm_set1_epi32(static_cast<int>(k32));
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(v, k128));
+            }
+#endif
+            const uint64_t k64 = (uint64_t(k32) << 32) | k32;
+            for (; i + 8 <= len; i += 8)
+            {
+                uint64_t v;
+                memcpy(&v, data + i, sizeof(v));
+                v ^= k64;
+                memcpy(data + i, &v, sizeof(v));
+            }
+            for (; i < len; ++i)
+            {
+                data[i] ^= key[i & 3];
+            }
+        }
     }
 
     constexpr size_t PAYLOAD_MIN_LEN = 125;
     constexpr size_t PAYLOAD_MID_LEN = 126;
     constexpr size_t PAYLOAD_MAX_LEN = 127;
 
+    //a read asks for WS_READ_SIZE_MIN bytes at first, doubles when reads fill it and halves when traffic is light
+    constexpr size_t WS_READ_SIZE_MIN = NMSG_READ_BUFFER_MIN;
+    constexpr size_t WS_READ_SIZE_MAX = NMSG_READ_BUFFER_SIZE;
+
     constexpr const string_view_t WEBSOCKET = "websocket"_sv;
     constexpr const string_view_t UPGRADE = "upgrade"_sv;
     constexpr const string_view_t WS_MAGICKEY = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"_sv;
 
+    /*
+    RFC 6455 server side. Fragmented messages are reassembled up to max message size,
+    ping is answered with pong and close with close in C++, the service only sees data messages.
+    With stream size set, a message bigger than it is delivered in parts as they arrive.
+    */
     class ws_connection: public base_connection
     {
     public:
@@ -116,22 +168,53 @@ namespace moon
         explicit ws_connection(asio::io_service& ios)
             :base_connection(ios)
             , header_delim_(STR_DCRLF.data(),STR_DCRLF.size())
+            , max_message_size_(WS_MAX_MESSAGE_SIZE)
+            , stream_size_(0)
+            , rsize_(WS_READ_SIZE_MIN)
+            , frame_remain_(0)
+            , payload_remain_(0)
+            , stream_offset_(0)
+            , stream_fin_(false)
+            , streaming_(false)
+            , in_message_(false)
+            , message_size_(0)
         {
+            memset(stream_key_, 0, sizeof(stream_key_));
         }
 
         void start(bool accepted, int32_t responseid = 0) override
         {
             base_connection_t::start(accepted, responseid);
-            response_msg_ = message::create(1024);
             read_header();
         }
 
+        void encode(const buffer_ptr_t & data) override
+        {
+            encode_message(data);
+        }
+
+        //text frame header is added once(pack_size flag), a framed buffer can be shared by many connections
+        static void encode_message(const buffer_ptr_t & data)
+        {
+            if (!data->check_flag(uint8_t(buffer_flag::pack_size)))
+            {
+                encode_frame(data, ws::opcode::text);
+                data->set_flag(uint8_t(buffer_flag::pack_size));
+            }
+        }
+
         bool send(const buffer_ptr_t & data) override
         {
-            encode_frame(data);
+            encode(data);
             return base_connection_t::send(data);
         }
 
+        void set_message_limit(size_t max_message_size, size_t stream_size)
+        {
+            max_message_size_ = max_message_size;
+            stream_size_ = stream_size;
+        }
+
     protected:
         void read_header()
         {
@@ -155,25 +238,18 @@ namespace moon
                     return;
                 }
 
-                last_recv_time_ = std::time(nullptr);
+                last_recv_time_ = time::coarse_millsecond();
 
                 size_t num_additional_bytes = sbuf->size() - bytes_transferred;
                 if (handshake(sbuf))
                 {
+                    rmsg_ = message::create(2 * rsize_);
                     if (num_additional_bytes > 0)
                     {
                         auto data = asio::buffer_cast<const char*>(sbuf->data());
-                        cache_.write_back(data, 0, num_additional_bytes);
-
-                        auto cod = decode_frame();
-                        if (ws::close_code::none != cod)
-                        {
-                            close();
-                            error(asio::error_code(), int(cod), std::string((const char*)cache_.data(), cache_.size()));
-                            return;
-                        }
+                        rmsg_->get_buffer()->write_back(data, 0, num_additional_bytes);
                     }
-                    read_some();
+                    parse(false, 0);
                 }
                 else
                 {
@@ -186,9 +262,18 @@ namespace moon
 
         void read_some()
         {
-            socket_.async_read_some(asio::buffer(buffer_),
+            if (nullptr == rmsg_)
+            {
+                rmsg_ = message::create(2 * rsize_);
+            }
+
+            //rest of a big frame is read exactly, so it ends at the end of its own message
+            size_t n = (0 != frame_remain_) ? frame_remain_ : rsize_;
+            bool exact = (0 != frame_remain_);
+            auto buf = rmsg_->get_buffer();
+            socket_.async_read_some(asio::buffer(buf->prepare(n), n),
                 make_custom_alloc_handler(allocator_,
-                    [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
+                    [this, self = shared_from_this(), n, exact](const asio::error_code& e, std::size_t bytes_transferred)
             {
                 if (!ok())
                     return;
@@ -205,20 +290,59 @@ namespace moon
                     return;
                 }
 
-                last_recv_time_ = std::time(nullptr);
-                cache_.write_back(buffer_.data(), 0, bytes_transferred);
-
-                auto cod = decode_frame();
-                if (ws::close_code::none != cod)
+                last_recv_time_ = time::coarse_millsecond();
+                rmsg_->get_buffer()->offset_writepos(static_cast<int>(bytes_transferred));
+                if (exact)
                 {
-                    close();
-                    error(asio::error_code(), int(cod), std::string(cache_.data(),cache_.size()));
-                    return;
+                    frame_remain_ -= bytes_transferred;
+                    parse(false, 0);
+                }
+                else
+                {
+                    parse(bytes_transferred == n, bytes_transferred);
                 }
-                read_some();
             }));
         }
 
+        //decode all complete frames in rmsg_ in place, then keep reading
+        void parse(bool full, size_t bytes_transferred)
+        {
+            std::string reason;
+            auto code = decode_frames(reason);
+            if (ws::close_code::none != code)
+            {
+                fail(code, reason);
+                return;
+            }
+
+            if (!ok())
+            {
+                return;
+            }
+
+            if (full && rsize_ < WS_READ_SIZE_MAX)
+            {
+                rsize_ *= 2;
+            }
+            else if (0 != bytes_transferred && rsize_ > WS_READ_SIZE_MIN && bytes_transferred <= rsize_ / 4)
+            {
+                rsize_ /= 2;
+            }
+            read_some();
+        }
+
+        //answer close frame(or report the error with a close frame), tell the service, then close after it is sent
+        void fail(ws::close_code code, const std::string& reason)
+        {
+            uint8_t tmp[2];
+            uint16_t n = static_cast<uint16_t>(code);
+            moon::host2net(n);
+            memcpy(tmp, &n, sizeof(n));
+            send_control(ws::opcode::close, tmp, sizeof(tmp));
+            error(asio::error_code(), int(code), reason);
+            linger_close();
+        }
+
         bool handshake(const std::shared_ptr<asio::streambuf>& buf)
         {
             if (handshaked_)
@@ -274,24 +398,29 @@ namespace moon
             base_connection::send(buf);
         }
 
-        ws::close_code decode_frame()
+        void send_control(ws::opcode op, const uint8_t* data, size_t size)
         {
-            const uint8_t* tmp = (const uint8_t*)(cache_.data());
-            size_t len = cache_.size();
+            auto buf = message::create_buffer(size + 2, 2);
+            buf->write_back(data, 0, size);
+            encode_frame(buf, op);
+            base_connection::send(buf);
+        }
 
-            if (len < 3)
+        //fh.len and header size, 0 if header is incomplete
+        ws::close_code decode_header(const uint8_t* tmp, size_t len, ws::frame_header& fh, size_t& need)
+        {
+            need = 0;
+            if (len < 2)
             {
                 return ws::close_code::none;
             }
 
-            size_t need = 2;
-            ws::frame_header fh;
-
+            size_t n = 2;
             fh.len = tmp[1] & 0x7F;
             switch (fh.len)
             {
-            case 126: need += 2; break;
-            case 127: need += 8; break;
+            case 126: n += 2; break;
+            case 127: n += 8; break;
             default:
                 break;
             }
@@ -302,14 +431,10 @@ namespace moon
             {
                 return ws::close_code::protocol_error;
             }
-
-            if (fh.mask)
-            {
-                need += 4;
-            }
+            n += 4;
 
             //need more data
-            if (len < need)
+            if (len < n)
             {
                 return ws::close_code::none;
             }
@@ -320,56 +445,70 @@ namespace moon
             fh.rsv2 = (tmp[0] & 0x20) != 0;
             fh.rsv3 = (tmp[0] & 0x10) != 0;
 
+            if (fh.rsv1 || fh.rsv2 || fh.rsv3)
+            {
+                // reserved bits not cleared
+                return ws::close_code::protocol_error;
+            }
+
             switch (fh.op)
             {
             case ws::opcode::text:
             case ws::opcode::binary:
+                if (in_message_)
+                {
+                    // new message before the last fragment of previous one
+                    return ws::close_code::protocol_error;
+                }
+                break;
             case ws::opcode::incomplete:
-                if (fh.rsv1 || fh.rsv2 || fh.rsv3)
+                if (!in_message_)
                 {
-                    // reserved bits not cleared
+                    // continuation frame without a message
                     return ws::close_code::protocol_error;
                 }
                 break;
-            default:
+            case ws::opcode::close:
+            case ws::opcode::ping:
+            case ws::opcode::pong:
                 if (!fh.fin)
                 {
                     // fragmented control message
                     return ws::close_code::protocol_error;
                 }
-                if (fh.len > 125)
+                if (fh.len > PAYLOAD_MIN_LEN)
                 {
                     // invalid length for control message
                     return ws::close_code::protocol_error;
                 }
-                if (fh.rsv1 || fh.rsv2 || fh.rsv3)
-                {
-                    // reserved bits not cleared
-                    return ws::close_code::protocol_error;
-                }
                 break;
+            default:
+                // reserved opcode
+                return ws::close_code::protocol_error;
             }
 
             switch (fh.len)
             {
-            case 126:
+            case PAYLOAD_MID_LEN:
             {
-                auto reallen = *(uint16_t*)(&tmp[2]);
+                uint16_t reallen = 0;
+                memcpy(&reallen, tmp + 2, sizeof(reallen));
                 moon::net2host(reallen);
                 fh.len = reallen;
-                if (fh.len < 126)
+                if (fh.len < PAYLOAD_MID_LEN)
                 {
                     // length not canonical
                     return ws::close_code::protocol_error;
                 }
                 break;
             }
-            case 127:
+            case PAYLOAD_MAX_LEN:
             {
-                auto reallen = *(uint64_t*)(&tmp[2]);
+                uint64_t reallen = 0;
+                memcpy(&reallen, tmp + 2, sizeof(reallen));
                 moon::net2host(reallen);
                 fh.len = reallen;
-                if (fh.len < 65536)
+                if (fh.len <= UINT16_MAX)
                 {
                     // length not canonical
                     return ws::close_code::protocol_error;
@@ -380,69 +519,265 @@ namespace moon
                 break;
             }
 
-            if (len < need + fh.len)
+            if (static_cast<uint8_t>(fh.op) < static_cast<uint8_t>(ws::opcode::close)
+                && (fh.len > max_message_size_ || message_size_ + fh.len > max_message_size_))
             {
-                //need more data
-                return ws::close_code::none;
+                return ws::close_code::too_big;
             }
 
-            if (fh.mask)
+            memcpy(&fh.key, tmp + n - sizeof(fh.key), sizeof(fh.key));
+            need = n;
+            return ws::close_code::none;
+        }
+
+        /*
+        Payloads are unmasked in place. The frame which ends at the end of received data is delivered
+        with rmsg_ itself(read position moved to its payload), others are copied out.
+        A frame bigger than the read size moves to a message of its exact size and the rest is read into it,
+        unless its message is streamed, then its payload is delivered as it arrives.
+        */
+        ws::close_code decode_frames(std::string& reason)
+        {
+            while (nullptr != rmsg_ && ok())
             {
-                fh.key = *((int32_t*)(tmp+(need-sizeof(fh.key))));
-                // unmask data:
-                uint8_t* d = (uint8_t*)(tmp + need);
-                for (uint64_t i = 0; i < fh.len; i++)
+                auto buf = rmsg_->get_buffer();
+                size_t len = buf->size();
+                if (0 != payload_remain_)
+                {
+                    if (0 == len)
+                    {
+                        break;
+                    }
+                    stream_payload();
+                    continue;
+                }
+
+                auto tmp = reinterpret_cast<uint8_t*>(buf->data());
+                ws::frame_header fh;
+                size_t need = 0;
+                auto code = decode_header(tmp, len, fh, need);
+                if (ws::close_code::none != code)
+                {
+                    return code;
+                }
+
+                if (0 == need)
+                {
+                    break;
+                }
+
+                bool control = static_cast<uint8_t>(fh.op) >= static_cast<uint8_t>(ws::opcode::close);
+                if (!control && 0 != stream_size_ && (streaming_ || message_size_ + fh.len > stream_size_))
+                {
+                    buf->seek(static_cast<int>(need), buffer::Current);
+                    start_stream(fh);
+                    continue;
+                }
+
+                size_t total = need + static_cast<size_t>(fh.len);
+                if (len < total)
+                {
+                    hold_partial_message(rmsg_, total, rsize_, frame_remain_);
+                    break;
+                }
+
+                uint8_t* payload = tmp + need;
+                size_t size = static_cast<size_t>(fh.len);
+                ws::unmask(payload, size, reinterpret_cast<const uint8_t*>(&fh.key));
+
+                if (control)
                 {
-                    d[i] = d[i] ^ ((uint8_t*)(&fh.key))[i % 4];
+                    buf->seek(static_cast<int>(total), buffer::Current);
+                    code = on_control(fh.op, payload, size, reason);
+                    if (ws::close_code::none != code)
+                    {
+                        return code;
+                    }
+                    continue;
+                }
+
+                in_message_ = !fh.fin;
+                if (fh.fin && nullptr == fragments_)
+                {
+                    message_size_ = 0;
+                    if (len == total)
+                    {
+                        buf->seek(static_cast<int>(need), buffer::Current);
+                        message_ptr_t msg;
+                        msg.swap(rmsg_);
+                        deliver(msg, socket_data_type::socket_recv);
+                        break;
+                    }
+
+                    auto msg = message::create(size);
+                    msg->get_buffer()->write_back(payload, 0, size);
+                    buf->seek(static_cast<int>(total), buffer::Current);
+                    deliver(msg, socket_data_type::socket_recv);
+                    continue;
+                }
+
+                //fragment of a buffered message
+                if (nullptr == fragments_)
+                {
+                    fragments_ = message::create(std::max(size * 2, WS_READ_SIZE_MIN));
+                }
+                fragments_->get_buffer()->write_back(payload, 0, size);
+                message_size_ += size;
+                buf->seek(static_cast<int>(total), buffer::Current);
+                if (fh.fin)
+                {
+                    message_size_ = 0;
+                    message_ptr_t msg;
+                    msg.swap(fragments_);
+                    deliver(msg, socket_data_type::socket_recv);
                 }
             }
+            return ws::close_code::none;
+        }
 
-            if (fh.op != ws::opcode::close &&  fh.fin)
+        //data frame header of a streamed message is consumed, its payload follows
+        void start_stream(const ws::frame_header& fh)
+        {
+            in_message_ = !fh.fin;
+            streaming_ = true;
+            stream_fin_ = fh.fin;
+            payload_remain_ = fh.len;
+            message_size_ += static_cast<size_t>(fh.len);
+            stream_offset_ = 0;
+            memcpy(stream_key_, &fh.key, sizeof(stream_key_));
+
+            //fragments buffered before the message became big
+            if (nullptr != fragments_)
             {
-                message_ptr_t msg_package_ = message::create(static_cast<size_t>(fh.len));
-                msg_package_->get_buffer()->write_back((tmp + need), 0, static_cast<size_t>(fh.len));
-                cache_.seek(int(need + fh.len), buffer::Current);
-                msg_package_->set_sender(id_);
-                msg_package_->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
-                msg_package_->set_type(PTYPE_SOCKET);
-                on_data(msg_package_);
+                message_ptr_t msg;
+                msg.swap(fragments_);
+                deliver(msg, socket_data_type::socket_recv_more);
             }
 
-            if (fh.op == ws::opcode::close)
+            if (0 == payload_remain_ && stream_fin_)
             {
-                //may have error msg
-                cache_.seek(static_cast<int>(need), buffer::Current);
-                return ws::close_code::normal;
+                end_stream();
+                deliver(message::create(0), socket_data_type::socket_recv);
             }
+        }
 
+        //deliver received payload bytes of the streamed frame
+        void stream_payload()
+        {
+            auto buf = rmsg_->get_buffer();
+            size_t len = buf->size();
+            size_t n = static_cast<size_t>(std::min<uint64_t>(len, payload_remain_));
+
+            uint8_t key[4];
+            for (size_t i = 0; i < sizeof(key); ++i)
+            {
+                key[i] = stream_key_[(i + stream_offset_) & 3];
+            }
+            ws::unmask(reinterpret_cast<uint8_t*>(buf->data()), n, key);
+            stream_offset_ = (stream_offset_ + n) & 3;
+            payload_remain_ -= n;
+
+            auto t = socket_data_type::socket_recv_more;
+            if (0 == payload_remain_ && stream_fin_)
+            {
+                end_stream();
+                t = socket_data_type::socket_recv;
+            }
+
+            if (n == len)
+            {
+                message_ptr_t msg;
+                msg.swap(rmsg_);
+                deliver(msg, t);
+                return;
+            }
+
+            auto msg = message::create(n);
+            msg->get_buffer()->write_back(buf->data(), 0, n);
+            buf->seek(static_cast<int>(n), buffer::Current);
+            deliver(msg, t);
+        }
+
+        void end_stream()
+        {
+            streaming_ = false;
+            message_size_ = 0;
+        }
+
+        ws::close_code on_control(ws::opcode op, const uint8_t* payload, size_t size, std::string& reason)
+        {
+            switch (op)
+            {
+            case ws::opcode::ping:
+                send_control(ws::opcode::pong, payload, size);
+                break;
+            case ws::opcode::close:
+            {
+                if (size < 2)
+                {
+                    return (0 == size) ? ws::close_code::normal : ws::close_code::protocol_error;
+                }
+                uint16_t code = 0;
+                memcpy(&code, payload, sizeof(code));
+                moon::net2host(code);
+                //may have error msg
+                reason.assign(reinterpret_cast<const char*>(payload) + 2, size - 2);
+                if (code < 1000 || code == ws::close_code::no_status || code == ws::close_code::abnormal
+                    || code == ws::close_code::reserved1 || (code >= ws::close_code::reserved2 && code < 3000) || code >= 5000)
+                {
+                    return ws::close_code::protocol_error;
+                }
+                return static_cast<ws::close_code>(code);
+            }
+            default:
+                break;
+            }
             return ws::close_code::none;
         }
 
-        void encode_frame(const buffer_ptr_t& data)
+        void deliver(const message_ptr_t& msg, socket_data_type t)
+        {
+            msg->set_sender(id_);
+            msg->set_subtype(static_cast<uint8_t>(t));
+            msg->set_type(PTYPE_SOCKET);
+            on_data(msg);
+        }
+
+        static void encode_frame(const buffer_ptr_t& data, ws::opcode op)
         {
             uint64_t size = data->size();
-            uint8_t m = 0x81;
-            if (size <= 125)
+            uint8_t head[10];
+            size_t n = 2;
+            head[0] = static_cast<uint8_t>(0x80 | static_cast<uint8_t>(op));
+            if (size <= PAYLOAD_MIN_LEN)
             {
-                data->write_front((uint8_t*)&size, 0, 1);
+                head[1] = static_cast<uint8_t>(size);
             }
             else if (size <= UINT16_MAX)
             {
-                uint8_t tmp = 126;
-                uint16_t n = (uint16_t)size;
-                moon::host2net(n);
-                data->write_front((uint16_t*)&n, 0, 1);
-                data->write_front(&tmp, 0, 1);
+                head[1] = PAYLOAD_MID_LEN;
+                uint16_t len = static_cast<uint16_t>(size);
+                moon::host2net(len);
+                memcpy(head + n, &len, sizeof(len));
+                n += sizeof(len);
             }
             else
             {
-                uint8_t tmp = 127;
-                moon::host2net(size);
-                data->write_back(&size, 0, 1);
-                data->write_back(&tmp, 0, 1);
+                head[1] = PAYLOAD_MAX_LEN;
+                uint64_t len = size;
+                moon::host2net(len);
+                memcpy(head + n, &len, sizeof(len));
+                n += sizeof(len);
             }
 
-            data->write_front(&m, 0, 1);
+            if (!data->write_front(head, 0, n))
+            {
+                //not enough head room(BUFFER_HEAD_RESERVED), move payload to a new buffer
+                buffer tmp(data->size(), sizeof(head));
+                tmp.write_back(data->data(), 0, data->size());
+                tmp.write_front(head, 0, n);
+                data->swap(tmp);
+            }
         }
 
         std::string make_handshake_response(string_view_t seckey)
@@ -471,8 +806,26 @@ namespace moon
     protected:
         const std::string header_delim_;
         bool handshaked_ = false;
-        message_ptr_t  response_msg_;
-        std::array<uint8_t, 1024> buffer_;
-        buffer cache_;
+        size_t max_message_size_;
+        size_t stream_size_;
+        //bytes the next read asks for
+        size_t rsize_;
+        //bytes of the big frame in rmsg_ not read yet
+        size_t frame_remain_;
+        //payload bytes of the streamed frame not received yet, the key rotates by stream_offset_
+        uint64_t payload_remain_;
+        size_t stream_offset_;
+        uint8_t stream_key_[4];
+        bool stream_fin_;
+        //current message is delivered in parts
+        bool streaming_;
+        //a non-fin data frame was received, continuation frames follow
+        bool in_message_;
+        //payload bytes of current message received so far
+        size_t message_size_;
+        //buffered fragments of current message
+        message_ptr_t fragments_;
+        //received data, read position is the first undecoded byte
+        message_ptr_t rmsg_;
     };
 }
\ No newline at end of file
@@ -16,7 +16,8 @@ namespace moon
     {
         protocol_default,
         protocol_custom,
-        protocol_websocket
+        protocol_websocket,
+        protocol_http//http/1.1 server, one socket_recv message per request
     };
 
     enum class socket_data_type :std::uint8_t
@@ -26,7 +27,10 @@ namespace moon
         socket_recv = 3,
         socket_close =4,
         socket_error = 5,
-        socket_logic_error = 6
+        socket_logic_error = 6,
+        socket_send_high = 7,//queued send bytes reached high watermark, data is queued bytes
+        socket_send_low = 8,//queued send bytes dropped to low watermark after socket_send_high, data is queued bytes
+        socket_recv_more = 9//a part of a websocket message bigger than stream size, the last part is socket_recv
     };
 
     enum class network_logic_error :std::uint8_t
@@ -36,6 +40,16 @@ namespace moon
         send_message_size_max = 2, // send message size too long
         timeout = 3, //socket read time out
         client_close = 4, //closed
+        send_buffer_full = 5, //queued send bytes reached high watermark, with send_policy::close
+        dead_link = 6, //udp arq: a segment was sent UDP_ARQ_DEAD_LINK times without ack
+    };
+
+    //what send does when queued bytes of a connection reach the high watermark
+    enum class send_policy :std::uint8_t
+    {
+        block,//keep queueing, producer should wait for socket_send_low(or use wait_writable)
+        drop,//drop data until queued bytes drop to low watermark
+        close,//close the connection
     };
 
     enum class read_delim :std::uint8_t
@@ -46,6 +60,25 @@ namespace moon
         LF,// \n
     };
 
+    //how a listener's sockets are driven
+    enum class io_backend :std::uint8_t
+    {
+        epoll,//asio reactor
+        io_uring,//linux io_uring: multishot accept and recv, provided buffers, batched submissions. Falls back to epoll if not available
+    };
+
+    constexpr const string_view_t UNIX_ENDPOINT_PREFIX = "unix:"_sv;
+
+    //path of a unix domain socket address "unix:/path", empty if it is not one
+    inline string_view_t unix_endpoint_path(string_view_t address)
+    {
+        if (address.size() > UNIX_ENDPOINT_PREFIX.size() && address.substr(0, UNIX_ENDPOINT_PREFIX.size()) == UNIX_ENDPOINT_PREFIX)
+        {
+            return address.substr(UNIX_ENDPOINT_PREFIX.size());
+        }
+        return string_view_t();
+    }
+
     class MOON_EXPORT tcp:public component
     {
     public:
@@ -53,12 +86,46 @@ namespace moon
 
         virtual ~tcp();
 
+        //should be called before listen/connect
         void setprotocol(protocol_type t);
 
+        //read timeout, 0 means no timeout
         void settimeout(int seconds);
 
+        //granularity of read timeout in milliseconds(default NET_TIMEOUT_PRECISION), should be called before settimeout
+        void settimeoutprecision(int milliseconds);
+
         void setnodelay(uint32_t connid);
 
+        //per connection send watermarks in bytes, high = 0 means no limit. low = 0 means high/2.
+        //also changes connections of shards and io threads, in their own threads
+        void setsendlimit(size_t high, size_t low, send_policy policy);
+
+        //bytes queued for sending(including the batch being written), 0 if connection not found
+        size_t queued_bytes(uint32_t connid);
+
+        //response when queued bytes is not above low watermark
+        void wait_writable(uint32_t connid, int32_t responseid);
+
+        //should be called before listen. n > 1: open n SO_REUSEPORT acceptors on n workers(at most all workers), the kernel balances connections between them.
+        //connections' io runs on the acceptor's worker, their messages are sent to this service. Not for custom protocol.
+        void setshards(uint32_t n);
+
+        //should be called before listen. true: accept and do io in server's network io threads(if any), with setshards n acceptors in n io threads
+        void setiothread(bool v);
+
+        //should be called before listen/connect. websocket: max bytes of a message(all of its fragments),
+        //a bigger message closes the connection with close code 1009. http: max bytes of a request body, a bigger one is answered with 413
+        void setmaxmessage(size_t bytes);
+
+        //should be called before listen/connect. websocket: a message bigger than bytes is delivered in parts as it arrives
+        //(socket_recv_more, the last part is socket_recv) instead of being buffered, 0 means never
+        void setstreamsize(size_t bytes);
+
+        //should be called before listen. io_uring: default protocol only, not with setshards or setiothread, connections made by connect still use epoll
+        void setbackend(io_backend b);
+
+        //ip "unix:/path" listens on a unix domain socket(port is ignored). A stale socket file nobody listens on is replaced, the bound file is removed on destroy. Not sharded
         bool listen(const std::string& ip, const std::string& port);
 
         void async_accept(int32_t responseid);
@@ -69,10 +136,19 @@ namespace moon
 
         void read(uint32_t connid,size_t n, read_delim delim,int32_t responseid);
 
+        //data is framed in the caller's thread, also for a connection in an io thread or a shard, which then only reads it
         bool send(uint32_t connid, const buffer_ptr_t& data);
 
         bool send_message(uint32_t connid, message* msg);
 
+        //http protocol: write status line, Content-Length, Connection, headers(header lines each ends with \r\n) and body in one buffer.
+        //keepalive false: the connection is closed after the response is sent
+        bool send_http(uint32_t connid, int status, string_view_t headers, string_view_t body, bool keepalive);
+
+        //frame data once and queue the same buffer to every connection, no per connection copy. data must not be modified afterwards.
+        //return the number of connections it was queued to(sharded connections are counted when found)
+        size_t multicast(const std::vector<uint32_t>& connids, const buffer_ptr_t& data);
+
         bool close(uint32_t connid);
 
     private:
@@ -81,8 +157,6 @@ namespace moon
         void destroy() override;
 
         void remove(uint32_t connid);
-
-        void check();
     private:
         struct imp;
         imp* imp_;
@@ -0,0 +1,496 @@
+#pragma once
+#include "config.h"
+#include "message.hpp"
+
+namespace moon
+{
+    constexpr size_t ARQ_HEADER_SIZE = 18;
+    constexpr uint32_t ARQ_MAX_FRAGMENT = 256;
+    constexpr uint32_t ARQ_INIT_RTO = 200;
+    constexpr uint32_t ARQ_MAX_RTO = 60000;
+
+    enum class arq_cmd :std::uint8_t
+    {
+        push = 1,
+        ack = 2,
+        close = 3,
+    };
+
+    /*
+    Reliable ordered messages over datagrams, like KCP: selective repeat with per segment ack and cumulative una,
+    rto from smoothed rtt, a segment is resent early when fastresend later segments are acked. There is no congestion
+    window and received messages are handed to the service at once, so the advertised window is always rcvwnd.
+    A message bigger than a segment is sent in fragments, frg counts the fragments after it.
+    Segment: cmd(1) frg(1) wnd(2) ts(4) sn(4) una(4) len(2) data, little endian. A datagram holds one or more segments.
+    */
+    class arq
+    {
+        struct snd_segment
+        {
+            buffer_ptr_t data;
+            uint32_t offset = 0;
+            uint32_t len = 0;
+            uint32_t sn = 0;
+            uint32_t ts = 0;
+            uint32_t resendts = 0;
+            uint32_t rto = 0;
+            uint32_t fastack = 0;
+            uint32_t xmit = 0;
+            uint8_t frg = 0;
+            bool acked = false;
+        };
+
+        struct rcv_segment
+        {
+            buffer_ptr_t data;
+            uint8_t frg = 0;
+            bool valid = false;
+        };
+
+        static int32_t diff(uint32_t a, uint32_t b)
+        {
+            return static_cast<int32_t>(a - b);
+        }
+
+        static void encode16(char* p, uint16_t v)
+        {
+            p[0] = static_cast<char>(v & 0xFF);
+            p[1] = static_cast<char>(v >> 8);
+        }
+
+        static void encode32(char* p, uint32_t v)
+        {
+            p[0] = static_cast<char>(v & 0xFF);
+            p[1] = static_cast<char>((v >> 8) & 0xFF);
+            p[2] = static_cast<char>((v >> 16) & 0xFF);
+            p[3] = static_cast<char>(v >> 24);
+        }
+
+        static uint16_t decode16(const char* p)
+        {
+            auto u = reinterpret_cast<const uint8_t*>(p);
+            return static_cast<uint16_t>(u[0] | (u[1] << 8));
+        }
+
+        static uint32_t decode32(const char* p)
+        {
+            auto u = reinterpret_cast<const uint8_t*>(p);
+            return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8) | (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+        }
+
+    public:
+        arq(size_t mtu, uint32_t sndwnd, uint32_t rcvwnd)
+            :mtu_(std::max<size_t>(mtu, ARQ_HEADER_SIZE + 1))
+            , snd_wnd_(std::max(sndwnd, 1u))
+            , rcv_wnd_(std::min(std::max(rcvwnd, 1u), 0xFFFFu))
+            , rmt_wnd_(UDP_ARQ_WINDOW)
+            , snd_una_(0)
+            , snd_nxt_(0)
+            , rcv_nxt_(0)
+            , srtt_(0)
+            , rttval_(0)
+            , rto_(ARQ_INIT_RTO)
+            , interval_(UDP_ARQ_INTERVAL)
+            , fastresend_(UDP_ARQ_FASTRESEND)
+            , minrto_(UDP_ARQ_MINRTO)
+            , dead_(false)
+            , closed_(false)
+            , snd_buf_(snd_wnd_)
+            , rcv_buf_(rcv_wnd_)
+        {
+            dgram_.resize(mtu_);
+        }
+
+        void set_nodelay(uint32_t interval, uint32_t fastresend, uint32_t minrto)
+        {
+            interval_ = std::max(interval, 1u);
+            fastresend_ = fastresend;
+            minrto_ = std::max(minrto, 1u);
+        }
+
+        size_t mss() const
+        {
+            return mtu_ - ARQ_HEADER_SIZE;
+        }
+
+        //queue a message, false if it needs more than ARQ_MAX_FRAGMENT segments
+        bool send(const buffer_ptr_t& data)
+        {
+            size_t size = data->size();
+            size_t count = (size + mss() - 1) / mss();
+            if (0 == count || count > ARQ_MAX_FRAGMENT)
+            {
+                return false;
+            }
+            size_t offset = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                snd_segment seg;
+                seg.data = data;
+                seg.offset = static_cast<uint32_t>(offset);
+                seg.len = static_cast<uint32_t>(std::min(mss(), size - offset));
+                seg.frg = static_cast<uint8_t>(count - i - 1);
+                offset += seg.len;
+                snd_queue_.push_back(std::move(seg));
+            }
+            return true;
+        }
+
+        //a datagram which may open a session: all segments well formed, the first one pushes data within the receive window of a new session
+        static bool valid_open(const char* p, size_t len, uint32_t rcvwnd)
+        {
+            if (len < ARQ_HEADER_SIZE
+                || static_cast<arq_cmd>(p[0]) != arq_cmd::push
+                || decode32(p + 8) >= std::min(std::max(rcvwnd, 1u), 0xFFFFu))
+            {
+                return false;
+            }
+
+            while (len >= ARQ_HEADER_SIZE)
+            {
+                auto cmd = static_cast<arq_cmd>(p[0]);
+                if (cmd != arq_cmd::push && cmd != arq_cmd::ack && cmd != arq_cmd::close)
+                {
+                    return false;
+                }
+                size_t n = ARQ_HEADER_SIZE + decode16(p + 16);
+                if (n > len)
+                {
+                    return false;
+                }
+                p += n;
+                len -= n;
+            }
+            return 0 == len;
+        }
+
+        //one received datagram, deliver(const message_ptr_t&) is called for each completed message in order. false if malformed
+        template<typename Deliver>
+        bool input(const char* p, size_t len, uint32_t current, Deliver&& deliver)
+        {
+            if (len < ARQ_HEADER_SIZE)
+            {
+                return false;
+            }
+
+            bool has_ack = false;
+            uint32_t maxack = 0;
+            uint32_t maxack_ts = 0;
+            while (len >= ARQ_HEADER_SIZE)
+            {
+                auto cmd = static_cast<arq_cmd>(p[0]);
+                uint8_t frg = static_cast<uint8_t>(p[1]);
+                uint16_t wnd = decode16(p + 2);
+                uint32_t ts = decode32(p + 4);
+                uint32_t sn = decode32(p + 8);
+                uint32_t una = decode32(p + 12);
+                uint16_t seglen = decode16(p + 16);
+                p += ARQ_HEADER_SIZE;
+                len -= ARQ_HEADER_SIZE;
+                if (seglen > len)
+                {
+                    return false;
+                }
+
+                rmt_wnd_ = wnd;
+                parse_una(una);
+
+                switch (cmd)
+                {
+                case arq_cmd::ack:
+                {
+                    if (diff(current, ts) >= 0)
+                    {
+                        update_rtt(current - ts);
+                    }
+                    parse_ack(sn);
+                    if (!has_ack || diff(sn, maxack) > 0)
+                    {
+                        maxack = sn;
+                        maxack_ts = ts;
+                        has_ack = true;
+                    }
+                    break;
+                }
+                case arq_cmd::push:
+                {
+                    if (diff(sn, rcv_nxt_ + rcv_wnd_) < 0)
+                    {
+                        acklist_.emplace_back(sn, ts);
+                        if (sn == rcv_nxt_ && !rcv_buf_[sn % rcv_wnd_].valid)
+                        {
+                            //in order, not copied to rcv_buf_
+                            ++rcv_nxt_;
+                            append(frg, p, seglen, deliver);
+                        }
+                        else if (diff(sn, rcv_nxt_) > 0)
+                        {
+                            store(sn, frg, p, seglen);
+                        }
+                    }
+                    break;
+                }
+                case arq_cmd::close:
+                    closed_ = true;
+                    break;
+                default:
+                    return false;
+                }
+                p += seglen;
+                len -= seglen;
+            }
+
+            if (has_ack)
+            {
+                for (uint32_t sn = snd_una_; diff(sn, snd_nxt_) < 0 && diff(sn, maxack) < 0; ++sn)
+                {
+                    //only acks of segments sent after its last transmission, or a resent segment is resent again at once
+                    auto& seg = snd_buf_[sn % snd_wnd_];
+                    if (!seg.acked && diff(maxack_ts, seg.ts) >= 0)
+                    {
+                        ++seg.fastack;
+                    }
+                }
+            }
+
+            //segments received earlier which are in order now
+            while (rcv_buf_[rcv_nxt_ % rcv_wnd_].valid)
+            {
+                auto& seg = rcv_buf_[rcv_nxt_ % rcv_wnd_];
+                seg.valid = false;
+                ++rcv_nxt_;
+                auto data = std::move(seg.data);
+                append(seg.frg, data->data(), data->size(), deliver);
+            }
+            return true;
+        }
+
+        //write acks, new segments within the window and segments to resend. output(const char*, size_t) is called for each datagram
+        template<typename Output>
+        void flush(uint32_t current, Output&& output)
+        {
+            size_t pos = 0;
+            auto write = [this, &pos, &output](arq_cmd cmd, uint8_t frg, uint32_t ts, uint32_t sn, const char* data, size_t len) {
+                if (pos + ARQ_HEADER_SIZE + len > mtu_)
+                {
+                    output(dgram_.data(), pos);
+                    pos = 0;
+                }
+                char* p = &dgram_[pos];
+                p[0] = static_cast<char>(cmd);
+                p[1] = static_cast<char>(frg);
+                encode16(p + 2, static_cast<uint16_t>(rcv_wnd_));
+                encode32(p + 4, ts);
+                encode32(p + 8, sn);
+                encode32(p + 12, rcv_nxt_);
+                encode16(p + 16, static_cast<uint16_t>(len));
+                if (0 != len)
+                {
+                    memcpy(p + ARQ_HEADER_SIZE, data, len);
+                }
+                pos += ARQ_HEADER_SIZE + len;
+            };
+
+            for (auto& ack : acklist_)
+            {
+                write(arq_cmd::ack, 0, ack.second, ack.first, nullptr, 0);
+            }
+            acklist_.clear();
+
+            uint32_t wnd = std::max(std::min(snd_wnd_, rmt_wnd_), 1u);
+            while (!snd_queue_.empty() && diff(snd_nxt_, snd_una_ + wnd) < 0)
+            {
+                auto& seg = snd_buf_[snd_nxt_ % snd_wnd_];
+                seg = std::move(snd_queue_.front());
+                snd_queue_.pop_front();
+                seg.sn = snd_nxt_++;
+            }
+
+            for (uint32_t sn = snd_una_; diff(sn, snd_nxt_) < 0; ++sn)
+            {
+                auto& seg = snd_buf_[sn % snd_wnd_];
+                if (seg.acked)
+                {
+                    continue;
+                }
+
+                bool resend = false;
+                if (0 == seg.xmit)
+                {
+                    resend = true;
+                    seg.rto = rto_;
+                    seg.resendts = current + seg.rto;
+                }
+                else if (diff(current, seg.resendts) >= 0)
+                {
+                    resend = true;
+                    //linear backoff, a dead link is found in seconds
+                    seg.rto = std::min(seg.rto + rto_ / 2, ARQ_MAX_RTO);
+                    seg.resendts = current + seg.rto;
+                }
+                else if (0 != fastresend_ && seg.fastack >= fastresend_)
+                {
+                    resend = true;
+                    seg.fastack = 0;
+                    seg.resendts = current + seg.rto;
+                }
+
+                if (resend)
+                {
+                    ++seg.xmit;
+                    seg.ts = current;
+                    write(arq_cmd::push, seg.frg, current, seg.sn, seg.data->data() + seg.offset, seg.len);
+                    if (seg.xmit >= UDP_ARQ_DEAD_LINK)
+                    {
+                        dead_ = true;
+                    }
+                }
+            }
+
+            if (0 != pos)
+            {
+                output(dgram_.data(), pos);
+            }
+        }
+
+        //a datagram which tells the peer this session is closed
+        template<typename Output>
+        void write_close(Output&& output)
+        {
+            char p[ARQ_HEADER_SIZE] = { 0 };
+            p[0] = static_cast<char>(arq_cmd::close);
+            encode16(p + 2, static_cast<uint16_t>(rcv_wnd_));
+            encode32(p + 8, snd_nxt_);
+            encode32(p + 12, rcv_nxt_);
+            output(p, sizeof(p));
+        }
+
+        //segments queued or in flight
+        size_t waiting() const
+        {
+            return snd_queue_.size() + static_cast<size_t>(snd_nxt_ - snd_una_);
+        }
+
+        //nothing to send, resend or ack
+        bool idle() const
+        {
+            return acklist_.empty() && snd_queue_.empty() && snd_una_ == snd_nxt_;
+        }
+
+        //a segment was sent UDP_ARQ_DEAD_LINK times without ack
+        bool dead() const
+        {
+            return dead_;
+        }
+
+        //the peer closed the session
+        bool closed() const
+        {
+            return closed_;
+        }
+
+    private:
+        void update_rtt(uint32_t rtt)
+        {
+            if (0 == srtt_)
+            {
+                srtt_ = rtt;
+                rttval_ = rtt / 2;
+            }
+            else
+            {
+                uint32_t delta = (rtt > srtt_) ? rtt - srtt_ : srtt_ - rtt;
+                rttval_ = (3 * rttval_ + delta) / 4;
+                srtt_ = std::max((7 * srtt_ + rtt) / 8, 1u);
+            }
+            uint32_t rto = srtt_ + std::max(interval_, 4 * rttval_);
+            rto_ = std::min(std::max(rto, minrto_), ARQ_MAX_RTO);
+        }
+
+        void release(snd_segment& seg)
+        {
+            seg.acked = false;
+            seg.xmit = 0;
+            seg.fastack = 0;
+            seg.data = nullptr;
+        }
+
+        void parse_una(uint32_t una)
+        {
+            while (diff(snd_una_, una) < 0 && diff(snd_una_, snd_nxt_) < 0)
+            {
+                release(snd_buf_[snd_una_ % snd_wnd_]);
+                ++snd_una_;
+            }
+        }
+
+        void parse_ack(uint32_t sn)
+        {
+            if (diff(sn, snd_una_) < 0 || diff(sn, snd_nxt_) >= 0)
+            {
+                return;
+            }
+            snd_buf_[sn % snd_wnd_].acked = true;
+            while (diff(snd_una_, snd_nxt_) < 0 && snd_buf_[snd_una_ % snd_wnd_].acked)
+            {
+                release(snd_buf_[snd_una_ % snd_wnd_]);
+                ++snd_una_;
+            }
+        }
+
+        void store(uint32_t sn, uint8_t frg, const char* data, size_t len)
+        {
+            auto& seg = rcv_buf_[sn % rcv_wnd_];
+            if (seg.valid)
+            {
+                return;
+            }
+            seg.valid = true;
+            seg.frg = frg;
+            seg.data = message::create_buffer(len);
+            seg.data->write_back(data, 0, len);
+        }
+
+        template<typename Deliver>
+        void append(uint8_t frg, const char* data, size_t len, Deliver& deliver)
+        {
+            if (nullptr == assembling_)
+            {
+                assembling_ = message::create((static_cast<size_t>(frg) + 1) * mss());
+            }
+            assembling_->get_buffer()->write_back(data, 0, len);
+            if (0 == frg)
+            {
+                message_ptr_t msg;
+                msg.swap(assembling_);
+                deliver(msg);
+            }
+        }
+
+    private:
+        size_t mtu_;
+        uint32_t snd_wnd_;
+        uint32_t rcv_wnd_;
+        uint32_t rmt_wnd_;
+        uint32_t snd_una_;
+        uint32_t snd_nxt_;
+        uint32_t rcv_nxt_;
+        uint32_t srtt_;
+        uint32_t rttval_;
+        uint32_t rto_;
+        uint32_t interval_;
+        uint32_t fastresend_;
+        uint32_t minrto_;
+        bool dead_;
+        bool closed_;
+        //in flight segments, [snd_una_, snd_nxt_) indexed by sn % snd_wnd_
+        std::vector<snd_segment> snd_buf_;
+        //out of order segments, [rcv_nxt_, rcv_nxt_ + rcv_wnd_) indexed by sn % rcv_wnd_
+        std::vector<rcv_segment> rcv_buf_;
+        std::deque<snd_segment> snd_queue_;
+        //sn and ts of received segments to ack
+        std::vector<std::pair<uint32_t, uint32_t>> acklist_;
+        std::vector<char> dgram_;
+        message_ptr_t assembling_;
+    };
+}
@@ -0,0 +1,704 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+#include "components/udp/udp.h"
+#include "log.h"
+#include "message.hpp"
+#include "service.h"
+#include "core/worker.h"
+#include "common/string.hpp"
+#include "common/time.hpp"
+#include "asio.hpp"
+#include "components/tcp/impl/conn_table.hpp"
+#include "arq.hpp"
+
+#if TARGET_PLATFORM == PLATFORM_LINUX
+#include <sys/socket.h>
+#endif
+
+namespace moon
+{
+    struct udp_session
+    {
+        uint32_t id = 0;
+        bool closed = false;
+        //arq has something to send or ack
+        bool dirty = false;
+        int64_t last_recv_time = 0;
+        asio::ip::udp::endpoint endpoint;
+        std::string addr;
+        std::unique_ptr<arq> arq_;
+    };
+
+    using udp_session_ptr_t = std::shared_ptr<udp_session>;
+
+    struct udp_endpoint_hash
+    {
+        size_t operator()(const asio::ip::udp::endpoint& ep) const
+        {
+            size_t h = ep.port();
+            auto addr = ep.address();
+            if (addr.is_v4())
+            {
+                return h ^ (static_cast<size_t>(addr.to_v4().to_ulong()) << 16);
+            }
+            for (auto c : addr.to_v6().to_bytes())
+            {
+                h = h * 31 + c;
+            }
+            return h;
+        }
+    };
+
+    //datagram waiting to be written, data is in send_buffer_
+    struct udp_datagram
+    {
+        asio::ip::udp::endpoint endpoint;
+        size_t offset;
+        size_t len;
+    };
+
+    struct udp::imp
+    {
+        imp() noexcept
+            : ios_(nullptr)
+            , mode_(udp_mode::udp_raw)
+            , listening_(false)
+            , flush_posted_(false)
+            , wait_writable_(false)
+            , ticking_(false)
+            , mtu_(UDP_ARQ_MTU)
+            , sndwnd_(UDP_ARQ_WINDOW)
+            , rcvwnd_(UDP_ARQ_WINDOW)
+            , interval_(UDP_ARQ_INTERVAL)
+            , fastresend_(UDP_ARQ_FASTRESEND)
+            , minrto_(UDP_ARQ_MINRTO)
+            , timeout_(0)
+            , send_head_(0)
+            , log_(nullptr)
+        {
+        }
+
+        std::shared_ptr<udp> get_self()
+        {
+            return self_.lock();
+        }
+
+        static uint32_t arq_clock()
+        {
+            return static_cast<uint32_t>(time::microsecond() / 1000);
+        }
+
+        void open(const asio::ip::udp::endpoint& local)
+        {
+            socket_.reset(new asio::ip::udp::socket(*ios_));
+            socket_->open(local.protocol());
+            socket_->bind(local);
+            socket_->non_blocking(true);
+            asio::error_code ec;
+            socket_->set_option(asio::socket_base::receive_buffer_size(UDP_SOCKET_BUFFER), ec);
+            socket_->set_option(asio::socket_base::send_buffer_size(UDP_SOCKET_BUFFER), ec);
+            rbuf_.resize(UDP_BATCH * UDP_MAX_DATAGRAM);
+            read();
+        }
+
+        void read()
+        {
+            //wait readable, then read datagrams in batches
+            socket_->async_receive(asio::null_buffers(), [this, self = get_self()](const asio::error_code& e, std::size_t) {
+                if (nullptr == self || !self->ok() || nullptr == socket_ || !socket_->is_open())
+                {
+                    return;
+                }
+                if (e && e != asio::error::connection_refused)
+                {
+                    CONSOLE_WARN(log_, "udp read error %s(%d)", e.message().data(), e.value());
+                }
+                receive();
+                flush();
+                read();
+            });
+        }
+
+        void receive()
+        {
+#if TARGET_PLATFORM == PLATFORM_LINUX
+            struct mmsghdr msgs[UDP_BATCH];
+            struct iovec iovecs[UDP_BATCH];
+            struct sockaddr_storage addrs[UDP_BATCH];
+            for (size_t i = 0; i < UDP_BATCH; ++i)
+            {
+                iovecs[i].iov_base = &rbuf_[i * UDP_MAX_DATAGRAM];
+                iovecs[i].iov_len = UDP_MAX_DATAGRAM;
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+            }
+
+            //at most a few batches, other handlers of the worker should not starve
+            for (int round = 0; round < 4 && nullptr != socket_; ++round)
+            {
+                for (size_t i = 0; i < UDP_BATCH; ++i)
+                {
+                    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+                    msgs[i].msg_hdr.msg_flags = 0;
+                }
+                int n = ::recvmmsg(socket_->native_handle(), msgs, UDP_BATCH, MSG_DONTWAIT, nullptr);
+                if (n <= 0)
+                {
+                    break;
+                }
+                for (int i = 0; i < n && nullptr != socket_; ++i)
+                {
+                    //bigger than UDP_MAX_DATAGRAM
+                    if (0 != (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+                    {
+                        continue;
+                    }
+                    asio::ip::udp::endpoint ep;
+                    memcpy(ep.data(), &addrs[i], msgs[i].msg_hdr.msg_namelen);
+                    ep.resize(msgs[i].msg_hdr.msg_namelen);
+                    on_datagram(ep, &rbuf_[i * UDP_MAX_DATAGRAM], msgs[i].msg_len);
+                }
+                if (static_cast<size_t>(n) < UDP_BATCH)
+                {
+                    break;
+                }
+            }
+#else
+            for (size_t i = 0; i < 4 * UDP_BATCH && nullptr != socket_; ++i)
+            {
+                asio::error_code ec;
+                asio::ip::udp::endpoint ep;
+                size_t n = socket_->receive_from(asio::buffer(rbuf_.data(), UDP_MAX_DATAGRAM), ep, 0, ec);
+                if (ec == asio::error::would_block)
+                {
+                    break;
+                }
+                if (!ec)
+                {
+                    on_datagram(ep, rbuf_.data(), n);
+                }
+            }
+#endif
+        }
+
+        void on_datagram(const asio::ip::udp::endpoint& ep, const char* data, size_t len)
+        {
+            udp_session_ptr_t s;
+            auto iter = endpoints_.find(ep);
+            if (iter != endpoints_.end())
+            {
+                s = sessions_.find(iter->second);
+            }
+
+            if (nullptr == s)
+            {
+                if (!listening_ || 0 == len)
+                {
+                    return;
+                }
+                //no session for stray or spoofed datagrams
+                if (mode_ == udp_mode::udp_arq && !arq::valid_open(data, len, rcvwnd_))
+                {
+                    return;
+                }
+                s = add_session(ep);
+                if (nullptr == s)
+                {
+                    return;
+                }
+                notify(s->id, s->addr, socket_data_type::socket_accept);
+                if (s->closed)
+                {
+                    return;
+                }
+            }
+
+            s->last_recv_time = time::coarse_millsecond();
+
+            if (nullptr == s->arq_)
+            {
+                auto msg = message::create(len);
+                msg->get_buffer()->write_back(data, 0, len);
+                msg->set_sender(s->id);
+                msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+                msg->set_type(PTYPE_SOCKET);
+                on_data_(msg);
+                return;
+            }
+
+            auto id = s->id;
+            bool ok = s->arq_->input(data, len, arq_clock(), [this, id](const message_ptr_t& msg) {
+                msg->set_sender(id);
+                msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+                msg->set_type(PTYPE_SOCKET);
+                on_data_(msg);
+            });
+
+            if (s->closed)
+            {
+                return;
+            }
+
+            if (!ok)
+            {
+                CONSOLE_DEBUG(log_, "udp session %u bad datagram from %s", s->id, s->addr.data());
+            }
+
+            if (s->arq_->closed())
+            {
+                remove(s, network_logic_error::ok, false);
+                return;
+            }
+            mark_dirty(s);
+        }
+
+        udp_session_ptr_t add_session(const asio::ip::udp::endpoint& ep)
+        {
+            auto s = std::make_shared<udp_session>();
+            s->id = sessions_.add(s);
+            if (0 == s->id)
+            {
+                return nullptr;
+            }
+            s->endpoint = ep;
+            asio::error_code ec;
+            s->addr = ep.address().to_string(ec) + ":" + std::to_string(ep.port());
+            s->last_recv_time = time::coarse_millsecond();
+            if (mode_ == udp_mode::udp_arq)
+            {
+                s->arq_.reset(new arq(mtu_, sndwnd_, rcvwnd_));
+                s->arq_->set_nodelay(interval_, fastresend_, minrto_);
+            }
+            endpoints_[ep] = s->id;
+            start_tick();
+            return s;
+        }
+
+        //err ok: closed by the peer or the service, without socket_logic_error
+        void remove(const udp_session_ptr_t& s, network_logic_error err, bool tell_peer)
+        {
+            if (s->closed)
+            {
+                return;
+            }
+            s->closed = true;
+            if (tell_peer && nullptr != s->arq_)
+            {
+                s->arq_->write_close([this, &s](const char* data, size_t len) {
+                    queue_datagram(s->endpoint, data, len);
+                });
+                post_flush();
+            }
+            endpoints_.erase(s->endpoint);
+            sessions_.remove(s->id);
+
+            if (err != network_logic_error::ok)
+            {
+                const char* errmsg = (err == network_logic_error::timeout) ? "timeout" : "dead link";
+                auto content = moon::format("{\"addr\":\"%s\",\"errcode\":%d,\"errmsg\":\"%s\"}", s->addr.data(), int(err), errmsg);
+                notify(s->id, content, socket_data_type::socket_logic_error);
+            }
+            notify(s->id, s->addr, socket_data_type::socket_close);
+        }
+
+        void notify(uint32_t id, const std::string& data, socket_data_type t)
+        {
+            auto msg = message::create();
+            msg->write_string(data);
+            msg->set_sender(id);
+            msg->set_subtype(static_cast<uint8_t>(t));
+            msg->set_type(PTYPE_SOCKET);
+            on_data_(msg);
+        }
+
+        void mark_dirty(const udp_session_ptr_t& s)
+        {
+            if (!s->dirty)
+            {
+                s->dirty = true;
+                dirty_.push_back(s);
+            }
+        }
+
+        void post_flush()
+        {
+            if (flush_posted_)
+            {
+                return;
+            }
+            flush_posted_ = true;
+            //sends of the current handler are written together
+            ios_->post([this, self = get_self()]() {
+                if (nullptr == self || !self->ok())
+                {
+                    return;
+                }
+                flush_posted_ = false;
+                flush();
+            });
+        }
+
+        //write acks and new segments of sessions touched since the last flush, then the queued datagrams
+        void flush()
+        {
+            if (!dirty_.empty())
+            {
+                auto now = arq_clock();
+                std::vector<udp_session_ptr_t> dirty;
+                dirty.swap(dirty_);
+                for (auto& s : dirty)
+                {
+                    s->dirty = false;
+                    flush_session(s, now);
+                }
+            }
+            send_datagrams();
+        }
+
+        void flush_session(const udp_session_ptr_t& s, uint32_t now)
+        {
+            if (s->closed)
+            {
+                return;
+            }
+            s->arq_->flush(now, [this, &s](const char* data, size_t len) {
+                queue_datagram(s->endpoint, data, len);
+            });
+            if (s->arq_->dead())
+            {
+                remove(s, network_logic_error::dead_link, true);
+            }
+        }
+
+        bool queue_datagram(const asio::ip::udp::endpoint& ep, const char* data, size_t len)
+        {
+            if (nullptr == socket_ || send_buffer_.size() + len > UDP_SEND_QUEUE_MAX)
+            {
+                return false;
+            }
+            size_t offset = send_buffer_.size();
+            send_buffer_.insert(send_buffer_.end(), data, data + len);
+            send_queue_.push_back(udp_datagram{ ep, offset, len });
+            return true;
+        }
+
+        void send_datagrams()
+        {
+            if (nullptr == socket_ || wait_writable_)
+            {
+                return;
+            }
+
+            while (send_head_ < send_queue_.size())
+            {
+#if TARGET_PLATFORM == PLATFORM_LINUX
+                struct mmsghdr msgs[UDP_BATCH];
+                struct iovec iovecs[UDP_BATCH];
+                size_t count = std::min(UDP_BATCH, send_queue_.size() - send_head_);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    auto& d = send_queue_[send_head_ + i];
+                    iovecs[i].iov_base = &send_buffer_[d.offset];
+                    iovecs[i].iov_len = d.len;
+                    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                    msgs[i].msg_hdr.msg_name = d.endpoint.data();
+                    msgs[i].msg_hdr.msg_namelen = static_cast<socklen_t>(d.endpoint.size());
+                }
+                int n = ::sendmmsg(socket_->native_handle(), msgs, static_cast<unsigned int>(count), MSG_DONTWAIT);
+                if (n > 0)
+                {
+                    send_head_ += static_cast<size_t>(n);
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    wait_writable();
+                    return;
+                }
+                //datagram can not be sent(e.g. unreachable address), drop it
+                ++send_head_;
+#else
+                auto& d = send_queue_[send_head_];
+                asio::error_code ec;
+                socket_->send_to(asio::buffer(&send_buffer_[d.offset], d.len), d.endpoint, 0, ec);
+                if (ec == asio::error::would_block)
+                {
+                    wait_writable();
+                    return;
+                }
+                ++send_head_;
+#endif
+            }
+            send_queue_.clear();
+            send_buffer_.clear();
+            send_head_ = 0;
+        }
+
+        void wait_writable()
+        {
+            wait_writable_ = true;
+            socket_->async_send(asio::null_buffers(), [this, self = get_self()](const asio::error_code&, std::size_t) {
+                if (nullptr == self || !self->ok())
+                {
+                    return;
+                }
+                wait_writable_ = false;
+                send_datagrams();
+            });
+        }
+
+        //arq retransmission and session timeout, runs while there are sessions
+        void start_tick()
+        {
+            if (ticking_ || (mode_ != udp_mode::udp_arq && 0 == timeout_))
+            {
+                return;
+            }
+            ticking_ = true;
+            timer_->expires_from_now(std::chrono::milliseconds(interval_));
+            timer_->async_wait([this, self = get_self()](const asio::error_code& e) {
+                if (e || nullptr == self || !self->ok())
+                {
+                    return;
+                }
+                ticking_ = false;
+                tick();
+            });
+        }
+
+        void tick()
+        {
+            auto now = arq_clock();
+            auto coarse = time::coarse_millsecond();
+            sessions_.for_each([this, now, coarse](const udp_session_ptr_t& s) {
+                if (s->closed)
+                {
+                    return;
+                }
+                if (0 != timeout_ && coarse - s->last_recv_time > timeout_)
+                {
+                    remove(s, network_logic_error::timeout, true);
+                    return;
+                }
+                if (nullptr != s->arq_ && !s->arq_->idle())
+                {
+                    flush_session(s, now);
+                }
+            });
+            send_datagrams();
+            if (0 != sessions_.size())
+            {
+                start_tick();
+            }
+        }
+
+        asio::io_service* ios_;
+        udp_mode mode_;
+        bool listening_;
+        bool flush_posted_;
+        bool wait_writable_;
+        bool ticking_;
+        size_t mtu_;
+        uint32_t sndwnd_;
+        uint32_t rcvwnd_;
+        uint32_t interval_;
+        uint32_t fastresend_;
+        uint32_t minrto_;
+        //milliseconds
+        int64_t timeout_;
+        size_t send_head_;
+        moon::log* log_;
+        std::unique_ptr<asio::ip::udp::socket> socket_;
+        std::unique_ptr<asio::steady_timer> timer_;
+        basic_conn_table<udp_session_ptr_t> sessions_;
+        std::unordered_map<asio::ip::udp::endpoint, uint32_t, udp_endpoint_hash> endpoints_;
+        std::vector<udp_session_ptr_t> dirty_;
+        std::vector<char> rbuf_;
+        std::vector<char> send_buffer_;
+        std::vector<udp_datagram> send_queue_;
+        std::weak_ptr<udp> self_;
+        std::function<void(const message_ptr_t&)> on_data_;
+    };
+
+    udp::udp() noexcept
+        :imp_(new imp)
+    {
+    }
+
+    udp::~udp()
+    {
+        SAFE_DELETE(imp_);
+    }
+
+    void udp::setmode(udp_mode m)
+    {
+        imp_->mode_ = m;
+    }
+
+    void udp::settimeout(int seconds)
+    {
+        imp_->timeout_ = (seconds > 0) ? int64_t(seconds) * 1000 : 0;
+        if (0 != imp_->sessions_.size())
+        {
+            imp_->start_tick();
+        }
+    }
+
+    void udp::setmtu(size_t bytes)
+    {
+        imp_->mtu_ = std::min(std::max(bytes, ARQ_HEADER_SIZE + 1), UDP_MAX_DATAGRAM);
+    }
+
+    void udp::setwindow(uint32_t sndwnd, uint32_t rcvwnd)
+    {
+        imp_->sndwnd_ = std::max(sndwnd, 1u);
+        imp_->rcvwnd_ = std::max(rcvwnd, 1u);
+    }
+
+    void udp::setarq(uint32_t interval, uint32_t fastresend, uint32_t minrto)
+    {
+        imp_->interval_ = std::max(interval, 1u);
+        imp_->fastresend_ = fastresend;
+        imp_->minrto_ = std::max(minrto, 1u);
+    }
+
+    bool udp::listen(const std::string & ip, const std::string & port)
+    {
+        try
+        {
+            if (nullptr != imp_->socket_)
+            {
+                CONSOLE_WARN(logger(), "udp listen error: socket is opened");
+                return false;
+            }
+            asio::ip::udp::resolver resolver(*imp_->ios_);
+            asio::ip::udp::resolver::query query(ip, port);
+            asio::ip::udp::endpoint endpoint = *resolver.resolve(query);
+            imp_->open(endpoint);
+            imp_->listening_ = true;
+            return true;
+        }
+        catch (asio::system_error& e)
+        {
+            imp_->socket_ = nullptr;
+            CONSOLE_WARN(logger(), "udp bind error %s(%d )", e.what(), e.code().value());
+            return false;
+        }
+    }
+
+    uint32_t udp::connect(const std::string & ip, const std::string & port)
+    {
+        try
+        {
+            asio::ip::udp::resolver resolver(*imp_->ios_);
+            asio::ip::udp::resolver::query query(ip, port);
+            asio::ip::udp::endpoint endpoint = *resolver.resolve(query);
+            if (nullptr == imp_->socket_)
+            {
+                imp_->open(asio::ip::udp::endpoint(endpoint.protocol(), 0));
+            }
+
+            auto iter = imp_->endpoints_.find(endpoint);
+            if (iter != imp_->endpoints_.end())
+            {
+                return iter->second;
+            }
+            auto s = imp_->add_session(endpoint);
+            return (nullptr != s) ? s->id : 0;
+        }
+        catch (asio::system_error& e)
+        {
+            CONSOLE_WARN(logger(), "udp::connect error %s", e.what());
+            return 0;
+        }
+    }
+
+    bool udp::send(uint32_t connid, const buffer_ptr_t & data)
+    {
+        if (nullptr == data || 0 == data->size())
+        {
+            return false;
+        }
+
+        auto& s = imp_->sessions_.find(connid);
+        if (nullptr == s)
+        {
+            return false;
+        }
+
+        if (nullptr == s->arq_)
+        {
+            if (data->size() > UDP_MAX_DATAGRAM || !imp_->queue_datagram(s->endpoint, data->data(), data->size()))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (!s->arq_->send(data))
+            {
+                return false;
+            }
+            imp_->mark_dirty(s);
+        }
+        imp_->post_flush();
+        return true;
+    }
+
+    bool udp::close(uint32_t connid)
+    {
+        auto s = imp_->sessions_.find(connid);
+        if (nullptr == s)
+        {
+            return false;
+        }
+        imp_->remove(s, network_logic_error::ok, true);
+        return true;
+    }
+
+    size_t udp::waiting(uint32_t connid)
+    {
+        auto& s = imp_->sessions_.find(connid);
+        if (nullptr == s || nullptr == s->arq_)
+        {
+            return 0;
+        }
+        return s->arq_->waiting();
+    }
+
+    void udp::init()
+    {
+        component::init();
+        auto s = parent<service>();
+        MOON_DCHECK(s != nullptr, "udp::init service is null");
+        imp_->self_ = s->get_component<udp>(name());
+        imp_->ios_ = &(s->get_worker()->io_service());
+        imp_->log_ = s->logger();
+        imp_->on_data_ = std::bind(&service::handle_message, s, std::placeholders::_1);
+        imp_->timer_.reset(new asio::steady_timer(*imp_->ios_));
+    }
+
+    void udp::destroy()
+    {
+        component::destroy();
+        asio::error_code ec;
+        imp_->timer_->cancel(ec);
+        if (nullptr != imp_->socket_)
+        {
+            imp_->socket_->close(ec);
+        }
+        imp_->sessions_.clear();
+        imp_->endpoints_.clear();
+        imp_->dirty_.clear();
+    }
+}
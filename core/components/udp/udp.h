@@ -0,0 +1,72 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+#pragma once
+#include "config.h"
+#include "component.h"
+#include "components/tcp/tcp.h"
+
+namespace moon
+{
+    enum class udp_mode :std::uint8_t
+    {
+        udp_raw,//one socket_recv message per datagram, no delivery or order guarantee
+        udp_arq,//reliable ordered messages, selective repeat with fast retransmit(KCP style)
+    };
+
+    /*
+    One udp socket, remote endpoints are sessions with connids allocated like tcp connections.
+    Messages to the service are the same as tcp's: socket_accept(first datagram from a new endpoint of a listening socket),
+    socket_recv, socket_logic_error(timeout, dead_link) and socket_close, data of accept and close is the remote address.
+    Datagrams are read with recvmmsg and written with sendmmsg on linux.
+    */
+    class MOON_EXPORT udp :public component
+    {
+    public:
+        udp() noexcept;
+
+        virtual ~udp();
+
+        //should be called before listen/connect
+        void setmode(udp_mode m);
+
+        //a session which receives nothing in seconds is closed, 0 means no timeout
+        void settimeout(int seconds);
+
+        //arq: bytes of a datagram(default UDP_ARQ_MTU), should be called before listen/connect. The peer must use the same mtu or bigger
+        void setmtu(size_t bytes);
+
+        //arq: send and receive window in segments(default UDP_ARQ_WINDOW), should be called before listen/connect
+        void setwindow(uint32_t sndwnd, uint32_t rcvwnd);
+
+        //arq: ms between retransmission checks, acks of fastresend later segments resend a segment(0 disables), min rto in ms
+        void setarq(uint32_t interval, uint32_t fastresend, uint32_t minrto);
+
+        bool listen(const std::string& ip, const std::string& port);
+
+        //session to ip:port, the socket is opened on first use(a listening socket is shared). return 0 if failed
+        uint32_t connect(const std::string& ip, const std::string& port);
+
+        //raw: one datagram(at most UDP_MAX_DATAGRAM bytes). arq: one message(at most 256 segments)
+        bool send(uint32_t connid, const buffer_ptr_t& data);
+
+        //arq: the peer is told, data not acked yet is dropped
+        bool close(uint32_t connid);
+
+        //arq: segments queued and not acked yet, 0 if session not found
+        size_t waiting(uint32_t connid);
+
+    private:
+        void init() override;
+
+        void destroy() override;
+    private:
+        struct imp;
+        imp* imp_;
+    };
+}
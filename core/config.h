@@ -8,18 +8,55 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 ****************************************************************************/
 #pragma once
 #include "common/macro_define.hpp"
+#include "common/intrusive_ptr.hpp"
 
 namespace moon
 {
-    const int32_t WORKER_ID_SHIFT = 24;
     const int64_t EVENT_UPDATE_INTERVAL = 5;
+    //work stealing scheduler
+    const int64_t STEAL_INTERVAL = 500;
+    const int32_t STEAL_BUSY_PERCENT = 50;
+    const int32_t STEAL_IDLE_PERCENT = 10;
+    //workers' recent cpu usage is sampled every LOAD_SAMPLE_INTERVAL ms, used by work stealing and service placement
+    const int64_t LOAD_SAMPLE_INTERVAL = 100;
+    //max messages handled by one drain of worker's local run queue, the rest wait for next drain
+    const uint32_t LOCAL_DRAIN_LIMIT = 1024;
     const size_t BUFFER_HEAD_RESERVED = 6;
     const size_t SERVICE_DB_NUM = 5;
 
-    DECLARE_SHARED_PTR(message);
+    class message;
+    //message carries its own reference count, see message.hpp
+    using message_ptr_t = intrusive_ptr<message>;
     DECLARE_SHARED_PTR(buffer);
     DECLARE_SHARED_PTR(service);
 
+    //how server::new_service chooses a worker when workerid is not specified
+    enum class placement : uint8_t
+    {
+        //use server's default placement
+        none,
+        round_robin,
+        //the shared worker with the lowest recent cpu usage
+        least_cpu,
+        //the shared worker with the fewest services
+        least_services,
+        //the worker of an existing unique service
+        colocate
+    };
+
+    inline placement placement_from_string(const string_view_t& s)
+    {
+        if (s == "round_robin")
+            return placement::round_robin;
+        if (s == "least_cpu")
+            return placement::least_cpu;
+        if (s == "least_services")
+            return placement::least_services;
+        if (s == "colocate")
+            return placement::colocate;
+        return placement::none;
+    }
+
     const uint8_t PTYPE_UNKNOWN = 0;
     const uint8_t PTYPE_SYSTEM = 1;
     const uint8_t PTYPE_TEXT = 2;
@@ -30,11 +67,50 @@ namespace moon
     //network
     using message_size_t = uint16_t;
     const message_size_t MAX_NMSG_SIZE = 8192;
-
-    inline uint8_t worker_id(uint32_t serviceid)
-    {
-        return ((serviceid >> WORKER_ID_SHIFT) & 0xFF);
-    }
+    //per connection read buffer of default protocol, frames bigger than it are read into the message directly
+    const size_t NMSG_READ_BUFFER_SIZE = 4096;
+    //default granularity(ms) of connection read timeout, see tcp::settimeoutprecision
+    const int64_t NET_TIMEOUT_PRECISION = 100;
+    const int64_t NET_TIMEOUT_PRECISION_MIN = 10;
+    //the read buffer starts from this size, grows when reads fill it and shrinks back when traffic is light
+    const size_t NMSG_READ_BUFFER_MIN = 256;
+    //one socket write gathers queued buffers up to this many bytes(at least one buffer) or NMSG_SEND_BATCH_BUFFERS buffers
+    const size_t NMSG_SEND_BATCH_BYTES = 64 * 1024;
+    const size_t NMSG_SEND_BATCH_BUFFERS = 256;
+    //default max bytes of a websocket message(all of its fragments) or a http request body, see tcp::setmaxmessage
+    const size_t WS_MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+    //max bytes of a http request line and header fields
+    const size_t HTTP_MAX_HEADER_SIZE = 16 * 1024;
+    //default max connections of http_client to one host:port
+    const uint32_t HTTP_CLIENT_MAX_CONN = 8;
+    //http_client closes a keep-alive connection idle for this many ms
+    const int64_t HTTP_CLIENT_IDLE_TIMEOUT = 60000;
+    //http_client checks request timeouts and idle connections every this many ms
+    const int64_t HTTP_CLIENT_CHECK_INTERVAL = 1000;
+    //udp: max bytes of a datagram, bigger received datagrams are dropped. Receive buffers are UDP_BATCH * UDP_MAX_DATAGRAM bytes per component
+    const size_t UDP_MAX_DATAGRAM = 4096;
+    //udp: datagrams read by one recvmmsg or written by one sendmmsg
+    const size_t UDP_BATCH = 32;
+    //udp: SO_RCVBUF and SO_SNDBUF(capped by the system's limits), a small datagram takes about 1KB of kernel buffer
+    const int UDP_SOCKET_BUFFER = 4 * 1024 * 1024;
+    //udp: datagrams are dropped when this many bytes wait for the socket to be writable
+    const size_t UDP_SEND_QUEUE_MAX = 4 * 1024 * 1024;
+    //udp arq: default bytes of a datagram(segment headers included), send and receive window in segments
+    const size_t UDP_ARQ_MTU = 1400;
+    const uint32_t UDP_ARQ_WINDOW = 128;
+    //udp arq: default ms between retransmission checks, acks after this many later segments trigger fast retransmit, min rto
+    const uint32_t UDP_ARQ_INTERVAL = 10;
+    const uint32_t UDP_ARQ_FASTRESEND = 2;
+    const uint32_t UDP_ARQ_MINRTO = 30;
+    //udp arq: a session is closed when a segment is sent this many times without ack
+    const uint32_t UDP_ARQ_DEAD_LINK = 20;
+    //io_uring backend(linux): submission queue entries of a listener's ring, the completion queue is 4 times bigger
+    const uint32_t IO_URING_ENTRIES = 1024;
+    //io_uring backend: provided receive buffers shared by all connections of a listener, count(power of 2) and bytes of each
+    const uint32_t IO_URING_RECV_BUFFERS = 1024;
+    const uint32_t IO_URING_RECV_BUFFER_SIZE = 4096;
+    //a connection closed after sending(e.g. websocket close handshake) waits at most this many ms for its queued data
+    const int64_t NET_LINGER_TIMEOUT = 5000;
 }
 
 
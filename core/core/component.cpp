@@ -62,6 +62,11 @@ namespace moon
         return component_imp_->enable_update_;
     }
 
+    size_t component::component_num() const
+    {
+        return component_imp_->components_.size();
+    }
+
     component_ptr_t component::get_component_imp(const std::string & name) const
     {
         auto iter = component_imp_->components_.find(name);
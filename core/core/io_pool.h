@@ -0,0 +1,103 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include "config.h"
+#include "asio.hpp"
+#include "log.h"
+
+namespace moon
+{
+    /*
+    Network io threads, separate from workers. Each thread runs its own io_service.
+    Sockets living here do io and framing without waiting for lua, their messages go to services' mailbox through server.
+    */
+    class io_pool
+    {
+    public:
+        io_pool() = default;
+
+        io_pool(const io_pool&) = delete;
+
+        io_pool& operator=(const io_pool&) = delete;
+
+        ~io_pool()
+        {
+            stop();
+        }
+
+        void init(uint32_t n)
+        {
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                auto ctx = std::make_unique<context>();
+                ctx->work = std::make_unique<asio::io_service::work>(ctx->ios);
+                contexts_.emplace_back(std::move(ctx));
+            }
+        }
+
+        void run(log* logger)
+        {
+            for (size_t i = 0; i < contexts_.size(); ++i)
+            {
+                auto ctx = contexts_[i].get();
+                ctx->thread = std::thread([ctx, logger, i]() {
+                    CONSOLE_INFO(logger, "IO-%d start", static_cast<int>(i + 1));
+                    ctx->ios.run();
+                    CONSOLE_INFO(logger, "IO-%d stop", static_cast<int>(i + 1));
+                });
+            }
+        }
+
+        //called after workers stopped, pending handlers(e.g. closing sockets) are dropped
+        void stop()
+        {
+            for (auto& ctx : contexts_)
+            {
+                ctx->work.reset();
+                ctx->ios.stop();
+            }
+
+            for (auto& ctx : contexts_)
+            {
+                if (ctx->thread.joinable())
+                {
+                    ctx->thread.join();
+                }
+            }
+        }
+
+        uint32_t size() const
+        {
+            return static_cast<uint32_t>(contexts_.size());
+        }
+
+        asio::io_service& get(uint32_t i)
+        {
+            return contexts_[i % contexts_.size()]->ios;
+        }
+
+        //round robin start index for a new listener
+        uint32_t next()
+        {
+            return next_.fetch_add(1);
+        }
+
+    private:
+        struct context
+        {
+            asio::io_service ios;
+            std::unique_ptr<asio::io_service::work> work;
+            std::thread thread;
+        };
+
+        std::atomic<uint32_t> next_{0};
+        std::vector<std::unique_ptr<context>> contexts_;
+    };
+}
@@ -11,8 +11,10 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "common/concurrent_map.hpp"
 #include "common/time.hpp"
 #include "common/rwlock.hpp"
+#include "common/handle_table.hpp"
 #include "log.h"
 #include "worker.h"
+#include "io_pool.h"
 #include "message.hpp"
 #include "service.h"
 
@@ -29,8 +31,16 @@ namespace moon
 
         server_imp()
             :ok_(false)
+            , event_wakeup_(false)
+            , work_steal_(false)
             , workernum_(0)
+            , io_threadnum_(0)
+            , quantum_count_(0)
+            , quantum_time_(0)
             , next_workerid_(0)
+            , balance_time_(0)
+            , sample_time_(0)
+            , placement_(placement::round_robin)
         {
             for (size_t i = 0; i < SERVICE_DB_NUM; i++)
             {
@@ -60,32 +70,149 @@ namespace moon
             return workers_[id];
         }
 
-        bool has_serviceid(uint32_t serviceid)
+        //shared worker with the smallest (load, servicenum) or (servicenum, load), ties are broken round robin
+        worker* least_loaded_worker(bool by_cpu)
         {
-            SHARED_LOCK_GURAD(serviceids_lck_);
-            return (serviceids_.find(serviceid) != serviceids_.end());
+            worker* res = nullptr;
+            uint8_t start = next_worker_id();
+            for (uint8_t i = 0; i < workernum_; i++)
+            {
+                auto w = workers_[(start + i) % workernum_].get();
+                if (!w->shared())
+                    continue;
+
+                if (nullptr == res)
+                {
+                    res = w;
+                    continue;
+                }
+
+                int64_t a[2] = { w->load(), w->servicenum() };
+                int64_t b[2] = { res->load(), res->servicenum() };
+                size_t k = by_cpu ? 0 : 1;
+                if (a[k] < b[k] || (a[k] == b[k] && a[1 - k] < b[1 - k]))
+                {
+                    res = w;
+                }
+            }
+            return (nullptr != res) ? res : next_worker().get();
         }
 
-        bool try_add_serviceid(uint32_t serviceid)
+        worker* select_worker(placement policy, const std::string& colocate, bool& bound)
         {
-            UNIQUE_LOCK_GURAD(serviceids_lck_);
-            if (serviceids_.find(serviceid) == serviceids_.end())
+            if (placement::none == policy)
+            {
+                policy = colocate.empty() ? placement_ : placement::colocate;
+            }
+
+            if (placement::colocate == policy)
+            {
+                uint32_t id = 0;
+                unique_services_.try_get_value(colocate, id);
+                auto w = route(id);
+                if (nullptr != w)
+                {
+                    //keep them together, work stealing will not move it
+                    bound = true;
+                    return w;
+                }
+                CONSOLE_WARN((&default_log_), "colocate service [%s] not found, use default placement.", colocate.data());
+                policy = (placement::colocate == placement_) ? placement::round_robin : placement_;
+            }
+
+            switch (policy)
             {
-                return serviceids_.emplace(serviceid).second;
+            case placement::least_cpu:
+                return least_loaded_worker(true);
+            case placement::least_services:
+                return least_loaded_worker(false);
+            default:
+                return next_worker().get();
             }
-            return false;
         }
 
-        void on_service_remove(uint32_t serviceid)
+        worker* route(uint32_t serviceid)
+        {
+            return routes_.find(serviceid);
+        }
+
+        void set_route(uint32_t serviceid, worker* w)
+        {
+            auto ok = routes_.set(serviceid, w);
+            MOON_DCHECK(ok, "set route of unknown service");
+            (void)ok;
+        }
+
+        //crashed service's id keeps reserved, messages send to it will get error response
+        void on_service_remove(uint32_t serviceid, bool crashed)
         {
-            UNIQUE_LOCK_GURAD(serviceids_lck_);
-            MOON_DCHECK(serviceids_.erase(serviceid)==1,"erase failed!");
+            if (crashed)
+            {
+                routes_.set(serviceid, nullptr);
+                return;
+            }
+            auto ok = routes_.release(serviceid);
+            MOON_DCHECK(ok, "erase failed!");
+            (void)ok;
         }
 
         size_t servicenum()
         {
-            SHARED_LOCK_GURAD(serviceids_lck_);
-            return serviceids_.size();
+            return routes_.size();
+        }
+
+        void sample_load()
+        {
+            auto now = time::microsecond();
+            auto period = now - sample_time_;
+            if (period < LOAD_SAMPLE_INTERVAL * 1000)
+            {
+                return;
+            }
+            sample_time_ = now;
+
+            for (auto& w : workers_)
+            {
+                w->sample_load(period);
+            }
+        }
+
+        //move one service from the busiest worker to the most idle shared worker
+        void balance()
+        {
+            auto now = time::microsecond();
+            auto period = now - balance_time_;
+            if (period < STEAL_INTERVAL * 1000)
+            {
+                return;
+            }
+            balance_time_ = now;
+
+            worker* busy = nullptr;
+            worker* idle = nullptr;
+            int32_t max_load = 0;
+            int32_t min_load = 100;
+            for (auto& w : workers_)
+            {
+                auto load = w->load();
+
+                if (load >= STEAL_BUSY_PERCENT && load > max_load && w->servicenum() > 1)
+                {
+                    max_load = load;
+                    busy = w.get();
+                }
+
+                if (load < STEAL_IDLE_PERCENT && load < min_load && w->shared())
+                {
+                    min_load = load;
+                    idle = w.get();
+                }
+            }
+
+            if (nullptr != busy && nullptr != idle && busy != idle)
+            {
+                busy->migrate_to(idle);
+            }
         }
 
         void wait()
@@ -95,18 +222,29 @@ namespace moon
                 (*iter)->wait();
             }
 
+            iopool_.stop();
+
             CONSOLE_INFO((&default_log_), "STOP");
             default_log_.wait();
             ok_ = false;
         }
 
         std::atomic_bool ok_;
+        bool event_wakeup_;
+        bool work_steal_;
         uint8_t workernum_;
+        uint32_t io_threadnum_;
+        uint32_t quantum_count_;
+        int64_t quantum_time_;
         std::atomic<uint32_t> next_workerid_;
+        int64_t balance_time_;
+        int64_t sample_time_;
+        placement placement_;
         std::vector<worker_ptr_t> workers_;
+        io_pool iopool_;
         std::unordered_map<std::string, register_func > regservices_;
-        rwlock serviceids_lck_;
-        std::unordered_set<uint32_t> serviceids_;
+        //serviceid -> worker
+        handle_table<worker> routes_;
         std::vector<std::shared_ptr<simple_db_t>>  databases_;
         env_t env_;
         unique_service_db_t unique_services_;
@@ -131,7 +269,7 @@ namespace moon
         worker_num == 0 ? 1 : worker_num;
         imp_->workernum_ = worker_num;
 
-        CONSOLE_INFO(logger(), "INIT with %d workers.", imp_->workernum_);
+        CONSOLE_INFO(logger(), "INIT with %d workers, %u io threads, %s wakeup, %s scheduler.", imp_->workernum_, imp_->io_threadnum_, imp_->event_wakeup_ ? "event" : "tick", imp_->work_steal_ ? "steal" : "static");
 
         for (uint8_t i = 0; i != worker_num; i++)
         {
@@ -139,18 +277,56 @@ namespace moon
             auto w = imp_->workers_.back();
             w->workerid(i+1);
             w->set_server(this);
-            w->on_service_remove = std::bind(&server_imp::on_service_remove, imp_, std::placeholders::_1);
+            w->event_wakeup(imp_->event_wakeup_);
+            w->quantum(imp_->quantum_count_, imp_->quantum_time_);
+            w->on_service_remove = std::bind(&server_imp::on_service_remove, imp_, std::placeholders::_1, std::placeholders::_2);
         }
+        imp_->balance_time_ = time::microsecond();
+        imp_->sample_time_ = imp_->balance_time_;
 
         for (auto& w : imp_->workers_)
         {
             w->run();
         }
 
+        imp_->iopool_.init(imp_->io_threadnum_);
+        imp_->iopool_.run(logger());
+
         logger()->init(logpath);
         imp_->ok_ = true;
     }
 
+    void server::event_wakeup(bool v)
+    {
+        imp_->event_wakeup_ = v;
+    }
+
+    void server::work_steal(bool v)
+    {
+        imp_->work_steal_ = v;
+    }
+
+    void server::service_quantum(uint32_t count, int64_t time)
+    {
+        imp_->quantum_count_ = count;
+        imp_->quantum_time_ = time;
+    }
+
+    void server::io_threads(uint32_t n)
+    {
+        imp_->io_threadnum_ = n;
+    }
+
+    io_pool* server::iopool() const
+    {
+        return &imp_->iopool_;
+    }
+
+    void server::service_placement(placement v)
+    {
+        imp_->placement_ = (placement::none == v) ? placement::round_robin : v;
+    }
+
     uint8_t server::workernum()
     {
         return static_cast<uint8_t>(imp_->workers_.size());
@@ -161,6 +337,15 @@ namespace moon
         return imp_->servicenum();
     }
 
+    worker* server::get_worker(uint32_t workerid) const
+    {
+        if (workerid == 0 || workerid > imp_->workers_.size())
+        {
+            return nullptr;
+        }
+        return imp_->workers_[workerid - 1].get();
+    }
+
     void server::run()
     {
         if (0 == imp_->workernum_)
@@ -182,8 +367,12 @@ namespace moon
             auto diff = (now - prew_tick);
             prew_tick = now;
 
+            time::update_coarse_clock();
+
             int stoped_worker_num = 0;
 
+            imp_->sample_load();
+
             for (auto& w : imp_->workers_)
             {
                 if (w->stoped())
@@ -199,6 +388,11 @@ namespace moon
                 break;
             }
 
+            if (imp_->work_steal_ && 0 == stoped_worker_num)
+            {
+                imp_->balance();
+            }
+
             if (diff <= EVENT_UPDATE_INTERVAL + prev_sleep_time)
             {
                 prev_sleep_time = EVENT_UPDATE_INTERVAL + prev_sleep_time - diff;
@@ -227,6 +421,11 @@ namespace moon
     }
 
     uint32_t server::new_service(const std::string & service_type, bool unique, bool shared, int workerid, const std::string & config)
+    {
+        return new_service(service_type, unique, shared, workerid, config, placement::none, std::string());
+    }
+
+    uint32_t server::new_service(const std::string & service_type, bool unique, bool shared, int workerid, const std::string & config, placement policy, const std::string& colocate)
     {
         if (!imp_->ok_)
             return 0;
@@ -241,29 +440,25 @@ namespace moon
         auto s = iter->second();
 
         worker* wk;
+        bool bound = (workerid > 0 || !shared);
         if (workerid>0 && workerid <= static_cast<int>(imp_->workernum_))
         {
             wk = imp_->workers_[workerid - 1].get();
         }
         else
         {
-            wk = imp_->next_worker().get();
+            wk = imp_->select_worker(policy, colocate, bound);
         }
 
-        size_t counter = 0;
-        uint32_t serviceid = 0;
-        do
+        uint32_t serviceid = imp_->routes_.create(wk);
+        if (0 == serviceid)
         {
-            if (counter>= worker::MAX_SERVICE_NUM)
-            {
-                CONSOLE_ERROR(logger(),"new service failed: can not get more service id.worker[%d] servicenum[%u].", wk->workerid(), wk->servicenum());
-                return 0;
-            }
-            serviceid = wk->make_serviceid();
-            ++counter;
-        } while (!imp_->try_add_serviceid(serviceid));
+            CONSOLE_ERROR(logger(),"new service failed: can not get more service id. servicenum[%u].", static_cast<uint32_t>(imp_->servicenum()));
+            return 0;
+        }
 
         wk->shared(shared);
+        s->set_bound(bound);
         s->set_id(serviceid);
         s->set_worker(wk);
         s->set_unique(unique);
@@ -276,7 +471,7 @@ namespace moon
                 return serviceid;
             }
         }
-        imp_->on_service_remove(serviceid);
+        imp_->on_service_remove(serviceid, false);
         CONSOLE_ERROR(logger(), "init service failed with config: %s", config.data());
         return 0;
     }
@@ -313,14 +508,14 @@ namespace moon
                 return;
             }
 
-            auto workerid =worker_id(serviceid);
-            if (workerid>0 && workerid <= imp_->workernum_)
+            auto w = imp_->route(serviceid);
+            if (nullptr != w)
             {
-                imp_->workers_[workerid-1]->remove_service(serviceid, sender, responseid);
+                w->remove_service(serviceid, sender, responseid);
             }
             else
             {
-                auto content = moon::format("rmservice worker %d not found.",workerid);
+                auto content = moon::format("rmservice service %u not found.", serviceid);
                 make_response(sender, "error", content, responseid, PTYPE_ERROR);
             }
         }
@@ -344,6 +539,26 @@ namespace moon
                 make_response(sender, "error", content, responseid, PTYPE_ERROR);
             }
         }
+        else if (cmds.front() == "queuewait")
+        {
+            if (cmds.size() < 2)
+            {
+                auto content = moon::format("server: call queuewait param error %s", header.data());
+                make_response(sender, "error", content, responseid, PTYPE_ERROR);
+                return;
+            }
+
+            uint32_t workerid = moon::string_convert<uint32_t>(cmds[1]);
+            if (workerid>0 && workerid  <= imp_->workernum_)
+            {
+                imp_->workers_[workerid-1]->queue_wait(sender, responseid);
+            }
+            else
+            {
+                auto content = moon::format("service worker %d not found.", workerid);
+                make_response(sender, "error", content, responseid, PTYPE_ERROR);
+            }
+        }
         else
         {
             auto content = moon::format("server: call invalid  cmd %s.", cmds.front().data());
@@ -358,15 +573,33 @@ namespace moon
             return;
         MOON_DCHECK(msg->type() != PTYPE_UNKNOWN, "invalid message type.");
         MOON_DCHECK(msg->receiver() != 0, "message receiver serviceid is 0.");
-        uint8_t wkid =worker_id(msg->receiver());
-        MOON_DCHECK(wkid > 0 && wkid <= imp_->workernum_, "invalid message receiver serviceid.");
-        imp_->workers_[wkid -1]->send(msg,(msg->responseid()!=0));
+        auto w = imp_->route(msg->receiver());
+        if (nullptr == w)
+        {
+            make_response(msg->sender(), "error", "call dead service.", msg->responseid(), PTYPE_ERROR);
+            return;
+        }
+        w->send(msg,(msg->responseid()!=0));
+    }
+
+    worker* server::route(uint32_t serviceid) const
+    {
+        return imp_->route(serviceid);
+    }
+
+    void server::set_route(uint32_t serviceid, worker* w)
+    {
+        imp_->set_route(serviceid, w);
     }
 
     void server::send(uint32_t sender, uint32_t receiver, const buffer_ptr_t & data, const string_view_t& header, int32_t responseid, uint8_t type) const
+    {
+        send(sender, receiver, message::create(data), header, responseid, type);
+    }
+
+    void server::send(uint32_t sender, uint32_t receiver, const message_ptr_t & msg, const string_view_t& header, int32_t responseid, uint8_t type) const
     {
         responseid = -responseid;
-        message_ptr_t msg = std::make_shared<message>(data);
         msg->set_sender(sender);
         msg->set_receiver(receiver);
         if (header.size() != 0)
@@ -378,17 +611,29 @@ namespace moon
         send_message(msg);
     }
 
-    void server::broadcast(uint32_t sender, const message_ptr_t & msg)
+    void server::publish(uint32_t sender, const string_view_t& topic, const message_ptr_t & msg)
     {
         if (!imp_->ok_)
             return;
 
         MOON_DCHECK(msg->type() != PTYPE_UNKNOWN,"invalid message type.");
-        msg->set_broadcast(true);
-        msg->set_sender(sender);
+        MOON_DCHECK(!topic.empty(), "publish empty topic.");
         for (auto& w : imp_->workers_)
         {
-            w->send(msg);
+            //each worker has its own topic table and only delivers to local subscribers
+            if (!w->has_subscriber())
+            {
+                continue;
+            }
+            //a message can only be linked into one mailbox, each worker gets its own copy
+            auto m = message::create(msg->size());
+            m->write_data(msg->bytes());
+            m->set_header(topic);
+            m->set_sender(sender);
+            m->set_type(msg->type());
+            m->set_subtype(msg->subtype());
+            m->set_broadcast(true);
+            w->send(m);
         }
     }
 
@@ -13,6 +13,8 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "server.h"
 #include "worker.h"
 #include "log.h"
+#include "common/time.hpp"
+#include "common/string.hpp"
 
 namespace moon
 {
@@ -20,7 +22,13 @@ namespace moon
     {
         service_imp()
             :unique_(false)
+            , bound_(false)
             , id_(0)
+            , handled_(0)
+            , runnable_(false)
+            , wait_count_(0)
+            , wait_total_(0)
+            , wait_max_(0)
             , pool_(nullptr)
             , worker_(nullptr)
         {
@@ -31,7 +39,16 @@ namespace moon
         }
 
         bool unique_;
+        bool bound_;
         uint32_t id_;
+        uint32_t handled_;
+        bool runnable_;
+        //queue wait time statistics, microseconds
+        uint32_t wait_count_;
+        int64_t wait_total_;
+        int64_t wait_max_;
+        std::deque<message_ptr_t> mailbox_;
+        std::unordered_set<std::string> topics_;
         server* pool_;
         worker* worker_;
     };
@@ -82,6 +99,97 @@ namespace moon
         service_imp_->pool_ = w->get_server();
     }
 
+    void service::set_bound(bool v)
+    {
+        service_imp_->bound_ = v;
+    }
+
+    bool service::movable() const
+    {
+        //components(e.g. tcp) are bound to worker's io_service
+        return !service_imp_->bound_ && ok() && component_num() == 0;
+    }
+
+    uint32_t service::handled_messages(bool reset)
+    {
+        auto n = service_imp_->handled_;
+        if (reset)
+        {
+            service_imp_->handled_ = 0;
+        }
+        return n;
+    }
+
+    bool service::push_message(const message_ptr_t & msg)
+    {
+        service_imp_->mailbox_.push_back(msg);
+        if (service_imp_->runnable_)
+        {
+            return false;
+        }
+        service_imp_->runnable_ = true;
+        return true;
+    }
+
+    bool service::dispatch_messages(uint32_t max_count, int64_t max_time)
+    {
+        auto& mailbox = service_imp_->mailbox_;
+        auto begin_time = time::microsecond();
+        auto now = begin_time;
+        uint32_t count = 0;
+        while (!mailbox.empty())
+        {
+            if ((max_count > 0 && count >= max_count) || (max_time > 0 && now - begin_time >= max_time))
+            {
+                break;
+            }
+
+            auto msg = std::move(mailbox.front());
+            mailbox.pop_front();
+
+            auto wait = now - msg->enqueue_time_;
+            ++service_imp_->wait_count_;
+            service_imp_->wait_total_ += wait;
+            service_imp_->wait_max_ = (std::max)(service_imp_->wait_max_, wait);
+
+            if (!msg->broadcast() || (ok() && id() != msg->sender()))
+            {
+                handle_message(msg);
+            }
+            ++count;
+            now = time::microsecond();
+        }
+        service_imp_->runnable_ = !mailbox.empty();
+        return service_imp_->runnable_;
+    }
+
+    bool service::reschedule()
+    {
+        service_imp_->runnable_ = !service_imp_->mailbox_.empty();
+        return service_imp_->runnable_;
+    }
+
+    std::deque<message_ptr_t> service::take_messages()
+    {
+        service_imp_->runnable_ = false;
+        return std::move(service_imp_->mailbox_);
+    }
+
+    std::string service::queue_wait_stat(bool reset)
+    {
+        auto& imp = *service_imp_;
+        double avg = (imp.wait_count_ == 0) ? 0.0 : static_cast<double>(imp.wait_total_) / imp.wait_count_;
+        auto res = moon::format(R"({"name":"%s","serviceid":%u,"count":%u,"avg":%.1f,"max":%lld,"queued":%u})"
+            , name().data(), id(), imp.wait_count_, avg, static_cast<long long>(imp.wait_max_), static_cast<uint32_t>(imp.mailbox_.size()));
+        if (reset)
+        {
+            imp.wait_count_ = 0;
+            imp.wait_total_ = 0;
+            imp.wait_max_ = 0;
+        }
+        return res;
+    }
+
     void service::exit()
     {
         removeself();
@@ -107,6 +215,36 @@ namespace moon
         get_worker()->remove_service(service_imp_->id_, 0, 0, crashed);
     }
 
+    void service::subscribe(const std::string & topic)
+    {
+        if (!service_imp_->topics_.emplace(topic).second)
+        {
+            return;
+        }
+        //before service added to worker, worker will subscribe all topics when adding it
+        if (ok())
+        {
+            get_worker()->subscribe(id(), topic);
+        }
+    }
+
+    void service::unsubscribe(const std::string & topic)
+    {
+        if (service_imp_->topics_.erase(topic) == 0)
+        {
+            return;
+        }
+        if (ok())
+        {
+            get_worker()->unsubscribe(id(), topic);
+        }
+    }
+
+    const std::unordered_set<std::string>& service::topics() const
+    {
+        return service_imp_->topics_;
+    }
+
     void service::set_unique(bool v)
     {
         service_imp_->unique_ = v;
@@ -121,6 +259,7 @@ namespace moon
                 MOON_CHECK(id() == msg->receiver() || msg->receiver() == 0, "message receiver must be 0 or this serivice");
             }
 
+            ++service_imp_->handled_;
             dispatch(msg.get());
             //redirect message
             if (msg->receiver() != id() && msg->receiver() != 0)
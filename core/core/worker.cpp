@@ -13,6 +13,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "message.hpp"
 #include "log.h"
 #include "server.h"
+#include "common/handle_table.hpp"
 
 
 namespace moon
@@ -21,27 +22,44 @@ namespace moon
         :shared_(true)
         , exit_(false)
         , stoped_(false)
+        , wakeup_(false)
+        , event_wakeup_(false)
+        , resume_(false)
+        , local_posted_(false)
         , workerid_(0)
+        , quantum_count_(0)
+        , quantum_time_(0)
         , cache_uuid_(0)
-        , serviceuid_(1)
+        , servicenum_(0)
         , start_time_(0)
         , work_time_(0)
+        , cpu_time_(0)
+        , load_mark_(0)
+        , load_(0)
         , server_(nullptr)
         , ios_(1)
         , work_(ios_)
+        , topicnum_(0)
     {
     }
 
     worker::~worker()
     {
+        mqueue_.pop_all([](message* m) {
+            message_ptr_t tmp(m, false);
+        });
     }
 
+    //worker which owns the calling thread
+    static thread_local worker* current_worker = nullptr;
+
     void worker::run()
     {
         stoped_ = false;
         thread_ = std::thread([this]() {
+            current_worker = this;
             CONSOLE_INFO(server_->logger(),"WORKER-%d start", workerid_);
-            start_time_ = time::millsecond();
+            start_time_ = time::microsecond();
             ios_.run();
             CONSOLE_INFO(server_->logger(), "WORKER-%d stop", workerid_);
         });
@@ -83,23 +101,15 @@ namespace moon
         return stoped_;
     }
 
-    uint32_t worker::make_serviceid()
-    {
-        auto uid = serviceuid_.fetch_add(1);
-        uid %= MAX_SERVICE_NUM;
-        uint32_t tmp = uid+1;
-        uint8_t wkid = workerid();
-        tmp |= static_cast<uint32_t>(wkid) << WORKER_ID_SHIFT;
-        return tmp;
-    }
-
     void worker::add_service(const service_ptr_t & s)
     {
+        //count it now, so services created in a row are not all placed to this worker
+        servicenum_.fetch_add(1);
         post([this,s](){
-            MOON_CHECK(services_.emplace(s->id(), s).second, "serviceid repeated");
+            insert_service(s);
             s->ok(true);
-            servicenum_.store(static_cast<uint32_t>(services_.size()));
             CONSOLE_INFO(server_->logger(),"[WORKER %d] new service [%s:%u]", workerid(), s->name().data(), s->id());
+            take_incoming(s);
         });    
     }
 
@@ -117,17 +127,23 @@ namespace moon
                     shared(true);
                 }
                 response_content = moon::format(R"({"name":"%s","serviceid":%u})",s->name().data(), s->id());    
-                if (!crashed)
+                auto leftover = s->take_messages();
+                on_service_remove(id, crashed);
+                server_->make_response(sender, "service destroy",response_content, respid, PTYPE_TEXT);
+                CONSOLE_INFO(server_->logger(), "[WORKER %d]service [%s:%u] destroy", workerid(), s->name().data(), s->id());
+                erase_service(iter);
+
+                //receivers of these messages will get error response
+                for (auto& m : leftover)
                 {
-                    on_service_remove(id);
+                    if (!m->broadcast())
+                    {
+                        server_->send_message(m);
+                    }
                 }
-                servicenum_.store(static_cast<uint32_t>(services_.size()));
-                server_->make_response(sender, "service destroy",response_content, respid);
-                CONSOLE_INFO(server_->logger(), "[WORKER %d]service [%s:%u] destroy", workerid(), s->name().data(), s->id());
-                services_.erase(iter);
 
+                //only services watching this service subscribe its exit topic
                 auto m = message::create();
-                m->set_header("exit");
                 m->set_type(PTYPE_SYSTEM);
                 if (crashed)
                 {
@@ -137,10 +153,22 @@ namespace moon
                 {
                     m->write_string("service exit");
                 }
-                get_server()->broadcast(id, m);
+                get_server()->publish(id, moon::format("exit.%u", id), m);
             }
             else
             {
+                auto w = server_->route(id);
+                if (w == this)
+                {
+                    //service is migrating to this worker, removed when it arrives
+                    removing_[id] = pending_remove{ sender, respid, crashed };
+                    return;
+                }
+                else if (nullptr != w)
+                {
+                    w->remove_service(id, sender, respid, crashed);
+                    return;
+                }
                 static const char* errmsg = "remove_service:service not found";
                 server_->make_response(sender, "error", errmsg, respid, PTYPE_ERROR);
             }
@@ -180,6 +208,22 @@ namespace moon
 
     void worker::send(const message_ptr_t & msg, bool immediately)
     {
+        if (current_worker == this)
+        {
+            msg->enqueue_time_ = time::microsecond();
+            localq_.push_back(msg);
+            //sent by a timer or io handler, otherwise handle_messages/drain_local is running and will drain it
+            if (!local_posted_)
+            {
+                local_posted_ = true;
+                post([this]() {
+                    local_posted_ = false;
+                    drain_local();
+                });
+            }
+            return;
+        }
+
         if (immediately)
         {
             post([this, msg]() {
@@ -188,7 +232,17 @@ namespace moon
         }
         else
         {
-            mqueue_.push_back(msg);
+            msg->enqueue_time_ = time::microsecond();
+            //the mailbox holds a reference until the message is popped
+            intrusive_ptr_add_ref(msg.get());
+            mqueue_.push(msg.get());
+            //only the first message of a batch wakes up the worker
+            if (event_wakeup_ && !wakeup_.exchange(true))
+            {
+                post([this]() {
+                    handle_messages();
+                });
+            }
         }
     }
 
@@ -214,14 +268,109 @@ namespace moon
 
     service * worker::find_service(uint32_t serviceid) const
     {
-        auto iter = services_.find(serviceid);
-        if (services_.end() != iter)
+        auto idx = handle_index(serviceid);
+        if (idx < lookup_.size())
         {
-            return iter->second.get();
+            auto s = lookup_[idx];
+            if (nullptr != s && s->id() == serviceid)
+            {
+                return s;
+            }
         }
         return nullptr;
     }
 
+    void worker::subscribe(uint32_t serviceid, const std::string & topic)
+    {
+        auto& subscribers = topics_[topic];
+        if (std::find(subscribers.begin(), subscribers.end(), serviceid) == subscribers.end())
+        {
+            subscribers.push_back(serviceid);
+        }
+        topicnum_.store(static_cast<uint32_t>(topics_.size()));
+    }
+
+    void worker::unsubscribe(uint32_t serviceid, const std::string & topic)
+    {
+        auto iter = topics_.find(topic);
+        if (iter == topics_.end())
+        {
+            return;
+        }
+
+        auto& subscribers = iter->second;
+        auto it = std::find(subscribers.begin(), subscribers.end(), serviceid);
+        if (it != subscribers.end())
+        {
+            *it = subscribers.back();
+            subscribers.pop_back();
+        }
+
+        if (subscribers.empty())
+        {
+            topics_.erase(iter);
+        }
+        topicnum_.store(static_cast<uint32_t>(topics_.size()));
+    }
+
+    bool worker::has_subscriber() const
+    {
+        return topicnum_.load() != 0;
+    }
+
+    void worker::insert_service(const service_ptr_t & s)
+    {
+        MOON_CHECK(services_.emplace(s->id(), s).second, "serviceid repeated");
+        for (auto& topic : s->topics())
+        {
+            subscribe(s->id(), topic);
+        }
+        auto idx = handle_index(s->id());
+        if (idx >= lookup_.size())
+        {
+            lookup_.resize(idx + 1, nullptr);
+        }
+        lookup_[idx] = s.get();
+        servicenum_.store(static_cast<uint32_t>(services_.size()));
+    }
+
+    void worker::erase_service(std::unordered_map<uint32_t, service_ptr_t>::iterator iter)
+    {
+        for (auto& topic : iter->second->topics())
+        {
+            unsubscribe(iter->first, topic);
+        }
+        lookup_[handle_index(iter->first)] = nullptr;
+        services_.erase(iter);
+        servicenum_.store(static_cast<uint32_t>(services_.size()));
+    }
+
+    void worker::take_incoming(const service_ptr_t & s)
+    {
+        auto iter = incoming_.find(s->id());
+        if (iter != incoming_.end())
+        {
+            for (auto& m : iter->second)
+            {
+                s->push_message(m);
+            }
+            incoming_.erase(iter);
+        }
+
+        if (s->reschedule())
+        {
+            runqueue_.push_back(s->id());
+            resume();
+        }
+
+        auto rm = removing_.find(s->id());
+        if (rm != removing_.end())
+        {
+            remove_service(s->id(), rm->second.sender, rm->second.respid, rm->second.crashed);
+            removing_.erase(rm);
+        }
+    }
+
     void worker::shared(bool v)
     {
         shared_ = v;
@@ -232,11 +381,119 @@ namespace moon
         return shared_.load();
     }
 
+    void worker::event_wakeup(bool v)
+    {
+        event_wakeup_ = v;
+    }
+
+    void worker::quantum(uint32_t count, int64_t time)
+    {
+        quantum_count_ = count;
+        quantum_time_ = time;
+    }
+
     uint32_t worker::servicenum() const
     {
         return servicenum_.load();
     }
 
+    int64_t worker::cpu_time() const
+    {
+        return cpu_time_.load();
+    }
+
+    int32_t worker::load() const
+    {
+        return load_.load();
+    }
+
+    void worker::sample_load(int64_t period)
+    {
+        auto t = cpu_time_.load();
+        auto cur = static_cast<int32_t>((t - load_mark_) * 100 / (period == 0 ? 1 : period));
+        load_mark_ = t;
+        load_.store((load_.load() * 3 + cur) / 4);
+    }
+
+    void worker::migrate_to(worker* target)
+    {
+        post([this, target] {
+            if (exit_ || services_.size() < 2)
+            {
+                return;
+            }
+
+            service_ptr_t s;
+            uint32_t max_handled = 0;
+            for (auto& it : services_)
+            {
+                auto n = it.second->handled_messages(true);
+                if (it.second->movable() && n > max_handled)
+                {
+                    max_handled = n;
+                    s = it.second;
+                }
+            }
+
+            if (nullptr == s)
+            {
+                return;
+            }
+
+            auto id = s->id();
+            //messages sent before route changed are moved to service's mailbox, later ones go to target directly,
+            //target holds them until the service arrives, so they are handled after the mailbox
+            server_->set_route(id, target);
+            mqueue_.pop_all([this](message* m) {
+                message_ptr_t msg(m, false);
+                enqueue(msg);
+            });
+            erase_service(services_.find(id));
+            outgoing_.emplace(id, s);
+            CONSOLE_INFO(server_->logger(), "[WORKER %d] service [%s:%u] migrate to [WORKER %d]", workerid(), s->name().data(), id, target->workerid());
+            //handoff after the handlers already posted to this worker(responses, wakeups), messages still on the way
+            //(sender got the old route, or local ones) are moved to the mailbox too, not forwarded behind the later ones
+            post([this, target, s] {
+                auto id = s->id();
+                mqueue_.pop_all([this](message* m) {
+                    message_ptr_t msg(m, false);
+                    enqueue(msg);
+                });
+                for (auto it = localq_.begin(); it != localq_.end();)
+                {
+                    if (!(*it)->broadcast() && (*it)->receiver() == id)
+                    {
+                        s->push_message(*it);
+                        it = localq_.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+                outgoing_.erase(id);
+                target->accept_service(s);
+                resume();
+            });
+            resume();
+        });
+    }
+
+    void worker::accept_service(const service_ptr_t& s)
+    {
+        post([this, s]() {
+            s->set_worker(this);
+            insert_service(s);
+            take_incoming(s);
+
+            if (exit_)
+            {
+                stoped_ = false;
+                s->exit();
+            }
+        });
+    }
+
     void worker::start()
     {
         post([this] {
@@ -250,69 +507,246 @@ namespace moon
     void worker::update()
     {
         post([this] {
-            auto begin_time = time::millsecond();
+            auto begin_time = time::microsecond();
 
             for (auto& it : services_)
             {
                 it.second->update();
             }
 
-            if (mqueue_.size() != 0)
+            cpu_time_ += time::microsecond() - begin_time;
+
+            if (!event_wakeup_)
             {
-                service* ser = nullptr;
-                swapqueue_.clear();
-                mqueue_.swap(swapqueue_);
-                for (auto& msg : swapqueue_)
-                {
-                    handle_one(ser, msg);
-                }
-                if (cache_uuid_ != 0)
+                handle_messages();
+            }
+        });
+    }
+
+    void worker::handle_messages()
+    {
+        //must reset before swap, messages pushed after swap will wake up again
+        wakeup_.store(false);
+
+        mqueue_.pop_all([this](message* m) {
+            message_ptr_t msg(m, false);
+            enqueue(msg);
+        });
+
+        if (runqueue_.empty())
+        {
+            return;
+        }
+
+        auto begin_time = time::microsecond();
+
+        //services which still have messages go to the back of runqueue, leftover is handled in next round
+        for (auto n = runqueue_.size(); n > 0; --n)
+        {
+            auto id = runqueue_.front();
+            runqueue_.pop_front();
+            //removed or migrated
+            auto s = find_service(id);
+            if (nullptr == s)
+            {
+                continue;
+            }
+
+            if (s->dispatch_messages(quantum_count_, quantum_time_))
+            {
+                runqueue_.push_back(id);
+            }
+        }
+
+        if (cache_uuid_ != 0)
+        {
+            cache_uuid_ = 0;
+            caches_.clear();
+        }
+
+        cpu_time_ += time::microsecond() - begin_time;
+
+        drain_local();
+
+        resume();
+    }
+
+    void worker::drain_local()
+    {
+        if (localq_.empty())
+        {
+            return;
+        }
+
+        auto begin_time = time::microsecond();
+        uint32_t n = 0;
+        while (!localq_.empty())
+        {
+            //ping-pong services can not starve io and timers
+            if (n++ >= LOCAL_DRAIN_LIMIT)
+            {
+                if (!local_posted_)
                 {
-                    cache_uuid_ = 0;
-                    caches_.clear();
+                    local_posted_ = true;
+                    post([this]() {
+                        local_posted_ = false;
+                        drain_local();
+                    });
                 }
+                break;
+            }
+
+            auto msg = std::move(localq_.front());
+            localq_.pop_front();
+
+            if (msg->broadcast())
+            {
+                enqueue(msg);
+                continue;
+            }
+
+            if (msg->responseid() != 0)
+            {
+                handle_one(nullptr, msg);
+                continue;
+            }
+
+            auto s = find_service(msg->receiver());
+            if (nullptr == s)
+            {
+                redirect(msg);
+                continue;
+            }
+
+            //receiver is idle: handle it now. otherwise keep the order behind its mailbox
+            if (s->push_message(msg) && s->dispatch_messages(1, 0))
+            {
+                runqueue_.push_back(s->id());
             }
-            auto difftime = time::millsecond() - begin_time;
-            work_time_ += difftime;
+        }
+
+        cpu_time_ += time::microsecond() - begin_time;
+
+        resume();
+    }
+
+    void worker::resume()
+    {
+        if (runqueue_.empty() || resume_)
+        {
+            return;
+        }
+
+        //let io handlers and timers run between rounds
+        resume_ = true;
+        post([this]() {
+            resume_ = false;
+            handle_messages();
         });
     }
 
     void worker::worker_time(uint32_t sender, uint32_t respid)
     {
         post([this, sender, respid]() {
-            auto cur = time::millsecond();
+            auto cur = time::microsecond();
             auto total_time  = cur - start_time_;
             total_time = total_time == 0 ? 1 : total_time;
 
-            auto percent = static_cast<float>(work_time_) / static_cast<float>(total_time);
+            auto cpu = cpu_time_.load();
+            auto percent = static_cast<float>(cpu - work_time_) / static_cast<float>(total_time);
             auto response_content = moon::format(R"(["worker%d",%.2f])", workerid(), percent*100);
-            server_->make_response(sender,"",response_content, respid);
+            server_->make_response(sender,"",response_content, respid, PTYPE_TEXT);
             start_time_ = cur;
-            work_time_ = 0;
+            work_time_ = cpu;
         });
     }
 
-    void worker::handle_one(service* ser,const message_ptr_t & msg)
+    void worker::queue_wait(uint32_t sender, uint32_t respid)
+    {
+        post([this, sender, respid]() {
+            std::string content;
+            for (auto& it : services_)
+            {
+                if (!content.empty())
+                {
+                    content.append(",");
+                }
+                content.append(it.second->queue_wait_stat(true));
+            }
+            auto response_content = moon::format(R"(["worker%d",[%s]])", workerid(), content.data());
+            server_->make_response(sender, "", response_content, respid, PTYPE_TEXT);
+        });
+    }
+
+    void worker::enqueue(const message_ptr_t & msg)
     {
         if (msg->broadcast())
         {
-            for (auto& it : services_)
+            auto iter = topics_.find(msg->header());
+            if (iter == topics_.end())
             {
-                auto& s = it.second;
-                if (s->ok() && s->id() != msg->sender())
+                return;
+            }
+
+            for (auto id : iter->second)
+            {
+                auto s = find_service(id);
+                if (nullptr != s && s->ok() && id != msg->sender() && s->push_message(msg))
                 {
-                    s->handle_message(msg);
+                    runqueue_.push_back(id);
                 }
             }
             return;
         }
 
+        auto s = find_service(msg->receiver());
+        if (nullptr == s)
+        {
+            redirect(msg);
+            return;
+        }
+
+        if (s->push_message(msg))
+        {
+            runqueue_.push_back(s->id());
+        }
+    }
+
+    void worker::redirect(const message_ptr_t & msg)
+    {
+        auto out = outgoing_.find(msg->receiver());
+        if (out != outgoing_.end())
+        {
+            //service is migrating from this worker, keep the order behind its mailbox
+            out->second->push_message(msg);
+            return;
+        }
+
+        if (server_->route(msg->receiver()) == this)
+        {
+            //service is migrating to this worker
+            incoming_[msg->receiver()].push_back(msg);
+            return;
+        }
+        //service migrated to other worker or dead
+        server_->send_message(msg);
+    }
+
+    void worker::handle_one(service* ser,const message_ptr_t & msg)
+    {
+        if (msg->broadcast())
+        {
+            enqueue(msg);
+            resume();
+            return;
+        }
+
         if (nullptr == ser || ser->id() != msg->receiver())
         {
             ser = find_service(msg->receiver());
             if (nullptr == ser)
             {
-                server_->make_response(msg->sender(), "error", "call dead service.", msg->responseid(), PTYPE_ERROR);
+                redirect(msg);
                 return;
             }
         }
@@ -10,8 +10,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #pragma once
 #include "config.h"
 #include "asio.hpp"
-#include "common/concurrent_queue.hpp"
-#include "common/spinlock.hpp"
+#include "common/mpsc_queue.hpp"
 
 namespace moon
 {
@@ -20,8 +19,6 @@ namespace moon
     class worker
     {
     public:
-        static const uint16_t MAX_SERVICE_NUM = 0xFFFF;
-
         friend class server;
 
         worker();
@@ -38,9 +35,18 @@ namespace moon
 
         asio::io_service& io_service();
 
+        uint8_t workerid() const;
+
         uint32_t make_cache(const buffer_ptr_t & buf);
 
         buffer_ptr_t  get_cache(uint32_t cacheid);
+
+        //topic table is only accessed by this worker's thread
+        void subscribe(uint32_t serviceid, const std::string& topic);
+
+        void unsubscribe(uint32_t serviceid, const std::string& topic);
+
+        bool has_subscriber() const;
     private:
         void run();
 
@@ -56,14 +62,10 @@ namespace moon
             ios_.post(std::forward<THandler>(h));
         }
 
-        uint32_t make_serviceid();
-
         void add_service(const service_ptr_t& s);
 
         void send(const message_ptr_t& msg,bool immediately =false);
     
-        uint8_t workerid() const;
-
         void workerid(uint8_t id);
 
         void set_server(server* v);
@@ -72,38 +74,111 @@ namespace moon
 
         bool shared() const;
 
+        void event_wakeup(bool v);
+
+        //message budget and time budget(microseconds) of a service per round, 0 means no limit
+        void quantum(uint32_t count, int64_t time);
+
         service* find_service(uint32_t serviceid) const;
 
         uint32_t servicenum() const;
 
-        std::function<void(uint32_t)> on_service_remove;
+        //accumulated busy time in microseconds, never reset
+        int64_t cpu_time() const;
+
+        //recent cpu usage in percent, smoothed over the last few LOAD_SAMPLE_INTERVAL
+        int32_t load() const;
+
+        //move the busiest movable service(with its mailbox) to worker target
+        void migrate_to(worker* target);
+
+        std::function<void(uint32_t, bool)> on_service_remove;
     private:
         void start();
 
         void update();
 
+        //called by server thread, period: microseconds since last sample
+        void sample_load(int64_t period);
+
+        //move messages to services' mailbox, then every runnable service gets one quantum
+        void handle_messages();
+
+        //schedule another round if there are runnable services left
+        void resume();
+
+        //handle messages sent by services of this worker, without locking and without waiting for next round
+        void drain_local();
+
         void worker_time(uint32_t sender, uint32_t respid);
 
+        void queue_wait(uint32_t sender, uint32_t respid);
+
         void handle_one(service* ser,const message_ptr_t& msg);
+
+        void enqueue(const message_ptr_t& msg);
+
+        //receiver is not in this worker
+        void redirect(const message_ptr_t& msg);
+
+        void accept_service(const service_ptr_t& s);
+
+        void insert_service(const service_ptr_t& s);
+
+        void erase_service(std::unordered_map<uint32_t, service_ptr_t>::iterator iter);
+
+        //messages arrived before the service was added, and removal requested before it
+        void take_incoming(const service_ptr_t& s);
     private:
+        struct pending_remove
+        {
+            uint32_t sender;
+            uint32_t respid;
+            bool crashed;
+        };
+
         std::atomic_bool shared_;
         bool exit_;
         std::atomic_bool stoped_;
+        std::atomic_bool wakeup_;
+        bool event_wakeup_;
+        bool resume_;
+        bool local_posted_;
         uint8_t workerid_;
+        uint32_t quantum_count_;
+        int64_t quantum_time_;
         uint32_t cache_uuid_;
-        std::atomic<uint16_t> serviceuid_;
         std::atomic<uint32_t> servicenum_;
 
+        //microseconds
         int64_t start_time_;
         int64_t work_time_;
+        std::atomic<int64_t> cpu_time_;
+        //only touched by server thread
+        int64_t load_mark_;
+        std::atomic<int32_t> load_;
         server*  server_;
         std::thread thread_;
         asio::io_service ios_;
         asio::io_service::work work_;
         std::unordered_map<uint32_t, service_ptr_t> services_;
-        std::vector<message_ptr_t> swapqueue_;
-        sync_queue<message_ptr_t, moon::spin_lock> mqueue_;
+        //indexed by slot index of serviceid, for O(1) lookup
+        std::vector<service*> lookup_;
+        mpsc_queue<message> mqueue_;
+        //runnable services, round robin
+        std::deque<uint32_t> runqueue_;
+        //messages sent from this worker's thread to this worker
+        std::deque<message_ptr_t> localq_;
         std::unordered_map<uint32_t, buffer_ptr_t> caches_;
+        //topic -> subscribers in this worker
+        std::unordered_map<std::string, std::vector<uint32_t>> topics_;
+        std::atomic<uint32_t> topicnum_;
+        //messages for services which are migrating to this worker
+        std::unordered_map<uint32_t, std::vector<message_ptr_t>> incoming_;
+        //services which are migrating to this worker, but removed before they arrive
+        std::unordered_map<uint32_t, pending_remove> removing_;
+        //services which are migrating from this worker, until the handoff
+        std::unordered_map<uint32_t, service_ptr_t> outgoing_;
     };
 };
 
@@ -10,41 +10,72 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #pragma once
 #include "config.h"
 #include "common/buffer.hpp"
+#include "common/block_pool.hpp"
+#include "common/atom_table.hpp"
+#include "common/mpsc_queue.hpp"
 
 namespace moon
 {
-    class  message final
+    class worker;
+    class service;
+
+    //global message header vocabulary, headers are carried as atom ids
+    inline atom_table& header_atoms()
+    {
+        static atom_table atoms;
+        return atoms;
+    }
+
+    class  message final :public mpsc_node
     {
+        friend class worker;
+        friend class service;
     public:
         static buffer_ptr_t create_buffer(size_t capacity = 64, size_t headreserved = BUFFER_HEAD_RESERVED)
         {
             return std::make_shared<buffer>(capacity, headreserved);
         }
 
+        //metadata, header and payload live in one pooled block, payload grows into pooled storage when the block is full
         static message_ptr_t create(size_t capacity = 64, size_t headreserved = BUFFER_HEAD_RESERVED)
         {
-            return std::make_shared<message>(capacity, headreserved);
+            size_t block_size = 0;
+            void* p = block_pool::allocate(sizeof(message) + headreserved + capacity, &block_size);
+            return message_ptr_t(new (p) message(block_size, headreserved));
         }
 
+        //copy the payload
         static message_ptr_t create(const buffer_ptr_t & v)
         {
-            return std::make_shared<message>(v);
-        }
-
-        message(size_t capacity = 64, size_t headreserved = 0)
-        {
-            init();
-            data_ = std::make_shared<buffer>(capacity, headreserved);
-        }
-
-        explicit message(const buffer_ptr_t & v)
-        {
-            init();
-            data_ = v;
+            if (nullptr == v)
+            {
+                return create(0);
+            }
+            auto m = create(v->size());
+            m->buf_.write_back(v->data(), 0, v->size());
+            if (v->check_flag(uint8_t(buffer_flag::pack_size)))
+            {
+                m->buf_.set_flag(uint8_t(buffer_flag::pack_size));
+            }
+            return m;
         }
 
-        ~message()
+        //take the payload, small payloads are copied into the message block, big ones are moved
+        static message_ptr_t create(buffer&& v)
         {
+            if (sizeof(message) + BUFFER_HEAD_RESERVED + v.size() <= block_pool::MAX_BLOCK_SIZE)
+            {
+                auto m = create(v.size());
+                m->buf_.write_back(v.data(), 0, v.size());
+                if (v.check_flag(uint8_t(buffer_flag::pack_size)))
+                {
+                    m->buf_.set_flag(uint8_t(buffer_flag::pack_size));
+                }
+                return m;
+            }
+            auto m = create(0);
+            m->buf_ = std::move(v);
+            return m;
         }
 
         message(const message&) = delete;
@@ -75,12 +106,29 @@ namespace moon
         {
             if (header.size() != 0)
             {
+                header_atom_ = 0;
                 header_ = std::string(header.data(),header.size());
             }       
         }
 
+        //atom from header_atoms(), no string copy
+        void set_header_atom(uint32_t atom)
+        {
+            header_atom_ = atom;
+            header_.clear();
+        }
+
+        uint32_t header_atom() const
+        {
+            return header_atom_;
+        }
+
         const std::string& header() const
         {
+            if (0 != header_atom_)
+            {
+                return header_atoms().name(header_atom_);
+            }
             return header_;
         }
 
@@ -118,47 +166,45 @@ namespace moon
 
         string_view_t bytes() const
         {
-            if (nullptr == data_)
-            {
-                return string_view_t(nullptr, 0);
-            }
-            return string_view_t(reinterpret_cast<const char*>(data_->data()),data_->size());
+            return string_view_t(reinterpret_cast<const char*>(buf_.data()), buf_.size());
         }
 
         string_view_t subbytes(int pos, size_t len = string_view_t::npos) const
         {
-            string_view_t sr(reinterpret_cast<const char*>(data_->data()), data_->size());
+            string_view_t sr(reinterpret_cast<const char*>(buf_.data()), buf_.size());
             return sr.substr(pos, len);
         }
 
         void write_data(string_view_t s)
         {
-            data_->write_back(s.data(), 0, s.size());
+            buf_.write_back(s.data(), 0, s.size());
         }
 
         void write_string(const std::string& s)
         {
-            data_->write_back(s.data(), 0, s.size()+1);
+            buf_.write_back(s.data(), 0, s.size()+1);
         }
 
         const char* data() const
         {
-            return data_->data();
+            return buf_.data();
         }
 
         size_t size() const
         {
-            return data_->size();
+            return buf_.size();
         }
 
-        operator const buffer_ptr_t&() const
+        //share the payload with others(e.g. socket send queue), the message is kept alive by the returned pointer
+        buffer_ptr_t shared_buffer()
         {
-            return data_;
+            message_ptr_t self(this);
+            return buffer_ptr_t(&buf_, [self](buffer*) {});
         }
 
         buffer* get_buffer()
         {
-            return data_.get();
+            return &buf_;
         }
 
         bool broadcast() const
@@ -174,24 +220,24 @@ namespace moon
 
         void* pointer()
         {
-            return data_.get();
+            return &buf_;
         }
 
         void reset()
         {
            init();
            header_.clear();
-           data_->clear();
+           buf_.clear();
         }
 
         uint16_t check_uint16() const
         {
-            if (data_->size() >= sizeof(uint16_t))
+            if (buf_.size() >= sizeof(uint16_t))
             {
-                auto d =data_->data();
-                if (data_->check_flag(uint8_t(buffer_flag::pack_size)))
+                auto d =buf_.data();
+                if (buf_.check_flag(uint8_t(buffer_flag::pack_size)))
                 {
-                    if (data_->size() < 2 * sizeof(uint16_t))
+                    if (buf_.size() < 2 * sizeof(uint16_t))
                     {
                         return 0;
                     }
@@ -203,22 +249,57 @@ namespace moon
         }
 
     private:
+        message(size_t block_size, size_t headreserved)
+            :ref_(0)
+            , block_size_(block_size)
+            , buf_(reinterpret_cast<char*>(this) + sizeof(message), block_size - sizeof(message), headreserved)
+        {
+            init();
+        }
+
+        ~message()
+        {
+        }
+
+        friend void intrusive_ptr_add_ref(message* m)
+        {
+            m->ref_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        friend void intrusive_ptr_release(message* m)
+        {
+            if (m->ref_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                size_t block_size = m->block_size_;
+                m->~message();
+                block_pool::deallocate(m, block_size);
+            }
+        }
+
         void init()
         {
             flag_ = 0;
             sender_ = 0;
             receiver_ = 0;
             responseid_ = 0;
+            header_atom_ = 0;
+            enqueue_time_ = 0;
         }
 
     private:
-        //1-8bit subtype,9-16bit type, 17bit isbroadcast
+        std::atomic<uint32_t> ref_;
+        //1-8bit subtype,9-16bit type, 17bit isbroadcast(published to topic, header is the topic)
         uint32_t flag_;
         uint32_t sender_;
         uint32_t receiver_;
         int32_t responseid_;
+        uint32_t header_atom_;
+        //microseconds, when the message was sent to worker's mailbox
+        int64_t enqueue_time_;
+        size_t block_size_;
+        //string header, used when header_atom_ is 0. short headers stay in the block(small string optimization)
         std::string header_;
-        buffer_ptr_t data_;
+        buffer buf_;
     };
 };
 
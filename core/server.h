@@ -12,9 +12,13 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 namespace moon
 {
     class log;
+    class worker;
+    class io_pool;
     class MOON_EXPORT  server final
     {
     public:
+        friend class worker;
+
         using register_func = service_ptr_t(*)();
 
         server();
@@ -29,6 +33,21 @@ namespace moon
 
         void init(uint8_t worker_num, const std::string& logpath);
 
+        //should be called before init. true: worker wakeup when message arrived, false: handle messages every tick
+        void event_wakeup(bool v);
+
+        //should be called before init. true: idle workers steal services from busy workers
+        void work_steal(bool v);
+
+        //should be called before init. message budget and time budget(microseconds) of a service per round, 0 means no limit
+        void service_quantum(uint32_t count, int64_t time);
+
+        //should be called before init. placement of services created without workerid and without their own placement
+        void service_placement(placement v);
+
+        //should be called before init. number of network io threads, 0: sockets do io in their service's worker
+        void io_threads(uint32_t n);
+
         void run();
 
         void stop();
@@ -37,15 +56,26 @@ namespace moon
 
         size_t servicenum();
 
+        //workerid starts from 1, return nullptr if not found
+        worker* get_worker(uint32_t workerid) const;
+
+        io_pool* iopool() const;
+
         uint32_t new_service(const std::string& service_type, bool unique, bool shareth,int workerid,const std::string& config);
 
+        //workerid has priority over policy. colocate: name of the unique service to share the worker with, implies placement::colocate
+        uint32_t new_service(const std::string& service_type, bool unique, bool shareth, int workerid, const std::string& config, placement policy, const std::string& colocate);
+
         void runcmd(uint32_t sender, const buffer_ptr_t& buf, const std::string& header, int32_t responseid);
 
         void send_message(const message_ptr_t& msg) const;
 
         void send(uint32_t sender, uint32_t receiver, const buffer_ptr_t& buf,const string_view_t& header, int32_t responseid, uint8_t mtype) const;
 
-        void broadcast(uint32_t sender, const message_ptr_t& msg);
+        void send(uint32_t sender, uint32_t receiver, const message_ptr_t& msg, const string_view_t& header, int32_t responseid, uint8_t mtype) const;
+
+        //deliver to services which subscribed topic on every worker, except sender
+        void publish(uint32_t sender, const string_view_t& topic, const message_ptr_t& msg);
 
         bool register_service(const std::string& type, register_func func);
 
@@ -63,6 +93,10 @@ namespace moon
 
         void make_response(uint32_t sender, const string_view_t&, const string_view_t& content, int32_t resp, uint8_t mtype = PTYPE_SOCKET) const;
     private:
+        worker* route(uint32_t serviceid) const;
+
+        void set_route(uint32_t serviceid, worker* w);
+
         struct server_imp;
         server_imp*   imp_;
     };
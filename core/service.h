@@ -43,6 +43,11 @@ namespace moon
         worker* get_worker() const;
 
         void removeself(bool crashed = false);
+
+        //subscribe messages published to topic, see server::publish
+        void subscribe(const std::string& topic);
+
+        void unsubscribe(const std::string& topic);
     protected:
         void set_unique(bool v);
 
@@ -50,6 +55,29 @@ namespace moon
 
         void set_worker(worker* w);
 
+        //service created with workerid or not shared will never migrate to other worker
+        void set_bound(bool v);
+
+        bool movable() const;
+
+        uint32_t handled_messages(bool reset);
+
+        //service's own mailbox, only accessed by the worker which the service belongs to
+        //return true if service becomes runnable
+        bool push_message(const message_ptr_t& msg);
+
+        //dispatch at most max_count messages or max_time microseconds(0 means no limit), return true if mailbox is not empty
+        bool dispatch_messages(uint32_t max_count, int64_t max_time);
+
+        //return true if mailbox is not empty
+        bool reschedule();
+
+        std::deque<message_ptr_t> take_messages();
+
+        std::string queue_wait_stat(bool reset);
+
+        const std::unordered_set<std::string>& topics() const;
+
         virtual bool init(const std::string& config) = 0;
 
         virtual void dispatch(message* msg) = 0;
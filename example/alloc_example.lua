@@ -0,0 +1,63 @@
+local moon = require("moon")
+
+--每轮给自己发送count条消息(每10ms发送batch条)，统计当前worker线程上每条消息的内存池分配次数和堆分配次数
+
+local count = 100000
+local batch = 1000
+local protocol = 'lua'
+local nround = 0
+local maxround = 10
+
+local recv = 0
+
+moon.init(function(config)
+    count = config.count or count
+    protocol = config.protocol or protocol
+    maxround = config.round or maxround
+    batch = config.batch or batch
+    return true
+end)
+
+local function send_batch()
+    if protocol == 'lua' then
+        for _=1,batch do
+            moon.send('lua', moon.sid(), "ALLOC", 1, "123456789")
+        end
+    else
+        for _=1,batch do
+            moon.raw_send('text', moon.sid(), "ALLOC", "123456789", 0)
+        end
+    end
+end
+
+local function send_all()
+    for _=1,count//batch do
+        send_batch()
+        moon.co_wait(10)
+    end
+end
+
+moon.start(function()
+    moon.dispatch(protocol, function()
+        recv = recv + 1
+    end)
+
+    moon.start_coroutine(function()
+        --第一轮预热内存池
+        send_all()
+        local total_allocs, total_heap = 0, 0
+        while nround < maxround do
+            recv = 0
+            local allocs, _, heap_allocs = moon.pool_stats()
+            send_all()
+            local allocs2, hits2, heap_allocs2, _, _, cached = moon.pool_stats()
+            nround = nround + 1
+            total_allocs = total_allocs + (allocs2 - allocs)
+            total_heap = total_heap + (heap_allocs2 - heap_allocs)
+            print(string.format("round %d recv %d pool allocs/send %.2f heap allocs/send %.4f hits %d cached %d bytes",
+                nround, recv, (allocs2 - allocs)/count, (heap_allocs2 - heap_allocs)/count, hits2, cached))
+        end
+        print(string.format("%s payload: pool allocs/send %.2f heap allocs/send %.4f",
+            protocol, total_allocs/(count*maxround), total_heap/(count*maxround)))
+    end)
+end)
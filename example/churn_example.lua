@@ -0,0 +1,36 @@
+local moon = require("moon")
+
+--不断创建和移除agent服务，测试服务创建销毁的吞吐
+
+--每批创建的服务数量
+local nagent = 100
+
+moon.init(function(config)
+    nagent = config.nagent or nagent
+    return true
+end)
+
+moon.start(function()
+    moon.start_coroutine(function()
+        local counter = 0
+        local prev = moon.millsecond()
+        while true do
+            local agents = {}
+            for i=1,nagent do
+                agents[i] = moon.new_service("lua", {name = "churn_agent", file = "churn_example_agent.lua"})
+            end
+
+            for _, id in ipairs(agents) do
+                moon.co_remove_service(id)
+            end
+
+            counter = counter + nagent
+            local now = moon.millsecond()
+            if now - prev >= 1000 then
+                print(string.format("churn %.0f services/s", counter*1000/(now - prev)))
+                counter = 0
+                prev = now
+            end
+        end
+    end)
+end)
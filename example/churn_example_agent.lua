@@ -0,0 +1,4 @@
+local moon = require("moon")
+
+moon.start(function()
+end)
@@ -0,0 +1,97 @@
+local moon = require("moon")
+
+--每个连接的内存占用：服务向自己监听的端口建立count个连接(每个连接在进程内占用两个默认协议的socket：connect端和accept端)
+--统计建立前后进程常驻内存(/proc/self/statm)的增量，输出平均每个连接的字节数。count较大时需要调高ulimit -n
+
+local network = moon.get_component_tcp("network")
+
+local count = 5000
+local ip = "127.0.0.1"
+local port = "12349"
+
+local accepted = 0
+local closed = 0
+
+moon.init(function(config)
+    count = config.count or count
+    ip = config.network.ip
+    port = tostring(config.network.port)
+    return true
+end)
+
+local function rss()
+    local f = io.open("/proc/self/statm")
+    if not f then
+        return nil
+    end
+    local _, pages = f:read("n", "n")
+    f:close()
+    return pages * 4096
+end
+
+local socket_handler = {}
+
+socket_handler[2] = function()
+    accepted = accepted + 1
+end
+
+socket_handler[4] = function()
+    closed = closed + 1
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg:sender(), msg:bytes())
+            end
+        end
+    })
+
+    local client = moon.add_component_tcp("connmem_client")
+
+    moon.start_coroutine(function()
+        collectgarbage("collect")
+        local before = rss()
+        if not before then
+            print("connmem: /proc/self/statm unavailable")
+            return
+        end
+
+        local start = moon.millsecond()
+        local conns = {}
+        for i = 1, count do
+            client:async_connect(ip, port, moon.make_response())
+            local connid, err = coroutine.yield()
+            if not connid then
+                print("connect failed", i, err)
+                break
+            end
+            conns[#conns + 1] = tonumber(connid)
+        end
+
+        while accepted < #conns do
+            moon.co_wait(10)
+        end
+        local cost = moon.millsecond() - start
+        collectgarbage("collect")
+        local after = rss()
+        local n = #conns * 2
+        print(string.format("connmem: %d connections in %d ms, rss %.1f MB -> %.1f MB, %.0f bytes/connection",
+            n, cost, before/1048576, after/1048576, (after - before)/n))
+
+        for _, connid in ipairs(conns) do
+            client:close(connid)
+        end
+        while closed < n do
+            moon.co_wait(10)
+        end
+        collectgarbage("collect")
+        print(string.format("connmem: all closed, rss %.1f MB", rss()/1048576))
+    end)
+end)
@@ -0,0 +1,19 @@
+local moon = require("moon")
+
+--与被大量消息淹没的服务处于同一个worker，每10ms给自己发送一条消息，观察各服务的消息排队时间
+
+moon.start(function()
+    moon.dispatch('text',function(msg)
+    end)
+
+    moon.repeated(10, -1, function()
+        moon.raw_send('text', moon.sid(), "PING", "", 0)
+    end)
+
+    moon.start_coroutine(function()
+        while true do
+            moon.co_wait(1000)
+            print(moon.co_query_queuewait(1))
+        end
+    end)
+end)
@@ -0,0 +1,22 @@
+local moon = require("moon")
+
+--多个worker线程同时向一个服务发送消息，测试mailbox的竞争开销
+
+local counter = 0
+
+moon.start(function()
+    moon.dispatch('text',function(msg)
+        counter = counter + 1
+    end)
+
+    local prev = moon.millsecond()
+    moon.repeated(1000, -1, function()
+        local now = moon.millsecond()
+        if now == prev then
+            return
+        end
+        print(string.format("fanin recv %.0f msg/s", counter*1000/(now - prev)))
+        counter = 0
+        prev = now
+    end)
+end)
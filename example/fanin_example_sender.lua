@@ -0,0 +1,21 @@
+local moon = require("moon")
+
+local receiver
+
+--每10ms发送的消息数量
+local nbatch = 200
+
+moon.init(function(config)
+    nbatch = config.nbatch or nbatch
+    return true
+end)
+
+moon.start(function()
+    receiver = moon.unique_service("fanin_example_receiver")
+
+    moon.repeated(10, -1, function()
+        for _=1,nbatch do
+            moon.raw_send('text', receiver, "FANIN", "123456789", 0)
+        end
+    end)
+end)
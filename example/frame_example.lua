@@ -0,0 +1,52 @@
+local moon = require("moon")
+
+--网络接收吞吐，每秒输出收到的包数量和字节数。默认协议配合frameclient.py使用，websocket协议配合wsclient.py使用
+
+local network = moon.get_component_tcp("network")
+
+local recv = 0
+local bytes = 0
+local conns = 0
+
+local socket_handler = {}
+
+socket_handler[2] = function(msg)
+    conns = conns + 1
+    print("accept ", msg:sender(), msg:bytes())
+end
+
+socket_handler[3] = function(msg)
+    recv = recv + 1
+    bytes = bytes + msg:size()
+end
+
+socket_handler[4] = function(msg)
+    conns = conns - 1
+    print("close ", msg:sender(), msg:bytes())
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg)
+            end
+        end
+    })
+
+    local prev = moon.millsecond()
+    moon.repeated(1000, -1, function()
+        local now = moon.millsecond()
+        if conns > 0 then
+            print(string.format("frame recv %.0f packets/s, %.1f MB/s", recv*1000/(now - prev), bytes*1000/(now - prev)/1048576))
+        end
+        recv = 0
+        bytes = 0
+        prev = now
+    end)
+end)
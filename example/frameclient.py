@@ -0,0 +1,38 @@
+# -*- coding:utf-8 -*-
+# usage: python frameclient.py [frame_size] [connections] [seconds]
+# 持续发送 2字节大端长度 + frame_size字节数据 的包，配合 ./moon 14 测试服务端接收吞吐
+import socket
+import struct
+import sys
+import threading
+import time
+
+HOST = "127.0.0.1"
+PORT = 12347
+
+frame_size = int(sys.argv[1]) if len(sys.argv) > 1 else 64
+nconn = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+seconds = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+
+frame = struct.pack(">H", frame_size) + b"x" * frame_size
+# 每次sendall发送约64KB
+chunk = frame * max(1, 65536 // len(frame))
+
+
+def run():
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((HOST, PORT))
+    end = time.time() + seconds
+    sent = 0
+    while time.time() < end:
+        s.sendall(chunk)
+        sent += len(chunk) // len(frame)
+    s.close()
+    print("sent %d packets, %.0f packets/s" % (sent, sent / float(seconds)))
+
+
+threads = [threading.Thread(target=run) for _ in range(nconn)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
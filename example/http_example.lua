@@ -0,0 +1,55 @@
+local moon = require("moon")
+
+--http协议(protocol 3)：每个完整的请求是一条socket_recv消息(请求行、头部和已解码的body)，keep-alive连接上的pipeline请求按顺序到达
+--配合httpbench.py使用，/echo返回请求的body，其它路径返回HelloWorld
+
+local network = moon.get_component_tcp("network")
+
+local request = moon.http_request.new()
+
+local HEADERS = "Content-Type: text/plain\r\n"
+
+local requests = 0
+
+local socket_handler = {}
+
+socket_handler[3] = function(msg)
+    local connid = msg:sender()
+    if request:parse_message(msg) == -1 then
+        network:send_http(connid, 400, "", "", false)
+        return
+    end
+
+    requests = requests + 1
+    local keepalive = request:keep_alive()
+    if request.path == "/echo" then
+        network:send_http(connid, 200, HEADERS, request.body, keepalive)
+    else
+        network:send_http(connid, 200, HEADERS, "HelloWorld", keepalive)
+    end
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg)
+            end
+        end
+    })
+
+    local prev = moon.millsecond()
+    moon.repeated(1000, -1, function()
+        local now = moon.millsecond()
+        if requests > 0 then
+            print(string.format("http %.0f requests/s", requests*1000/(now - prev)))
+        end
+        requests = 0
+        prev = now
+    end)
+end)
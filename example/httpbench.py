@@ -0,0 +1,101 @@
+# -*- coding:utf-8 -*-
+# usage: python httpbench.py [connections] [seconds] [pipeline] [path]
+# 类似wrk：connections个keep-alive连接，每个连接一次发送pipeline个GET请求，收齐响应后再发下一批。配合 ./moon 21 使用
+# 输出每秒请求数和每批请求的延迟分布
+import selectors
+import socket
+import sys
+import time
+
+HOST = "127.0.0.1"
+PORT = 12352
+
+nconn = int(sys.argv[1]) if len(sys.argv) > 1 else 16
+seconds = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+pipeline = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+path = sys.argv[4] if len(sys.argv) > 4 else "/"
+
+request = ("GET %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n" % (path, HOST, PORT)).encode()
+batch = request * pipeline
+
+
+class Conn(object):
+    def __init__(self, sel):
+        self.sock = socket.create_connection((HOST, PORT))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sock.setblocking(False)
+        self.buf = b""
+        self.pending = 0
+        self.start = 0.0
+        sel.register(self.sock, selectors.EVENT_READ, self)
+
+    def send(self):
+        self.sock.sendall(batch)
+        self.pending = pipeline
+        self.start = time.time()
+
+    # 解析完整的响应，返回个数
+    def parse(self):
+        n = 0
+        while True:
+            end = self.buf.find(b"\r\n\r\n")
+            if end < 0:
+                break
+            head = self.buf[:end]
+            length = 0
+            for line in head.split(b"\r\n")[1:]:
+                k, _, v = line.partition(b":")
+                if k.strip().lower() == b"content-length":
+                    length = int(v.strip())
+            total = end + 4 + length
+            if len(self.buf) < total:
+                break
+            if not head.startswith(b"HTTP/1.1 200"):
+                raise RuntimeError("bad response: %r" % head)
+            self.buf = self.buf[total:]
+            n += 1
+        return n
+
+
+def main():
+    sel = selectors.DefaultSelector()
+    conns = [Conn(sel) for _ in range(nconn)]
+    latencies = []
+    done = 0
+    begin = time.time()
+    end = begin + seconds
+    for c in conns:
+        c.send()
+
+    active = nconn
+    while active > 0:
+        for key, _ in sel.select(1):
+            c = key.data
+            data = c.sock.recv(65536)
+            if not data:
+                raise RuntimeError("connection closed")
+            c.buf += data
+            n = c.parse()
+            c.pending -= n
+            done += n
+            if c.pending == 0:
+                latencies.append(time.time() - c.start)
+                if time.time() < end:
+                    c.send()
+                else:
+                    sel.unregister(c.sock)
+                    c.sock.close()
+                    active -= 1
+
+    cost = time.time() - begin
+    latencies.sort()
+
+    def pct(p):
+        return latencies[min(len(latencies) - 1, int(len(latencies) * p))] * 1000
+
+    print("%d connections, pipeline %d, %d requests in %.2fs, %.0f requests/s" % (nconn, pipeline, done, cost, done / cost))
+    print("latency(ms) avg %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f" % (
+        sum(latencies) / len(latencies) * 1000, pct(0.5), pct(0.9), pct(0.99), latencies[-1] * 1000))
+
+
+main()
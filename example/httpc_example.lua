@@ -0,0 +1,112 @@
+local moon = require("moon")
+local httpc = require("moon.httpc")
+
+--http client：concurrency个协程向http_example(protocol 3)共发送count个GET请求
+--分别测试连接池(keep-alive复用)、连接池+pipeline、每个请求新建连接(tcp custom协议,Connection: close)，输出请求数/秒和使用的连接数
+
+local host = "127.0.0.1"
+local port = "12353"
+local count = 10000
+local concurrency = 50
+local pipeline = 16
+
+moon.init(function(config)
+    host = config.host or host
+    port = tostring(config.port or port)
+    count = config.count or count
+    concurrency = config.concurrency or concurrency
+    pipeline = config.pipeline or pipeline
+    return true
+end)
+
+--n个协程并发执行fn(i),全部结束后返回
+local function parallel(n, fn)
+    local co = coroutine.running()
+    local remain = n
+    for i = 1, n do
+        moon.start_coroutine(function()
+            fn(i)
+            remain = remain - 1
+            if remain == 0 then
+                coroutine.resume(co)
+            end
+        end)
+    end
+    coroutine.yield()
+end
+
+local function bench(total, fn)
+    local failed = 0
+    local start = moon.millsecond()
+    parallel(concurrency, function(i)
+        for _ = 1, total // concurrency do
+            if not fn(i) then
+                failed = failed + 1
+            end
+        end
+    end)
+    local cost = moon.millsecond() - start
+    return cost, failed
+end
+
+local function run_httpc(client, name)
+    local url = "http://"..host..":"..port.."/"
+    local cost, failed = bench(count, function()
+        local response = client:get(url)
+        return response and response.status_code == 200 and response.body == "HelloWorld"
+    end)
+    print(string.format("%s: %d requests %.0f requests/s, %d failed, %d connections",
+        name, count, count*1000/math.max(cost, 1), failed, client:connections()))
+end
+
+local function run_baseline(total)
+    local sock = moon.add_component_tcp("baseline")
+    sock:setprotocol(1)
+    local request = "GET / HTTP/1.1\r\nHost: "..host.."\r\nConnection: close\r\n\r\n"
+    local cost, failed = bench(total, function()
+        local respid = moon.make_response()
+        sock:async_connect(host, port, respid)
+        local connid = coroutine.yield()
+        if not connid then
+            return false
+        end
+        connid = tonumber(connid)
+        sock:send(connid, request)
+        respid = moon.make_response()
+        sock:read(connid, 0, 2, respid)
+        local head = coroutine.yield()
+        local len = head and tonumber(head:match("[Cc]ontent%-[Ll]ength: *(%d+)"))
+        local body
+        if len then
+            respid = moon.make_response()
+            sock:read(connid, len, 0, respid)
+            body = coroutine.yield()
+        end
+        sock:close(connid)
+        return body == "HelloWorld"
+    end)
+    print(string.format("connection per request: %d requests %.0f requests/s, %d failed, %d connections",
+        total, total*1000/math.max(cost, 1), failed, total))
+end
+
+moon.start(function()
+    moon.start_coroutine(function()
+        --等待http_example启动监听
+        moon.co_wait(100)
+
+        local client = httpc.new()
+        client:settimeout(5)
+        local response, err, reason = client:post("http://"..host..":"..port.."/echo", "hello")
+        assert(response and response.body == "hello", tostring(err)..tostring(reason))
+        print("echo", response.status_code, response.reason, response:header("Content-Type"), response.body)
+
+        run_httpc(client, "keep-alive pool")
+
+        local pipelined = httpc.new()
+        pipelined:setmaxconn(2)
+        pipelined:setpipeline(pipeline)
+        run_httpc(pipelined, "pipeline "..pipeline)
+
+        run_baseline(count // 5)
+    end)
+end)
@@ -2,7 +2,8 @@
 -- {
 --     protocol_default,
 --     protocol_custom,
---     protocol_websocket
+--     protocol_websocket,
+--     protocol_http
 -- };
 
 -- enum class socket_data_type :std::uint8_t
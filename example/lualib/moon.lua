@@ -66,9 +66,18 @@ local protocol = {}
 
 local watching_service = {}
 local watching_response = {}
+local watching_exit = {}
 
 local waitallco = {}
 
+--订阅服务的退出通知,服务退出时,等待它回应的协程会被唤醒
+local function watch_exit(serviceid)
+    if not watching_exit[serviceid] then
+        watching_exit[serviceid] = true
+        core.subscribe("exit." .. serviceid)
+    end
+end
+
 local function co_resume(co, ...)
     local ok, err = _co_resume(co, ...)
     if not ok then
@@ -158,6 +167,30 @@ end
 
 core.set_dispatch(_default_dispatch)
 
+--header转换为atom(整数id),消息只携带id,接收方msg:header()得到共享的短字符串
+--atom表是全局的且不会释放，每个服务最多转换max_header_atoms个不同的header，动态生成的header超出后使用字符串
+--过长的header或者atom表已满时core.atom返回0，同样缓存，使用字符串
+local max_header_atoms = 256
+local header_atoms = {}
+local header_atom_count = 0
+
+local function to_atom(header)
+    if type(header) ~= "string" then
+        return 0
+    end
+    local atom = header_atoms[header]
+    if atom then
+        return atom
+    end
+    if header_atom_count >= max_header_atoms then
+        return 0
+    end
+    atom = core.atom(header)
+    header_atoms[header] = atom
+    header_atom_count = header_atom_count + 1
+    return atom
+end
+
 --[[
     向指定服务发送消息,消息内容会根据协议类型进行打包
 	@param PTYPE:协议类型
@@ -175,7 +208,7 @@ function moon.send(PTYPE, receiver, header, ...)
         print("moon.send send to a exited service")
         return false
     end
-    return core.send(sid_, receiver, p.pack(...), header, 0, p.PTYPE)
+    return core.send(sid_, receiver, p.pack(...), header, 0, p.PTYPE, to_atom(header))
 end
 
 --[[
@@ -199,12 +232,39 @@ function moon.raw_send(PTYPE, receiver, header, data, responseid)
 	if not responseid then
 		responseid = moon.make_response()
 		watching_response[responseid] = receiver
+		watch_exit(receiver)
 	end
 
-	core.send(sid_, receiver, data, header, responseid, p.PTYPE)
+	core.send(sid_, receiver, data, header, responseid, p.PTYPE, to_atom(header))
 	return responseid
 end
 
+--[[
+    订阅主题,其它服务moon.publish到这个主题的消息会发送给当前服务,消息的header为主题名
+    @param topic:主题名 string
+]]
+function moon.subscribe(topic)
+    core.subscribe(topic)
+end
+
+function moon.unsubscribe(topic)
+    core.unsubscribe(topic)
+end
+
+--[[
+    向主题发布消息,只有订阅了这个主题的服务会收到,发布者自己不会收到
+    @param PTYPE:协议类型
+    @param topic:主题名 string
+    @param ...:消息内容
+]]
+function moon.publish(PTYPE, topic, ...)
+    local p = protocol[PTYPE]
+    if not p then
+        error(string.format("moon publish unknown PTYPE[%s] message", PTYPE))
+    end
+    core.publish(sid_, topic, p.pack(...), p.PTYPE)
+end
+
 --[[
     获取当前的服务id
 	@return int
@@ -219,15 +279,19 @@ end
     @param config 服务的启动配置，数据类型table, 可以用来向服务传递初始化配置(moon.init)
     @param unique 是否是唯一服务，唯一服务可以用moon.unique_service(name) 查询服务id
 	@param shared 可选，是否共享工作者线程，默认true
-	@workerid 可选，工作者线程ID,在指定工作者线程创建该服务。默认0,服务将轮询加入工作者线程中
+	@workerid 可选，工作者线程ID,在指定工作者线程创建该服务。默认0,服务按放置策略加入工作者线程中
 	@return int 返回所创建的服务ID, 0代表创建失败
+    config.placement 可选，放置策略 round_robin,least_cpu,least_services,colocate，默认使用服务器的placement配置
+    config.colocate 可选，唯一服务名，和该服务放在同一个工作者线程
 ]]
 function moon.new_service(stype, config, unique, shared, workerid)
     unique = unique or false
     shared = shared or true
     workerid = workerid or 0
+    local placement = config.placement or ""
+    local colocate = config.colocate or ""
     config = json_encode(config)
-    return core.new_service(stype, unique, shared, workerid, config)
+    return core.new_service(stype, unique, shared, workerid, config, placement, colocate)
 end
 
 --[[
@@ -262,6 +326,19 @@ function moon.query_worktime(workerid, bco)
     core.runcmd(sid_, "", header, respid)
 end
 
+--[[
+	查询worker上每个服务的消息排队时间(微秒)，查询后统计清零
+	返回json字符串, 每个服务包含 name,serviceid,count(消息数),avg(平均排队时间),max(最大排队时间),queued(当前排队消息数)
+]]
+function moon.query_queuewait(workerid, bco)
+    local header = "queuewait." .. workerid
+    local respid = 0
+    if bco then
+        respid = make_response()
+    end
+    core.runcmd(sid_, "", header, respid)
+end
+
 --[[
 	根据服务name获取服务id,注意只能查询创建时unique配置为true的服务
 ]]
@@ -381,9 +458,7 @@ end
 ------------------------------------------
 
 function moon.co_remove_service(serviceid)
-    local co = co_running()
-    moon.remove_service(serviceid, co)
-    return co_yield()
+    return moon.remove_service(serviceid, true)
 end
 
 function moon.co_query_worktime(workerid)
@@ -392,6 +467,12 @@ function moon.co_query_worktime(workerid)
     return co_yield()
 end
 
+function moon.co_query_queuewait(workerid)
+    local co = co_running()
+    moon.query_queuewait(workerid, co)
+    return co_yield()
+end
+
 --[[
 	send-response 形式调用，发送消息附带一个responseid，对方收到后把
 	responseid发送回来，必须调用moon.response应答.
@@ -413,6 +494,7 @@ function moon.co_call(PTYPE, receiver, ...)
 
     local responseid = make_response()
     watching_response[responseid] = receiver
+    watch_exit(receiver)
 
 	core.send(sid_, receiver, p.pack(...), nil, responseid, p.PTYPE)
     return co_yield()
@@ -535,19 +617,24 @@ reg_protocol {
     dispatch = function(msg, _)
         local sender = msg:sender()
         local header = msg:header()
-        if header == "exit" then
+        if watching_exit[sender] and header == "exit." .. sender then
             local data = msg:bytes()
             watching_service[sender] = true
+            watching_exit[sender] = nil
+            core.unsubscribe(header)
+            local cos = {}
             for k, v in pairs(watching_response) do
                 if v == sender then
-                    local co = resplistener[k]
-                    if co then
-                        co_resume(co, false, data)
+                    watching_response[k] = nil
+                    if resplistener[k] then
+                        cos[#cos + 1] = resplistener[k]
                         resplistener[k] = nil
-                        return
                     end
                 end
             end
+            for _, co in ipairs(cos) do
+                co_resume(co, false, data)
+            end
         end
         return true
     end
@@ -0,0 +1,101 @@
+--协程http client封装,连接池、pipeline和响应解析在C++ http_client组件中完成
+
+local moon  = require("moon")
+
+local co_yield      = coroutine.yield
+local make_response = moon.make_response
+
+local httpc = {}
+
+httpc.__index = httpc
+
+local n = 0
+function httpc.new()
+    n = n + 1
+    local tb = {}
+    tb.client = moon.add_component_http("component_http"..tostring(n))
+    return setmetatable(tb, httpc)
+end
+
+--每个host:port的最大连接数
+function httpc:setmaxconn(v)
+    self.client:setmaxconn(v)
+end
+
+--一个连接上未收到响应的最大请求数,1表示不使用pipeline
+function httpc:setpipeline(v)
+    self.client:setpipeline(v)
+end
+
+--请求超时(秒),0表示不超时
+function httpc:settimeout(v)
+    self.client:settimeout(v)
+end
+
+function httpc:setmaxbody(v)
+    self.client:setmaxbody(v)
+end
+
+--当前打开(包括正在连接)的连接数
+function httpc:connections()
+    return self.client:connections()
+end
+
+--http://host[:port]/path?query
+local function parse_url(url)
+    local host, port, path = url:match("^http://([^:/]+):?(%d*)(.*)$")
+    if not host then
+        return nil
+    end
+    if port == "" then
+        port = "80"
+    end
+    if path == "" then
+        path = "/"
+    end
+    return host, port, path
+end
+
+local function format_headers(headers)
+    if not headers then
+        return ""
+    end
+    local t = {}
+    for k, v in pairs(headers) do
+        t[#t+1] = k..": "..tostring(v).."\r\n"
+    end
+    return table.concat(t)
+end
+
+--[[
+    发送请求并等待响应(必须在协程中调用)
+    成功返回moon.http_response对象(status_code,reason,body,header(name))
+    失败返回nil,err("timeout","closed","error"),reason
+]]
+function httpc:request(method, url, body, headers)
+    local host, port, path = parse_url(url)
+    if not host then
+        return nil, "error", "unsupported url "..tostring(url)
+    end
+    local respid = make_response()
+    self.client:request(method, host, port, path, format_headers(headers), body or "", respid)
+    local data, err, reason = co_yield()
+    if not data then
+        return nil, err, reason
+    end
+    local response = moon.http_response.new()
+    if response:parse(data) == -1 then
+        return nil, "error", "bad response"
+    end
+    return response
+end
+
+function httpc:get(url, headers)
+    return self:request("GET", url, nil, headers)
+end
+
+function httpc:post(url, body, headers)
+    return self:request("POST", url, body, headers)
+end
+
+return httpc
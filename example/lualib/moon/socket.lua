@@ -51,6 +51,18 @@ function session:send(data)
     return self.sock:send(self.connid,data,false)
 end
 
+--等待发送队列的字节数降到低水位(network配置send_low)以下
+function session:co_wait_writable()
+    local respid = make_response()
+    self.sock:wait_writable(self.connid,respid)
+    return co_yield()
+end
+
+--已排队等待发送的字节数
+function session:queued_bytes()
+    return self.sock:queued_bytes(self.connid)
+end
+
 function session:close()
     assert(self.connid,"attemp close an invalid session")
     local ret = self.sock:close(self.connid)
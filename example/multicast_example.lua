@@ -0,0 +1,90 @@
+local moon = require("moon")
+
+--组播：服务向自己建立count个连接，每轮向所有accept的连接推送同一条size字节的消息
+--分别用count次send和一次multicast发送，输出发送调用的cpu耗时和全部连接收到消息的耗时。count较大时需要调高ulimit -n
+
+local network = moon.get_component_tcp("network")
+
+local count = 2000
+local size = 256
+local maxround = 5
+local ip = "127.0.0.1"
+local port = "12351"
+
+local accepted = {}
+local recv = 0
+
+moon.init(function(config)
+    count = config.count or count
+    size = config.size or size
+    maxround = config.round or maxround
+    ip = config.network.ip
+    port = tostring(config.network.port)
+    return true
+end)
+
+local socket_handler = {}
+
+socket_handler[2] = function(connid)
+    accepted[#accepted + 1] = connid
+end
+
+socket_handler[3] = function()
+    recv = recv + 1
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg:sender())
+            end
+        end
+    })
+
+    local client = moon.add_component_tcp("multicast_client")
+    local data = string.rep("x", size)
+
+    local function round(name, fn)
+        recv = 0
+        local start = moon.millsecond()
+        local c = os.clock()
+        fn()
+        local cost = os.clock() - c
+        while recv < #accepted do
+            moon.co_wait(1)
+        end
+        print(string.format("%-9s %d connections: call %.2f ms(cpu), all received %d ms", name, #accepted, cost*1000, moon.millsecond() - start))
+    end
+
+    moon.start_coroutine(function()
+        for i = 1, count do
+            client:async_connect(ip, port, moon.make_response())
+            local connid, err = coroutine.yield()
+            if not connid then
+                print("connect failed", i, err)
+                break
+            end
+        end
+
+        while #accepted < count do
+            moon.co_wait(10)
+        end
+
+        for _ = 1, maxround do
+            round("send", function()
+                for _, connid in ipairs(accepted) do
+                    network:send(connid, data)
+                end
+            end)
+            round("multicast", function()
+                network:multicast(accepted, data)
+            end)
+        end
+    end)
+end)
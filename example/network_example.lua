@@ -12,7 +12,10 @@ local socket_handler = {}
 --     socket_recv = 3,
 --     socket_close =4,
 --     socket_error = 5,
---     socket_logic_error = 6
+--     socket_logic_error = 6,
+--     socket_send_high = 7,
+--     socket_send_low = 8,
+--     socket_recv_more = 9
 -- };
 
 socket_handler[1] = function(sessionid, data)
@@ -25,12 +28,31 @@ end
 
 local response = string.pack("H",2)
 
+--websocket配置了stream_size时，大消息分段到达：若干个socket_recv_more，最后一段是socket_recv
+local parts = {}
+
+socket_handler[9] = function(sessionid, data)
+	local t = parts[sessionid]
+	if not t then
+		t = {}
+		parts[sessionid] = t
+	end
+	t[#t+1] = data
+end
+
 socket_handler[3] = function(sessionid, data)
+	local t = parts[sessionid]
+	if t then
+		t[#t+1] = data
+		data = table.concat(t)
+		parts[sessionid] = nil
+	end
 	network:send(sessionid, response..data)
 	--print("recv", data)
 end
 
 socket_handler[4] = function(sessionid, data)
+	parts[sessionid] = nil
 	print("close ",sessionid, data)
 end
 
@@ -0,0 +1,34 @@
+local moon = require("moon")
+
+--同一个worker上的两个服务互相发送消息，每秒输出往返次数和平均往返延迟(微秒)
+
+local peer_name
+local peer
+local count = 0
+
+moon.init(function(config)
+    peer_name = config.peer
+    return true
+end)
+
+moon.start(function()
+    moon.dispatch('lua', function(msg, p)
+        local sender = msg:sender()
+        count = count + 1
+        moon.send('lua', sender, "PING", p.unpack(msg))
+    end)
+
+    if not peer_name then
+        return
+    end
+
+    peer = moon.unique_service(peer_name)
+    moon.send('lua', peer, "PING", 1)
+
+    moon.repeated(1000, -1, function()
+        if count > 0 then
+            print(string.format("round trips %d avg %.1f us", count, 1000000/count))
+        end
+        count = 0
+    end)
+end)
@@ -0,0 +1,46 @@
+local moon = require("moon")
+
+--服务放置策略示例
+--busy服务每10ms占用约8ms cpu, 1秒后按不同的placement创建agent服务,
+--从日志 [WORKER n] new service [name:id] 可以看到每个服务被放到了哪个worker:
+--least_cpu 避开busy所在的worker, least_services 放到服务最少的worker, colocate 和busy放到同一个worker
+
+local role = 'main'
+local nagent = 6
+
+moon.init(function(config)
+    role = config.role or role
+    nagent = config.nagent or nagent
+    return true
+end)
+
+local function burn(ms)
+    local t = moon.millsecond()
+    while moon.millsecond() - t < ms do
+    end
+end
+
+moon.start(function()
+    if role == 'busy' then
+        moon.repeated(10, -1, function()
+            burn(8)
+        end)
+        return
+    end
+
+    if role == 'agent' then
+        return
+    end
+
+    moon.start_coroutine(function()
+        --等待worker负载采样
+        moon.co_wait(1000)
+        for _, policy in ipairs({"least_cpu", "least_services", "round_robin"}) do
+            for _=1,nagent do
+                moon.new_service("lua", {name = policy.."_agent", file = "placement_example.lua", role = "agent", placement = policy})
+            end
+        end
+        moon.new_service("lua", {name = "colocate_agent", file = "placement_example.lua", role = "agent", colocate = "placement_example_busy"})
+        print("placement example done, see [WORKER n] new service logs")
+    end)
+end)
@@ -0,0 +1,10 @@
+local moon = require("moon")
+
+local counter = 0
+
+moon.start(function()
+    moon.repeated(1000, -1, function()
+        counter = counter + 1
+        moon.publish('lua', "news", "hello", counter)
+    end)
+end)
@@ -0,0 +1,22 @@
+local moon = require("moon")
+
+--订阅了主题的服务才会收到发布的消息，header为主题名
+
+local subscribe = true
+
+moon.init(function(config)
+    subscribe = config.subscribe
+    if subscribe then
+        moon.subscribe("news")
+    end
+    return true
+end)
+
+moon.start(function()
+    moon.dispatch('lua',function(msg,p)
+        if not subscribe then
+            error("receive message without subscribe")
+        end
+        print(moon.name(), "recv", msg:header(), p.unpack(msg))
+    end)
+end)
@@ -0,0 +1,77 @@
+local moon = require("moon")
+
+--发送背压示例：客户端连接后服务端持续发送数据，客户端读取很慢时发送队列达到高水位
+--block策略下生产者等待队列降到低水位后继续发送，drop策略丢弃数据，close策略关闭连接
+
+local network = moon.get_component_tcp("network")
+
+local chunk = string.rep("x", 4096)
+
+local socket_handler = {}
+
+local conns = {}
+
+local function produce(connid)
+    moon.start_coroutine(function()
+        local sent, dropped = 0, 0
+        while conns[connid] do
+            for _=1,16 do
+                if network:send(connid, chunk) then
+                    sent = sent + 1
+                else
+                    dropped = dropped + 1
+                end
+            end
+            if network:queued_bytes(connid) >= 1024*1024 then
+                local respid = moon.make_response()
+                network:wait_writable(connid, respid)
+                local queued, err = coroutine.yield()
+                if not queued then
+                    print("wait_writable failed", err)
+                    break
+                end
+            else
+                moon.co_wait(1)
+            end
+        end
+        print(string.format("producer %d stop, sent %d dropped %d", connid, sent, dropped))
+    end)
+end
+
+socket_handler[2] = function(sessionid, data)
+    print("accept ", sessionid, data)
+    conns[sessionid] = true
+    produce(sessionid)
+end
+
+socket_handler[4] = function(sessionid, data)
+    conns[sessionid] = nil
+    print("close ", sessionid, data)
+end
+
+socket_handler[6] = function(sessionid, data)
+    print("logic error ", sessionid, data)
+end
+
+socket_handler[7] = function(sessionid, data)
+    print("send high watermark ", sessionid, data)
+end
+
+socket_handler[8] = function(sessionid, data)
+    print("send low watermark ", sessionid, data)
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg:sender(), msg:bytes())
+            end
+        end
+    })
+end)
@@ -0,0 +1,123 @@
+local moon = require("moon")
+
+--udp：server回显收到的消息，client每10ms发送batch条消息，共count条，检查顺序和丢失并输出往返延迟
+--network配置transport为udp，arq为true时是可靠有序的会话(KCP风格)，false时是原始数据报。配合udprelay.py模拟丢包和延迟
+
+local network = moon.get_component_udp("network")
+
+local role = "server"
+local ip = "127.0.0.1"
+local port = "12355"
+local count = 5000
+local batch = 10
+local size = 64
+local mode = "raw"
+
+moon.init(function(config)
+    role = config.role or role
+    ip = config.network.ip
+    port = tostring(config.target_port or config.network.port)
+    count = config.count or count
+    batch = config.batch or batch
+    size = config.size or size
+    mode = config.network.arq and "arq" or "raw"
+    return true
+end)
+
+local socket_handler = {}
+
+local function server()
+    socket_handler[2] = function(msg)
+        print("udp accept", msg:sender(), msg:bytes())
+    end
+
+    socket_handler[3] = function(msg)
+        network:send(msg:sender(), msg:bytes())
+    end
+
+    socket_handler[4] = function(msg)
+        print("udp close", msg:sender(), msg:bytes())
+    end
+
+    socket_handler[6] = function(msg)
+        print("udp error", msg:sender(), msg:bytes())
+    end
+end
+
+local function client()
+    local connid = network:connect(ip, port)
+    assert(connid ~= 0, "udp connect failed")
+
+    local padding = string.rep("x", size)
+    local sent = 0
+    local received = 0
+    local disorder = 0
+    local expect = 1
+    local rtts = {}
+    local start = moon.millsecond()
+
+    local function report()
+        table.sort(rtts)
+        local function pct(p)
+            return rtts[math.max(1, math.floor(#rtts * p))] or 0
+        end
+        print(string.format("udp %s: sent %d received %d lost %d out of order %d, rtt(ms) p50 %d p99 %d max %d, %d ms",
+            mode, sent, received, sent - received, disorder,
+            pct(0.5), pct(0.99), rtts[#rtts] or 0, moon.millsecond() - start))
+    end
+
+    socket_handler[3] = function(msg)
+        local seq, ts = msg:bytes():match("^(%d+)|(%d+)|")
+        seq = tonumber(seq)
+        received = received + 1
+        if seq < expect then
+            disorder = disorder + 1
+        else
+            expect = seq + 1
+        end
+        rtts[#rtts + 1] = moon.millsecond() - tonumber(ts)
+        if received == count then
+            report()
+        end
+    end
+
+    socket_handler[6] = function(msg)
+        print("udp error", msg:bytes())
+    end
+
+    moon.repeated(10, (count + batch - 1) // batch, function()
+        for _ = 1, math.min(batch, count - sent) do
+            sent = sent + 1
+            network:send(connid, sent.."|"..moon.millsecond().."|"..padding)
+        end
+        if sent == count then
+            --datagrams lost without arq, report what arrived
+            moon.repeated(2000, 1, function()
+                if received < count then
+                    report()
+                end
+            end)
+        end
+    end)
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg)
+            end
+        end
+    })
+
+    if role == "server" then
+        server()
+    else
+        client()
+    end
+end)
@@ -0,0 +1,61 @@
+# -*- coding:utf-8 -*-
+# udp中继，模拟丢包、延迟和乱序。client发往listen_port的数据报转发给target_port，回复转发给client
+# usage: python udprelay.py listen_port target_port [loss% delay_ms jitter_ms]
+import heapq
+import random
+import select
+import socket
+import sys
+import time
+
+
+def main():
+    listen_port = int(sys.argv[1])
+    target = ("127.0.0.1", int(sys.argv[2]))
+    loss = float(sys.argv[3]) / 100 if len(sys.argv) > 3 else 0.1
+    delay = float(sys.argv[4]) / 1000 if len(sys.argv) > 4 else 0.02
+    jitter = float(sys.argv[5]) / 1000 if len(sys.argv) > 5 else 0.005
+
+    front = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    front.bind(("127.0.0.1", listen_port))
+    back = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    back.bind(("127.0.0.1", 0))
+    client = None
+    pending = []
+    seq = 0
+    stats = {"forward": 0, "drop": 0}
+
+    print("relay %d -> %d loss %.0f%% delay %.0fms jitter %.0fms" % (listen_port, target[1], loss * 100, delay * 1000, jitter * 1000))
+    last_print = time.time()
+    while True:
+        now = time.time()
+        timeout = max(0.0, pending[0][0] - now) if pending else 0.5
+        readable, _, _ = select.select([front, back], [], [], timeout)
+        for s in readable:
+            data, addr = s.recvfrom(65536)
+            if s is front:
+                client = addr
+                out, dest = back, target
+            else:
+                if client is None:
+                    continue
+                out, dest = front, client
+            if random.random() < loss:
+                stats["drop"] += 1
+                continue
+            seq += 1
+            heapq.heappush(pending, (time.time() + delay + random.uniform(0, jitter), seq, out, dest, data))
+
+        now = time.time()
+        while pending and pending[0][0] <= now:
+            _, _, out, dest, data = heapq.heappop(pending)
+            out.sendto(data, dest)
+            stats["forward"] += 1
+
+        if now - last_print >= 5:
+            print("forward %d drop %d" % (stats["forward"], stats["drop"]))
+            last_print = now
+
+
+if __name__ == "__main__":
+    main()
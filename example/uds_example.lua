@@ -0,0 +1,112 @@
+local moon = require("moon")
+
+--tcp和unix domain socket对比：server回显收到的消息，client分别连接tcp端口和unix:路径
+--先一问一答测试往返延迟，再保持window条size字节的消息在途测试吞吐，最后输出unix相对tcp的比例
+
+local role = "server"
+local ip = "127.0.0.1"
+local port = "12357"
+local unix_path = "unix:moon_uds.sock"
+local seconds = 3
+local size = 4096
+local window = 64
+
+local socket_handler = {}
+
+local function server()
+    local network = moon.get_component_tcp("network")
+    socket_handler[3] = function(msg)
+        network:send(msg:sender(), msg:bytes())
+    end
+end
+
+local function client()
+    local network = moon.add_component_tcp("uds_client")
+
+    local function run(connid, data, inflight)
+        local count = 0
+        local bytes = 0
+        local outstanding = 0
+        local stop = moon.millsecond() + seconds * 1000
+        socket_handler[3] = function(msg)
+            count = count + 1
+            bytes = bytes + msg:size()
+            outstanding = outstanding - 1
+            if moon.millsecond() < stop then
+                network:send(connid, data)
+                outstanding = outstanding + 1
+            end
+        end
+        for _ = 1, inflight do
+            network:send(connid, data)
+            outstanding = outstanding + 1
+        end
+        while outstanding > 0 do
+            moon.co_wait(10)
+        end
+        return count, bytes
+    end
+
+    local function bench(name, addr, p)
+        network:async_connect(addr, p, moon.make_response())
+        local connid, err = coroutine.yield()
+        if not connid then
+            print(name, "connect failed", err)
+            return nil
+        end
+        connid = tonumber(connid)
+
+        local count = run(connid, "ping", 1)
+        local rtt = seconds * 1000000 / count
+        print(string.format("%-4s round trips %d, avg %.1f us", name, count, rtt))
+
+        local mcount, bytes = run(connid, string.rep("x", size), window)
+        local mps = mcount / seconds
+        local mbps = bytes / seconds / 1024 / 1024
+        print(string.format("%-4s %d bytes x %d in flight: %.0f msg/s, %.1f MB/s", name, size, window, mps, mbps))
+        network:close(connid)
+        return {rtt = rtt, mps = mps}
+    end
+
+    moon.start_coroutine(function()
+        local tcp = bench("tcp", ip, port)
+        local uds = bench("unix", unix_path, "")
+        if tcp and uds then
+            print(string.format("unix/tcp: latency %.0f%%, throughput %.0f%%", uds.rtt * 100 / tcp.rtt, uds.mps * 100 / tcp.mps))
+        end
+    end)
+end
+
+--client在另一个worker上，可能在server的start之前连上，所以server在init中准备好
+moon.init(function(config)
+    role = config.role or role
+    ip = config.ip or ip
+    port = tostring(config.port or port)
+    unix_path = config.unix_path or unix_path
+    seconds = config.seconds or seconds
+    size = config.size or size
+    window = config.window or window
+    if role == "server" then
+        server()
+    end
+    return true
+end)
+
+moon.register_protocol(
+{
+    name = "socket",
+    PTYPE = moon.PSOCKET,
+    pack = function(...) return ... end,
+    dispatch = function(msg)
+        local f = socket_handler[msg:subtype()]
+        if f then
+            f(msg)
+        end
+    end
+})
+
+moon.start(function()
+    if role == "client" then
+        client()
+    end
+end)
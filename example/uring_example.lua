@@ -0,0 +1,48 @@
+local moon = require("moon")
+
+--回显服务，比较epoll和io_uring两种网络后端(network.backend)，每秒输出回显的包数量。配合uringbench.py使用
+
+local network = moon.get_component_tcp("network")
+
+local echo = 0
+local conns = 0
+
+local socket_handler = {}
+
+socket_handler[2] = function(msg)
+    conns = conns + 1
+end
+
+socket_handler[3] = function(msg)
+    echo = echo + 1
+    network:send(msg:sender(), msg:bytes())
+end
+
+socket_handler[4] = function(msg)
+    conns = conns - 1
+end
+
+moon.start(function()
+    moon.register_protocol(
+    {
+        name = "socket",
+        PTYPE = moon.PSOCKET,
+        pack = function(...) return ... end,
+        dispatch = function(msg)
+            local f = socket_handler[msg:subtype()]
+            if f then
+                f(msg)
+            end
+        end
+    })
+
+    local prev = moon.millsecond()
+    moon.repeated(1000, -1, function()
+        local now = moon.millsecond()
+        if conns > 0 then
+            print(string.format("%s echo %.0f packets/s, %d connections", moon.name(), echo*1000/(now - prev), conns))
+        end
+        echo = 0
+        prev = now
+    end)
+end)
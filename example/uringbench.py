@@ -0,0 +1,192 @@
+# -*- coding:utf-8 -*-
+# usage: python uringbench.py port [connections] [seconds] [window] [size] [--pid server_pid]
+# 默认协议(2字节大端长度 + size字节数据)回显压测，每个连接保持window个包在途。配合 ./moon 25 使用，12358 epoll，12359 io_uring
+# 输出每秒回显的包数量。指定--pid时用ptrace统计服务端所有线程的系统调用，输出每个包的系统调用次数(跟踪会降低吞吐，这一轮的吞吐不作比较)
+import ctypes
+import os
+import selectors
+import signal
+import socket
+import struct
+import sys
+import time
+
+HOST = "127.0.0.1"
+
+PTRACE_SYSCALL = 24
+PTRACE_DETACH = 17
+PTRACE_SEIZE = 0x4206
+PTRACE_INTERRUPT = 0x4207
+PTRACE_GET_SYSCALL_INFO = 0x420e
+PTRACE_O_TRACESYSGOOD = 1
+PTRACE_EVENT_STOP = 128
+SYSCALL_INFO_ENTRY = 1
+
+# x86_64
+SYSCALL_NAMES = {
+    0: "read", 1: "write", 16: "ioctl", 7: "poll", 20: "writev", 19: "readv", 44: "sendto", 45: "recvfrom",
+    46: "sendmsg", 47: "recvmsg", 10: "mprotect", 202: "futex", 228: "clock_gettime", 230: "clock_nanosleep", 232: "epoll_wait",
+    233: "epoll_ctl", 281: "epoll_pwait", 288: "accept4", 426: "io_uring_enter", 441: "epoll_pwait2",
+}
+
+
+WALL = 0x40000000
+
+
+# 线程停下时收到的信号，继续运行时交还给它
+def stop_signal(status):
+    sig = os.WSTOPSIG(status)
+    if sig == (signal.SIGTRAP | 0x80) or (status >> 16) == PTRACE_EVENT_STOP:
+        return 0
+    return sig
+
+
+# 在子进程中运行：跟踪pid的所有线程seconds秒，向fd写入开始标记和结果
+def trace(pid, seconds, fd):
+    libc = ctypes.CDLL(None, use_errno=True)
+    libc.ptrace.argtypes = [ctypes.c_long, ctypes.c_long, ctypes.c_void_p, ctypes.c_void_p]
+    libc.ptrace.restype = ctypes.c_long
+    info = ctypes.create_string_buffer(88)
+
+    tids = [int(t) for t in os.listdir("/proc/%d/task" % pid)]
+    for tid in tids:
+        if libc.ptrace(PTRACE_SEIZE, tid, None, PTRACE_O_TRACESYSGOOD) != 0:
+            raise OSError(ctypes.get_errno(), "PTRACE_SEIZE %d" % tid)
+        libc.ptrace(PTRACE_INTERRUPT, tid, None, None)
+
+    counts = {}
+    total = 0
+    os.write(fd, b"S")
+    # 服务端的定时器保证一直有系统调用，每次停下时检查是否到时间
+    end = time.time() + seconds
+    while True:
+        tid, status = os.waitpid(-1, WALL)
+        if not os.WIFSTOPPED(status):
+            continue
+        if os.WSTOPSIG(status) == (signal.SIGTRAP | 0x80):
+            n = libc.ptrace(PTRACE_GET_SYSCALL_INFO, tid, ctypes.c_void_p(len(info)), info)
+            if n > 0 and info.raw[0] == SYSCALL_INFO_ENTRY:
+                nr = struct.unpack_from("Q", info.raw, 24)[0]
+                counts[nr] = counts.get(nr, 0) + 1
+                total += 1
+        if time.time() >= end:
+            break
+        libc.ptrace(PTRACE_SYSCALL, tid, None, stop_signal(status))
+
+    # 停下其余线程再detach
+    libc.ptrace(PTRACE_DETACH, tid, None, stop_signal(status))
+    left = set(tids)
+    left.discard(tid)
+    for tid in left:
+        libc.ptrace(PTRACE_INTERRUPT, tid, None, None)
+    while left:
+        tid, status = os.waitpid(-1, WALL)
+        if tid in left and os.WIFSTOPPED(status):
+            libc.ptrace(PTRACE_DETACH, tid, None, stop_signal(status))
+            left.discard(tid)
+
+    top = sorted(counts.items(), key=lambda kv: -kv[1])[:6]
+    os.write(fd, ("%d %s\n" % (total, ",".join("%s=%d" % (SYSCALL_NAMES.get(k, str(k)), v) for k, v in top))).encode())
+
+
+class Conn(object):
+    def __init__(self, sel, port, frame, window):
+        self.sock = socket.create_connection((HOST, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.frame = frame
+        self.sock.sendall(frame * window)
+        self.sock.setblocking(False)
+        self.buf = b""
+        sel.register(self.sock, selectors.EVENT_READ, self)
+
+    # 收到的完整包数量，每收到一个再发一个
+    def recv(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise RuntimeError("connection closed")
+        self.buf += data
+        n = 0
+        while len(self.buf) >= 2:
+            size = struct.unpack_from(">H", self.buf)[0]
+            if len(self.buf) < 2 + size:
+                break
+            self.buf = self.buf[2 + size:]
+            n += 1
+        if n > 0:
+            self.sock.setblocking(True)
+            self.sock.sendall(self.frame * n)
+            self.sock.setblocking(False)
+        return n
+
+
+def main():
+    args = [a for a in sys.argv[1:]]
+    pid = 0
+    if "--pid" in args:
+        i = args.index("--pid")
+        pid = int(args[i + 1])
+        del args[i:i + 2]
+    port = int(args[0]) if len(args) > 0 else 12358
+    nconn = int(args[1]) if len(args) > 1 else 16
+    seconds = int(args[2]) if len(args) > 2 else 10
+    window = int(args[3]) if len(args) > 3 else 8
+    size = int(args[4]) if len(args) > 4 else 64
+
+    frame = struct.pack(">H", size) + b"x" * size
+    sel = selectors.DefaultSelector()
+    conns = [Conn(sel, port, frame, window) for _ in range(nconn)]
+
+    tracer = None
+    if pid:
+        rfd, wfd = os.pipe()
+        tracer = os.fork()
+        if tracer == 0:
+            os.close(rfd)
+            trace(pid, max(1, seconds - 1), wfd)
+            os._exit(0)
+        os.close(wfd)
+        sel.register(rfd, selectors.EVENT_READ, None)
+
+    # 跟踪开始时和收到结果时已回显的包数量，结果：(包数量, 系统调用次数, 最多的几种)
+    state = {"begin": None, "result": None}
+
+    def on_trace(data, done):
+        if state["begin"] is None and data.startswith(b"S"):
+            state["begin"] = done
+            data = data[1:]
+        if data:
+            fields = data.decode().split()
+            state["result"] = (done - state["begin"], int(fields[0]), fields[1] if len(fields) > 1 else "")
+            return True
+        return False
+
+    done = 0
+    begin = time.time()
+    end = begin + seconds
+    while time.time() < end:
+        for key, _ in sel.select(1):
+            if key.data is None:
+                if on_trace(os.read(rfd, 4096), done):
+                    sel.unregister(rfd)
+                continue
+            done += key.data.recv()
+    elapsed = time.time() - begin
+    print("port %d: %d connections, window %d, %d bytes: %.0f msg/s" % (port, nconn, window, size, done / elapsed))
+
+    if tracer:
+        while state["result"] is None:
+            data = os.read(rfd, 4096)
+            if not data:
+                break
+            on_trace(data, done)
+        os.waitpid(tracer, 0)
+        if state["result"] and state["result"][0] > 0:
+            msgs, total, top = state["result"]
+            print("server syscalls: %d for %d msg, %.3f per msg (%s)" % (total, msgs, total / msgs, top))
+
+    for c in conns:
+        c.sock.close()
+
+
+if __name__ == "__main__":
+    main()
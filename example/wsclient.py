@@ -0,0 +1,70 @@
+# -*- coding:utf-8 -*-
+# usage: python wsclient.py [frame_size] [connections] [seconds]
+# websocket握手后持续发送frame_size字节的masked binary帧，配合 ./moon 19 测试服务端websocket接收吞吐
+import base64
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+HOST = "127.0.0.1"
+PORT = 12350
+
+frame_size = int(sys.argv[1]) if len(sys.argv) > 1 else 16384
+nconn = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+seconds = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+
+
+def make_frame(size):
+    key = os.urandom(4)
+    payload = bytes(i & 0xFF for i in range(size))
+    masked = bytes(b ^ key[i & 3] for i, b in enumerate(payload))
+    if size <= 125:
+        head = struct.pack(">BB", 0x82, 0x80 | size)
+    elif size <= 0xFFFF:
+        head = struct.pack(">BBH", 0x82, 0x80 | 126, size)
+    else:
+        head = struct.pack(">BBQ", 0x82, 0x80 | 127, size)
+    return head + key + masked
+
+
+frame = make_frame(frame_size)
+# 每次sendall发送约64KB
+chunk = frame * max(1, 65536 // len(frame))
+
+
+def handshake(s):
+    key = base64.b64encode(os.urandom(16)).decode()
+    req = ("GET / HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+           "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n") % (HOST, PORT, key)
+    s.sendall(req.encode())
+    resp = b""
+    while b"\r\n\r\n" not in resp:
+        data = s.recv(1024)
+        if not data:
+            raise RuntimeError("handshake failed")
+        resp += data
+    if b" 101 " not in resp.split(b"\r\n")[0]:
+        raise RuntimeError("handshake failed: %r" % resp)
+
+
+def run():
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((HOST, PORT))
+    handshake(s)
+    end = time.time() + seconds
+    sent = 0
+    while time.time() < end:
+        s.sendall(chunk)
+        sent += len(chunk) // len(frame)
+    s.close()
+    print("sent %d frames, %.0f frames/s, %.1f MB/s" % (sent, sent / float(seconds), sent * frame_size / float(seconds) / 1048576))
+
+
+threads = [threading.Thread(target=run) for _ in range(nconn)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
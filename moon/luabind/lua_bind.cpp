@@ -5,7 +5,10 @@
 #include "common/buffer_writer.hpp"
 #include "common/hash.hpp"
 #include "common/http_request.hpp"
+#include "common/http_response.hpp"
 #include "components/tcp/tcp.h"
+#include "components/http/http_client.h"
+#include "components/udp/udp.h"
 
 #include "message.hpp"
 #include "server.h"
@@ -16,6 +19,10 @@
 
 #include "services/lua_service.h"
 
+extern "C" {
+    #include "lua53/lstring.h"
+}
+
 
  //WRAP_FUNCTION : http://sol2.readthedocs.io/en/latest/performance.html
 #define WRAP_FUNCTION(f) sol::c_call<sol::wrap<decltype(f),(f)>>
@@ -55,6 +62,11 @@ const lua_bind & lua_bind::bind_util() const
     lua.set_function("millsecond", WRAP_FUNCTION(&time::millsecond));
     lua.set_function("sleep", [](int64_t ms) { thread_sleep(ms); });
     lua.set_function("hash_string", [](const std::string& s) { return moon::hash_range(s.begin(), s.end()); });
+    lua.set_function("atom", [](string_view_t name) { return header_atoms().intern(name); });
+    lua.set_function("pool_stats", []() {
+        auto s = block_pool::local_stats();
+        return std::make_tuple(s.allocs, s.hits, s.heap_allocs, s.frees, s.heap_frees, s.cached_bytes);
+    });
 
     lua_getglobal(lua.lua_state(), "table");
     lua_pushcclosure(lua.lua_state(), new_table, 0);
@@ -81,6 +93,48 @@ const lua_bind & lua_bind::bind_log(moon::log* logger) const
     return *this;
 }
 
+static int atom_cache_key = 0;
+
+//atom headers become shared short strings, cached per lua state by atom id
+static int message_header(lua_State* L)
+{
+    message* m = sol::stack::get<message*>(L, 1);
+    uint32_t atom = m->header_atom();
+    if (0 == atom)
+    {
+        const auto& header = m->header();
+        lua_pushlstring(L, header.data(), header.size());
+        return 1;
+    }
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &atom_cache_key);
+    if (lua_type(L, -1) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &atom_cache_key);
+    }
+
+    if (lua_rawgeti(L, -1, atom) == LUA_TNIL)
+    {
+        lua_pop(L, 1);
+        auto& atoms = header_atoms();
+        const void* s = atoms.extra(atom);
+        if (nullptr == s)
+        {
+            const auto& name = atoms.name(atom);
+            s = luaS_sharedshrstr(name.data(), name.size());
+            atoms.set_extra(atom, s);
+        }
+        lua_pushsharedstring(L, s);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, atom);
+    }
+    lua_remove(L, -2);
+    return 1;
+}
+
 static void redirect_message(message* m, const moon::string_view_t& header, uint32_t receiver)
 {
     if (header.size() != 0)
@@ -99,7 +153,7 @@ const lua_bind & lua_bind::bind_message() const
         , "receiver", WRAP_FUNCTION(&message::receiver)
         , "type", WRAP_FUNCTION(&message::type)
         , "subtype", WRAP_FUNCTION(&message::subtype)
-        , "header", WRAP_FUNCTION(&message::header)
+        , "header", message_header
         , "bytes", WRAP_FUNCTION(&message::bytes)
         , "size", WRAP_FUNCTION(&message::size)
         , "subbytes", WRAP_FUNCTION(&message::subbytes)
@@ -115,11 +169,22 @@ const lua_bind& lua_bind::bind_service(lua_service* s) const
 
     lua.set("null", (void*)(server_));
 
-    auto broadcast = [server_](uint32_t sender, const buffer_ptr_t & data, uint8_t type)
+    //atom: header atom id from atom(), the header string is ignored when it is given
+    auto send = [server_](uint32_t sender, uint32_t receiver, const message_ptr_t& msg, const lua_header& header, int32_t responseid, uint8_t type, sol::optional<uint32_t> atom)
+    {
+        string_view_t str = header.str;
+        if (atom && 0 != *atom)
+        {
+            msg->set_header_atom(*atom);
+            str = string_view_t{};
+        }
+        server_->send(sender, receiver, msg, str, responseid, type);
+    };
+
+    auto publish = [server_](uint32_t sender, const string_view_t& topic, const message_ptr_t & msg, uint8_t type)
     {
-        auto msg = message::create(data);
         msg->set_type(type);
-        server_->broadcast(sender, msg);
+        server_->publish(sender, topic, msg);
     };
 
     lua.set_function("name", &lua_service::name, s);
@@ -128,6 +193,10 @@ const lua_bind& lua_bind::bind_service(lua_service* s) const
     lua.set_function("make_cache", &lua_service::make_cache, s);
     lua.set_function("add_component_tcp", &lua_service::add_component_tcp, s);
     lua.set_function("get_component_tcp", &lua_service::get_component_tcp, s);
+    lua.set_function("add_component_http", &lua_service::add_component_http, s);
+    lua.set_function("get_component_http", &lua_service::get_component_http, s);
+    lua.set_function("add_component_udp", &lua_service::add_component_udp, s);
+    lua.set_function("get_component_udp", &lua_service::get_component_udp, s);
     lua.set_function("remove_component", &lua_service::remove, s);
     lua.set_function("set_init", &lua_service::set_init,s);
     lua.set_function("set_start", &lua_service::set_start,s);
@@ -135,10 +204,14 @@ const lua_bind& lua_bind::bind_service(lua_service* s) const
     lua.set_function("set_dispatch", &lua_service::set_dispatch,s);
     lua.set_function("set_destroy", &lua_service::set_destroy,s);
     lua.set_function("memory_use", &lua_service::memory_use, s);
-    lua.set_function("send", &server::send, server_);
-    lua.set_function("new_service", &server::new_service, server_);
+    lua.set_function("send", send);
+    lua.set_function("new_service", [server_](const std::string& service_type, bool unique, bool shareth, int workerid, const std::string& config, const std::string& policy, const std::string& colocate)->uint32_t {
+        return server_->new_service(service_type, unique, shareth, workerid, config, placement_from_string(policy), colocate);
+    });
     lua.set_function("runcmd", &server::runcmd, server_);
-    lua.set_function("broadcast", broadcast);
+    lua.set_function("publish", publish);
+    lua.set_function("subscribe", &lua_service::subscribe, s);
+    lua.set_function("unsubscribe", &lua_service::unsubscribe, s);
     lua.set_function("workernum", &server::workernum, server_);
     lua.set_function("local_db", &server::local_db, server_);
     lua.set_function("unique_service", &server::get_unique_service, server_);
@@ -162,9 +235,42 @@ const lua_bind & lua_bind::bind_socket() const
         , "read", WRAP_FUNCTION(&moon::tcp::read)
         , "send", WRAP_FUNCTION(&moon::tcp::send)
         , "send_message", WRAP_FUNCTION(&moon::tcp::send_message)
+        , "send_http", WRAP_FUNCTION(&moon::tcp::send_http)
+        , "multicast", [](moon::tcp& t, const sol::table& connids, const moon::buffer_ptr_t& data) {
+            std::vector<uint32_t> ids;
+            ids.reserve(connids.size());
+            for (size_t i = 1; i <= connids.size(); ++i)
+            {
+                ids.push_back(connids.get<uint32_t>(i));
+            }
+            return t.multicast(ids, data);
+        }
         , "setprotocol", WRAP_FUNCTION(&moon::tcp::setprotocol)
         , "settimeout", WRAP_FUNCTION(&moon::tcp::settimeout)
+        , "settimeoutprecision", WRAP_FUNCTION(&moon::tcp::settimeoutprecision)
         , "setnodelay", WRAP_FUNCTION(&moon::tcp::setnodelay)
+        , "setsendlimit", WRAP_FUNCTION(&moon::tcp::setsendlimit)
+        , "setshards", WRAP_FUNCTION(&moon::tcp::setshards)
+        , "setiothread", WRAP_FUNCTION(&moon::tcp::setiothread)
+        , "setbackend", WRAP_FUNCTION(&moon::tcp::setbackend)
+        , "setmaxmessage", WRAP_FUNCTION(&moon::tcp::setmaxmessage)
+        , "setstreamsize", WRAP_FUNCTION(&moon::tcp::setstreamsize)
+        , "queued_bytes", WRAP_FUNCTION(&moon::tcp::queued_bytes)
+        , "wait_writable", WRAP_FUNCTION(&moon::tcp::wait_writable)
+        );
+
+    lua.new_usertype<moon::udp>("udp"
+        , sol::call_constructor, sol::no_constructor
+        , "setmode", WRAP_FUNCTION(&moon::udp::setmode)
+        , "settimeout", WRAP_FUNCTION(&moon::udp::settimeout)
+        , "setmtu", WRAP_FUNCTION(&moon::udp::setmtu)
+        , "setwindow", WRAP_FUNCTION(&moon::udp::setwindow)
+        , "setarq", WRAP_FUNCTION(&moon::udp::setarq)
+        , "listen", WRAP_FUNCTION(&moon::udp::listen)
+        , "connect", WRAP_FUNCTION(&moon::udp::connect)
+        , "send", WRAP_FUNCTION(&moon::udp::send)
+        , "close", WRAP_FUNCTION(&moon::udp::close)
+        , "waiting", WRAP_FUNCTION(&moon::udp::waiting)
         );
     return *this;
 }
@@ -179,10 +285,34 @@ const lua_bind & lua_bind::bind_http() const
     lua.new_usertype<moon::http_request>("http_request"
         , sol::constructors<sol::types<>>()
         , "parse", WRAP_FUNCTION(&moon::http_request::parse_string)
+        , "parse_message", [](moon::http_request& r, message* m) { return r.parse(m->bytes()); }
+        , "header", WRAP_FUNCTION(&moon::http_request::get_header)
+        , "keep_alive", WRAP_FUNCTION(&moon::http_request::keep_alive)
         , "method",sol::readonly(&moon::http_request::method)
         , "path", sol::readonly(&moon::http_request::path)
         , "query_string", sol::readonly(&moon::http_request::query_string)
         , "http_version", sol::readonly(&moon::http_request::http_version)
+        , "body", sol::readonly(&moon::http_request::body)
+        );
+
+    lua.new_usertype<moon::http_response>("http_response"
+        , sol::constructors<sol::types<>>()
+        , "parse", WRAP_FUNCTION(&moon::http_response::parse_string)
+        , "header", WRAP_FUNCTION(&moon::http_response::get_header)
+        , "status_code", sol::readonly(&moon::http_response::status_code)
+        , "http_version", sol::readonly(&moon::http_response::http_version)
+        , "reason", sol::readonly(&moon::http_response::reason)
+        , "body", sol::readonly(&moon::http_response::body)
+        );
+
+    lua.new_usertype<moon::http_client>("http_client"
+        , sol::call_constructor, sol::no_constructor
+        , "setmaxconn", WRAP_FUNCTION(&moon::http_client::setmaxconn)
+        , "setpipeline", WRAP_FUNCTION(&moon::http_client::setpipeline)
+        , "settimeout", WRAP_FUNCTION(&moon::http_client::settimeout)
+        , "setmaxbody", WRAP_FUNCTION(&moon::http_client::setmaxbody)
+        , "request", WRAP_FUNCTION(&moon::http_client::request)
+        , "connections", WRAP_FUNCTION(&moon::http_client::connections)
         );
 
     return *this;
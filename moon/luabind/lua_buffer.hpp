@@ -2,11 +2,27 @@
 #include "sol.hpp"
 #include "message.hpp"
 #include "lua_serialize.hpp"
+
+namespace moon
+{
+    //message header passed from lua: nil, string, or number(converted to its string form)
+    struct lua_header
+    {
+        string_view_t str;
+    };
+}
+
 namespace sol
 {
     template <>
     struct lua_size<moon::buffer_ptr_t> : std::integral_constant<int, 1> {};
 
+    template <>
+    struct lua_size<moon::message_ptr_t> : std::integral_constant<int, 1> {};
+
+    template <>
+    struct lua_size<moon::lua_header> : std::integral_constant<int, 1> {};
+
     namespace stack {
         template <>
         struct checker<moon::buffer_ptr_t> {
@@ -56,6 +72,81 @@ namespace sol
             }
         };
 
+        template <>
+        struct checker<moon::message_ptr_t> {
+            template <typename Handler>
+            static bool check(lua_State* L, int index, Handler&& handler, record& tracking) {
+                return checker<moon::buffer_ptr_t>::check(L, index, std::forward<Handler>(handler), tracking);
+            }
+        };
+
+        //build the message directly from lua data, no intermediate shared buffer
+        template <>
+        struct getter<moon::message_ptr_t> {
+            static moon::message_ptr_t get(lua_State* L, int index, record& tracking) {
+                tracking.use(1);
+                type t = type_of(L, index);
+                if (t == type::nil)
+                {
+                    return moon::message::create(0);
+                }
+
+                if (t == type::string)
+                {
+                    std::size_t len;
+                    auto str = lua_tolstring(L, index, &len);
+                    auto msg = moon::message::create(len);
+                    msg->get_buffer()->write_back(str, 0, len);
+                    return msg;
+                }
+
+                if (t == type::userdata || t == type::lightuserdata)
+                {
+                    moon::buffer* p = static_cast<moon::buffer*>(lua_touserdata(L, index));
+                    auto msg = moon::message::create(std::move(*p));
+                    delete p;
+                    return msg;
+                }
+
+                luaL_error(L, "get message only support string or void*(buffer*)");
+                return nullptr;
+            }
+        };
+
+        template <>
+        struct checker<moon::lua_header> {
+            template <typename Handler>
+            static bool check(lua_State* L, int index, Handler&& handler, record& tracking) {
+                tracking.use(1);
+                type t = type_of(L, index);
+                if (t == type::nil || t == type::string || t == type::number)
+                {
+                    return true;
+                }
+                else
+                {
+                    handler(L, index, type::string, t);
+                    return false;
+                }
+            }
+        };
+
+        template <>
+        struct getter<moon::lua_header> {
+            static moon::lua_header get(lua_State* L, int index, record& tracking) {
+                tracking.use(1);
+                moon::lua_header h;
+                type t = type_of(L, index);
+                if (t == type::string || t == type::number)
+                {
+                    std::size_t len;
+                    auto str = lua_tolstring(L, index, &len);
+                    h.str = moon::string_view_t{ str,len };
+                }
+                return h;
+            }
+        };
+
         template <>
         struct pusher<moon::buffer_ptr_t> {
             static int push(lua_State* L, const moon::buffer_ptr_t& buf) {
@@ -157,18 +157,23 @@ int main(int argc, char*argv[])
             server_.set_env("outer_host", c->outer_host);
             server_.set_env("server_config", scfg.config());
 
+            server_.event_wakeup(c->wakeup == "event");
+            server_.work_steal(c->scheduler == "steal");
+            server_.service_quantum(c->quantum_count, c->quantum_time);
+            server_.service_placement(placement_from_string(c->placement));
+            server_.io_threads(static_cast<uint32_t>(c->io_thread));
             server_.init(c->thread, c->log);
             server_.logger()->set_level(c->loglevel);
             for (auto&s : c->services)
             {
-                MOON_CHECK(0 != server_.new_service(s.type, s.unique, s.shared, s.threadid, s.config), "new_service failed");
+                MOON_CHECK(0 != server_.new_service(s.type, s.unique, s.shared, s.threadid, s.config, placement_from_string(s.placement), s.colocate), "new_service failed");
             }
 
             if (!c->startup.empty())
             {
                 MOON_CHECK(moon::path::extension(c->startup) == ".lua", "startup file must be lua script.");
-                module.set_function("new_service", [c, &server_](const std::string& service_type, bool unique, bool shareth, int workerid, const std::string& config)->uint32_t {
-                    return server_.new_service(service_type, unique, shareth, workerid, config);
+                module.set_function("new_service", [c, &server_](const std::string& service_type, bool unique, bool shareth, int workerid, const std::string& config, const std::string& policy, const std::string& colocate)->uint32_t {
+                    return server_.new_service(service_type, unique, shareth, workerid, config, placement_from_string(policy), colocate);
                 });
                 lua.script_file(c->startup);
             }
@@ -15,6 +15,8 @@ namespace moon
         bool unique;
         bool shared;
         int32_t threadid;
+        std::string placement;
+        std::string colocate;
         std::string type;
         std::string name;
         std::string config;
@@ -24,7 +26,13 @@ namespace moon
     {
         int32_t sid;
         int32_t thread;
+        int32_t io_thread;
         std::string loglevel;
+        std::string wakeup;
+        std::string scheduler;
+        uint32_t quantum_count;
+        int64_t quantum_time;
+        std::string placement;
         std::string name;
         std::string outer_host;
         std::string inner_host;
@@ -95,9 +103,19 @@ namespace moon
                     scfg.outer_host = rapidjson::get_value<std::string>(&c, "outer_host", "*");
                     scfg.inner_host = rapidjson::get_value<std::string>(&c, "inner_host", "127.0.0.1");
                     scfg.thread = rapidjson::get_value<int32_t>(&c, "thread", std::thread::hardware_concurrency());
+                    scfg.io_thread = rapidjson::get_value<int32_t>(&c, "io_thread", 0);
+                    MOON_CHECK(scfg.io_thread >= 0, "Server config format error: io_thread must >= 0");
                     scfg.startup = rapidjson::get_value<std::string>(&c, "startup");
                     scfg.log = rapidjson::get_value<std::string>(&c, "log");
                     scfg.loglevel = rapidjson::get_value<std::string>(&c, "loglevel", "DEBUG");
+                    scfg.wakeup = rapidjson::get_value<std::string>(&c, "wakeup", "tick");
+                    MOON_CHECK(scfg.wakeup == "tick" || scfg.wakeup == "event", "Server config format error: wakeup must be tick or event");
+                    scfg.scheduler = rapidjson::get_value<std::string>(&c, "scheduler", "static");
+                    MOON_CHECK(scfg.scheduler == "static" || scfg.scheduler == "steal", "Server config format error: scheduler must be static or steal");
+                    scfg.quantum_count = static_cast<uint32_t>(rapidjson::get_value<int32_t>(&c, "quantum_count", 64));
+                    scfg.quantum_time = rapidjson::get_value<int64_t>(&c, "quantum_time", 1000);
+                    scfg.placement = rapidjson::get_value<std::string>(&c, "placement", "round_robin");
+                    MOON_CHECK(placement::none != placement_from_string(scfg.placement), "Server config format error: placement must be round_robin, least_cpu, least_services or colocate");
                     if (scfg.log.find("#date") != std::string::npos)
                     {
                         time_t now = std::time(nullptr);
@@ -120,6 +138,9 @@ namespace moon
                             sc.unique = rapidjson::get_value<bool>(&s, "unique", false);
                             sc.shared = rapidjson::get_value<bool>(&s, "shared", true);
                             sc.threadid = rapidjson::get_value<int32_t>(&s, "threadid", 0);
+                            sc.placement = rapidjson::get_value<std::string>(&s, "placement");
+                            MOON_CHECK(sc.placement.empty() || placement::none != placement_from_string(sc.placement), "Server config format error: service placement must be round_robin, least_cpu, least_services or colocate");
+                            sc.colocate = rapidjson::get_value<std::string>(&s, "colocate");
                             sc.name = rapidjson::get_value<int32_t>(&s, "name");
                             rapidjson::StringBuffer buffer;
                             rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
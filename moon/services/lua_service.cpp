@@ -65,6 +65,30 @@ moon::tcp * lua_service::get_component_tcp(const std::string & name)
     return ((p != nullptr) ? p.get() : nullptr);
 }
 
+moon::http_client * lua_service::add_component_http(const std::string & name)
+{
+    auto p = add_component<moon::http_client>(name);
+    return ((p != nullptr) ? p.get() : nullptr);
+}
+
+moon::http_client * lua_service::get_component_http(const std::string & name)
+{
+    auto p = get_component<moon::http_client>(name);
+    return ((p != nullptr) ? p.get() : nullptr);
+}
+
+moon::udp * lua_service::add_component_udp(const std::string & name)
+{
+    auto p = add_component<moon::udp>(name);
+    return ((p != nullptr) ? p.get() : nullptr);
+}
+
+moon::udp * lua_service::get_component_udp(const std::string & name)
+{
+    auto p = get_component<moon::udp>(name);
+    return ((p != nullptr) ? p.get() : nullptr);
+}
+
 void lua_service::set_init(sol_function_t f)
 {
     init_ = f;
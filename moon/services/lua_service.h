@@ -3,6 +3,8 @@
 #include "log.h"
 #include "luabind/lua_bind.h"
 #include "components/tcp/tcp.h"
+#include "components/http/http_client.h"
+#include "components/udp/udp.h"
 
 class lua_service :public moon::service
 {
@@ -35,6 +37,14 @@ public:
 
     moon::tcp* get_component_tcp(const std::string& name);
 
+    moon::http_client* add_component_http(const std::string& name);
+
+    moon::http_client* get_component_http(const std::string& name);
+
+    moon::udp* add_component_udp(const std::string& name);
+
+    moon::udp* get_component_udp(const std::string& name);
+
 private:
     bool     init(const std::string& config) override;
 
@@ -28,22 +28,63 @@ namespace moon
             {
                 std::string compname = rapidjson::get_value<std::string>(&doc, "network.name");
                 auto timeout = rapidjson::get_value<int32_t>(&doc, "network.timeout", 0);
+                auto timeout_precision = rapidjson::get_value<int32_t>(&doc, "network.timeout_precision", static_cast<int32_t>(NET_TIMEOUT_PRECISION));
                 auto ip = rapidjson::get_value<std::string>(&doc, "network.ip");
                 auto port = rapidjson::get_value<std::string>(&doc, "network.port");
                 auto type = rapidjson::get_value<std::string>(&doc, "network.type","listen");
                 auto protocol = rapidjson::get_value<int32_t>(&doc, "network.protocol",0);
+                auto send_high = rapidjson::get_value<int64_t>(&doc, "network.send_high", 0);
+                auto send_low = rapidjson::get_value<int64_t>(&doc, "network.send_low", 0);
+                auto send_policy = rapidjson::get_value<std::string>(&doc, "network.send_policy", "block");
+                auto shards = rapidjson::get_value<int32_t>(&doc, "network.shards", 0);
+                auto iothread = rapidjson::get_value<bool>(&doc, "network.io_thread", false);
+                auto max_message_size = rapidjson::get_value<int64_t>(&doc, "network.max_message_size", static_cast<int64_t>(WS_MAX_MESSAGE_SIZE));
+                auto stream_size = rapidjson::get_value<int64_t>(&doc, "network.stream_size", 0);
+                auto transport = rapidjson::get_value<std::string>(&doc, "network.transport", "tcp");
+                auto arq = rapidjson::get_value<bool>(&doc, "network.arq", false);
+                auto backend = rapidjson::get_value<std::string>(&doc, "network.backend", "epoll");
 
-                if (ip.empty() || port.empty())
+                //unix domain socket needs no port
+                if (ip.empty() || (port.empty() && unix_endpoint_path(ip).empty()))
                 {
                     CONSOLE_ERROR(s->logger(), "service %s add network component failed. ip or port is null", s->name());
                     return false;
                 }
 
+                if (transport == "udp")
+                {
+                    auto u = s->template add_component<moon::udp>(compname);
+                    u->setmode(arq ? udp_mode::udp_arq : udp_mode::udp_raw);
+                    u->settimeout(timeout);
+                    if (type == "listen")
+                    {
+                        u->listen(ip, port);
+                    }
+                    return true;
+                }
+
                 auto n = s->template add_component<moon::tcp>(compname);
                 n->setprotocol(protocol_type(protocol));
+                n->settimeoutprecision(timeout_precision);
                 n->settimeout(timeout);
+                auto policy = moon::send_policy::block;
+                if (send_policy == "drop")
+                {
+                    policy = moon::send_policy::drop;
+                }
+                else if (send_policy == "close")
+                {
+                    policy = moon::send_policy::close;
+                }
+                n->setsendlimit(static_cast<size_t>(send_high), static_cast<size_t>(send_low), policy);
+                n->setmaxmessage(static_cast<size_t>(max_message_size));
+                n->setstreamsize(static_cast<size_t>(stream_size));
                 if (type == "listen")
                 {
+                    //-1: one acceptor per worker
+                    n->setshards((shards < 0) ? std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(shards));
+                    n->setiothread(iothread);
+                    n->setbackend((backend == "io_uring") ? io_backend::io_uring : io_backend::epoll);
                     n->listen(ip, port);
                 }
             }
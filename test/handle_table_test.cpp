@@ -0,0 +1,165 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+//handle_table tests
+//usage: handle_test
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "common/handle_table.hpp"
+
+using namespace moon;
+
+#define CHECK(expr) do { if (!(expr)) { std::printf("%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #expr); std::exit(1); } } while (0)
+
+static void test_basic()
+{
+    handle_table<int> t;
+    int a = 1, b = 2;
+    uint32_t ha = t.create(&a);
+    uint32_t hb = t.create(&b);
+    CHECK(0 != ha && 0 != hb && ha != hb);
+    CHECK(&a == t.find(ha));
+    CHECK(&b == t.find(hb));
+    CHECK(2 == t.size());
+
+    CHECK(t.set(ha, &b));
+    CHECK(&b == t.find(ha));
+    CHECK(t.release(ha));
+    CHECK(!t.release(ha));
+    CHECK(nullptr == t.find(ha));
+    CHECK(!t.set(ha, &a));
+    CHECK(1 == t.size());
+    CHECK(nullptr == t.find(0));
+}
+
+//one service spawns and exits over and over, its old id must never resolve to a later service
+static void test_churn_one_slot()
+{
+    handle_table<int> t;
+    int v = 0;
+    uint32_t first = t.create(&v);
+    CHECK(t.release(first));
+
+    const size_t cycles = 4096 * 8;
+    for (size_t i = 0; i < cycles; ++i)
+    {
+        uint32_t h = t.create(&v);
+        CHECK(0 != h);
+        CHECK(h != first);
+        CHECK(nullptr == t.find(first));
+        CHECK(t.release(h));
+    }
+    CHECK(0 == t.size());
+}
+
+//released slots are reused in FIFO order once enough slots are free
+static void test_fifo_reuse()
+{
+    handle_table<int> t;
+    int v = 0;
+    std::vector<uint32_t> handles;
+    for (uint32_t i = 0; i < HANDLE_MIN_FREE + 10; ++i)
+    {
+        handles.push_back(t.create(&v));
+    }
+    for (auto h : handles)
+    {
+        CHECK(t.release(h));
+    }
+
+    //more than HANDLE_MIN_FREE slots are free, the released ones come back oldest first
+    for (size_t i = 0; i < 5; ++i)
+    {
+        uint32_t h = t.create(&v);
+        CHECK(handle_index(h) == handle_index(handles[i]));
+        CHECK(h != handles[i]);
+    }
+}
+
+//a full table returns 0, every live handle is unique
+static void test_full()
+{
+    handle_table<int> t;
+    int v = 0;
+    std::unordered_set<uint32_t> live;
+    for (;;)
+    {
+        uint32_t h = t.create(&v);
+        if (0 == h)
+        {
+            break;
+        }
+        CHECK(live.insert(h).second);
+    }
+    CHECK(HANDLE_INDEX_MASK == live.size());
+
+    uint32_t old = *live.begin();
+    CHECK(t.release(old));
+    uint32_t h = t.create(&v);
+    CHECK(0 != h && h != old);
+    CHECK(nullptr == t.find(old));
+}
+
+static void test_threads()
+{
+    handle_table<int> t;
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{ false };
+    for (int n = 0; n < 4; ++n)
+    {
+        threads.emplace_back([&t, &failed] {
+            int v = 0;
+            std::vector<uint32_t> mine;
+            for (int i = 0; i < 50000; ++i)
+            {
+                uint32_t h = t.create(&v);
+                if (0 == h || &v != t.find(h))
+                {
+                    failed = true;
+                    return;
+                }
+                mine.push_back(h);
+                if (mine.size() > 16)
+                {
+                    if (!t.release(mine.front()) || nullptr != t.find(mine.front()))
+                    {
+                        failed = true;
+                        return;
+                    }
+                    mine.erase(mine.begin());
+                }
+            }
+            for (auto h : mine)
+            {
+                t.release(h);
+            }
+        });
+    }
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+    CHECK(!failed);
+    CHECK(0 == t.size());
+}
+
+int main()
+{
+    test_basic();
+    test_churn_one_slot();
+    test_fifo_reuse();
+    test_full();
+    test_threads();
+    std::printf("handle_table: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,231 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2017 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+//mpsc_queue tests and contention benchmark
+//usage: mpsc_test              run the tests
+//       mpsc_test bench [producers] [count]   N producer threads push count nodes each, one consumer drains with pop_all
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "common/mpsc_queue.hpp"
+
+using namespace moon;
+
+struct node : public mpsc_node
+{
+    size_t producer = 0;
+    size_t seq = 0;
+};
+
+#define CHECK(expr) do { if (!(expr)) { std::printf("%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #expr); std::exit(1); } } while (0)
+
+static void test_fifo()
+{
+    mpsc_queue<node> q;
+    CHECK(nullptr == q.pop());
+    CHECK(0 == q.pop_all([](node*) {}));
+
+    std::vector<node> nodes(100);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i].seq = i;
+        q.push(&nodes[i]);
+    }
+
+    size_t expect = 0;
+    CHECK(nodes.size() == q.pop_all([&expect](node* n) { CHECK(n->seq == expect); ++expect; }));
+    CHECK(nullptr == q.pop());
+
+    //pop_all stops at the newest node seen on entry
+    q.push(&nodes[0]);
+    q.push(&nodes[1]);
+    size_t n = q.pop_all([&q, &nodes](node* v) {
+        if (v == &nodes[0])
+        {
+            q.push(&nodes[2]);
+        }
+    });
+    CHECK(2 == n);
+    CHECK(&nodes[2] == q.pop());
+    CHECK(nullptr == q.pop());
+}
+
+namespace moon
+{
+    struct mpsc_queue_tester
+    {
+        template<typename T>
+        static void push_stub(mpsc_queue<T>& q)
+        {
+            q.push_stub();
+        }
+    };
+}
+
+//pop relinks the stub behind its last node X. If B is pushed between pop's head_ load and the stub exchange,
+//pop returns X and leaves X->B->stub with head_ at the stub. pop_all must still return B.
+static void test_push_while_relinking_stub()
+{
+    mpsc_queue<node> q;
+    node x, b;
+    q.push(&x);
+    q.push(&b);
+    CHECK(&x == q.pop());
+    //the stub exchange that lost the race with the push of b
+    mpsc_queue_tester::push_stub(q);
+
+    CHECK(1 == q.pop_all([&b](node* n) { CHECK(n == &b); }));
+    CHECK(nullptr == q.pop());
+    CHECK(0 == q.pop_all([](node*) {}));
+
+    q.push(&x);
+    CHECK(1 == q.pop_all([&x](node* n) { CHECK(n == &x); }));
+}
+
+//one producer pushes a pair and waits until the consumer drained it, the consumer races the pushes with pop_all
+static void test_push_pairs(size_t rounds)
+{
+    mpsc_queue<node> q;
+    std::vector<node> nodes(rounds * 2);
+    std::atomic<size_t> pushed{ 0 };
+    std::atomic<size_t> popped{ 0 };
+    std::thread producer([&q, &nodes, &pushed, &popped, rounds] {
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            q.push(&nodes[i * 2]);
+            q.push(&nodes[i * 2 + 1]);
+            pushed.store(i * 2 + 2, std::memory_order_release);
+            while (popped.load(std::memory_order_acquire) < i * 2 + 2)
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    size_t n = 0;
+    size_t idle = 0;
+    while (n < rounds * 2)
+    {
+        bool linked = (pushed.load(std::memory_order_acquire) > n);
+        size_t count = q.pop_all([](node*) {});
+        n += count;
+        popped.store(n, std::memory_order_release);
+        //the pushes of the pair are complete, a stranded node is never returned
+        idle = (count == 0 && linked) ? idle + 1 : 0;
+        CHECK(idle < 3);
+        if (count == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(nullptr == q.pop());
+}
+
+static void test_producers(size_t producers, size_t count)
+{
+    mpsc_queue<node> q;
+    std::vector<node> nodes(producers * count);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&q, &nodes, p, count] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                node& n = nodes[p * count + i];
+                n.producer = p;
+                n.seq = i;
+                q.push(&n);
+            }
+        });
+    }
+
+    std::vector<size_t> next(producers, 0);
+    size_t total = producers * count;
+    size_t popped = 0;
+    while (popped < total)
+    {
+        popped += q.pop_all([&next](node* n) {
+            //per producer fifo
+            CHECK(n->seq == next[n->producer]);
+            ++next[n->producer];
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    CHECK(nullptr == q.pop());
+}
+
+static void bench(size_t producers, size_t count)
+{
+    mpsc_queue<node> q;
+    std::vector<node> nodes(producers * count);
+    std::atomic<bool> start{ false };
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&q, &nodes, &start, p, count] {
+            while (!start.load(std::memory_order_acquire)) {}
+            for (size_t i = 0; i < count; ++i)
+            {
+                q.push(&nodes[p * count + i]);
+            }
+        });
+    }
+
+    size_t total = producers * count;
+    size_t popped = 0;
+    size_t batches = 0;
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    while (popped < total)
+    {
+        size_t n = q.pop_all([](node*) {});
+        if (n > 0)
+        {
+            popped += n;
+            ++batches;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    std::printf("%zu producers, %zu nodes: %.3f s, %.0f nodes/s, %.1f nodes per pop_all\n"
+        , producers, total, sec, total / sec, double(total) / batches);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && 0 == std::strcmp(argv[1], "bench"))
+    {
+        size_t producers = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 4;
+        size_t count = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 1000000;
+        bench(producers, count);
+        return 0;
+    }
+
+    test_fifo();
+    test_push_while_relinking_stub();
+    test_push_pairs(100000);
+    test_producers(1, 100000);
+    test_producers(4, 100000);
+    test_producers(8, 50000);
+    std::printf("mpsc_queue: all tests passed\n");
+    return 0;
+}
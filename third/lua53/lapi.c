@@ -1037,6 +1037,16 @@ static void cloneproto (lua_State *L, Proto *f, const Proto *src) {
   }
 }
 
+/* push a string from luaS_sharedshrstr, reuse the copy of this state if it has one, so short string equality still holds */
+LUA_API void lua_pushsharedstring (lua_State *L, const void *s) {
+  TString *ts;
+  lua_lock(L);
+  ts = luaS_clonestring(L, cast(TString *, s));
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
 LUA_API void lua_clonefunction (lua_State *L, const void * fp) {
   LClosure *cl;
   LClosure *f = cast(LClosure *, fp);
@@ -400,6 +400,20 @@ luaS_expandshr(int n) {
   ATOM_ADD(&SSM.n, n);
 }
 
+/* intern a short string into SSM for the host (e.g. message header atoms), it is never collected */
+LUA_API const void *
+luaS_sharedshrstr(const char *str, size_t l) {
+  unsigned int h;
+  TString *ts;
+  if (l > LUAI_MAXSHORTLEN)
+    return NULL;
+  h = luaS_hash(str, l, 0);
+  ts = query_string(h, str, l);
+  if (ts)
+    return ts;
+  return add_string(h, str, l);
+}
+
 LUAI_FUNC TString *
 luaS_clonestring(lua_State *L, TString *ts) {
   unsigned int h;